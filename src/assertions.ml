@@ -56,21 +56,17 @@ module Assertions(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
   
   and branch cont1 cont2 =
     !stats#branch;
-    let oldForest = !currentForest in
-    let leftForest = ref [] in
-    let rightForest = ref [] in
-    oldForest := Node (BranchNode, rightForest)::Node (BranchNode, leftForest)::!oldForest;
-    currentForest := leftForest;
-    push_context (Branching LeftBranch);
-    execute_branch cont1;
-    pop_context ();
-    if !leftForest = [] then leftForest := [Node (SuccessNode, ref [])];
-    currentForest := rightForest;
-    push_context (Branching RightBranch);
-    execute_branch cont2;
-    pop_context ();
-    if !rightForest = [] then rightForest := [Node (SuccessNode, ref [])];
-    currentForest := oldForest;
+    forest_branch
+      begin fun () ->
+        push_context (Branching LeftBranch);
+        execute_branch cont1;
+        pop_context ()
+      end
+      begin fun () ->
+        push_context (Branching RightBranch);
+        execute_branch cont2;
+        pop_context ()
+      end;
     SymExecSuccess
   
   and assert_expr_split e h env l msg url = 
@@ -103,6 +99,9 @@ module Assertions(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
 
   let real_mul l t1 t2 =
     if t1 == real_unit then t2 else if t2 == real_unit then t1 else
+    match (real_lit_value t1, real_lit_value t2) with
+      (Some n1, Some n2) -> real_lit (mult_num n1 n2)
+    | _ ->
     let t = ctxt#mk_real_mul t1 t2 in
     if is_dummy_frac_term t1 || is_dummy_frac_term t2 then dummy_frac_terms := t::!dummy_frac_terms;
     t
@@ -120,7 +119,7 @@ module Assertions(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
       ((g1, literal1), (g2, literal2)) -> if literal1 && literal2 then g1 == g2 else definitely_equal g1 g2
   
   let assume_field h0 fparent fname frange fghost tp tv tcoef cont =
-    let (_, (_, _, _, _, symb, _, _)) = List.assoc (fparent, fname) field_pred_map in
+    let (_, (_, _, _, _, symb, _, _)) = lookup_field_pred fparent fname in
     if fghost = Real then begin
       match frange with
         Int (_, _) | PtrType _ ->
@@ -222,6 +221,34 @@ module Assertions(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
     | None ->
       static_error l (Printf.sprintf "Cannot produce points-to chunk for variable of type '%s'" (string_of_type type_)) None
 
+  (* Instance predicate assertions in method contracts are produced and consumed at every call of the method; their
+     predicate is looked up in the class and interface maps once per class and predicate name. Raises Not_found if the
+     type does not define the predicate. *)
+  let inst_pred_cache = Hashtbl.create 100
+  
+  let lookup_inst_pred tn g =
+    match Hashtbl.find_opt inst_pred_cache (tn, g) with
+      Some result -> result
+    | None ->
+      let result =
+        match try_assoc tn classmap1 with
+          Some (lcn, abstract, fin, methods, fds_opt, ctors, super, interfs, preds, pn, ilist) ->
+          let (_, pmap, _, symb, _) = List.assoc g preds in (pmap, symb)
+        | None ->
+          match try_assoc tn classmap0 with
+            Some {cpreds} ->
+            let (_, pmap, _, symb, _) = List.assoc g cpreds in (pmap, symb)
+          | None ->
+            match try_assoc tn interfmap1 with
+              Some (li, fields, methods, preds, interfs, pn, ilist) -> let (_, pmap, family, symb) = List.assoc g preds in (pmap, symb)
+            | None ->
+              let InterfaceInfo (li, fields, methods, preds, interfs) = List.assoc tn interfmap0 in
+              let (_, pmap, family, symb) = List.assoc g preds in
+              (pmap, symb)
+      in
+      Hashtbl.add inst_pred_cache (tn, g) result;
+      result
+
   let rec produce_asn_core_with_post tpenv h ghostenv env p coef size_first size_all (assuming: bool) cont_with_post: symexec_result =
     let cont h env ghostenv = cont_with_post h env ghostenv None in
     let with_context_helper cont =
@@ -235,7 +262,7 @@ module Assertions(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
     match p with
     | WPointsTo (l, WRead (lr, e, fparent, fname, frange, fstatic, fvalue, fghost), tp, rhs) ->
       if fstatic then
-        let (_, (_, _, _, _, symb, _, _)) = List.assoc (fparent, fname) field_pred_map in
+        let (_, (_, _, _, _, symb, _, _)) = lookup_field_pred fparent fname in
         evalpat (fghost = Ghost) ghostenv env rhs tp tp $. fun ghostenv env t ->
         produce_chunk h (symb, true) [] coef (Some 0) [t] None $. fun h ->
         cont h ghostenv env
@@ -265,7 +292,7 @@ module Assertions(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
         if not is_global_predref then 
           let Some term = try_assoc g#name env in ((term, false), pats0, pats, g#domain, None)
        else
-          begin match try_assoc g#name predfammap with
+          begin match try_lookup_predfam g#name with
             Some (_, _, _, declared_paramtypes, symb, _, _) -> ((symb, true), pats0, pats, g#domain, Some (g#name, declared_paramtypes))
           | None ->
             let PredCtorInfo (_, ps1, ps2, inputParamCount, body, funcsym) = List.assoc g#name predctormap in
@@ -312,21 +339,7 @@ module Assertions(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
       )
     | WInstPredAsn (l, e_opt, st, cfin, tn, g, index, pats) ->
         let (pmap, pred_symb) =
-          try
-          match try_assoc tn classmap1 with
-            Some (lcn, abstract, fin, methods, fds_opt, ctors, super, interfs, preds, pn, ilist) ->
-            let (_, pmap, _, symb, _) = List.assoc g preds in (pmap, symb)
-          | None ->
-            match try_assoc tn classmap0 with
-              Some {cpreds} ->
-              let (_, pmap, _, symb, _) = List.assoc g cpreds in (pmap, symb)
-            | None ->
-              match try_assoc tn interfmap1 with
-                Some (li, fields, methods, preds, interfs, pn, ilist) -> let (_, pmap, family, symb) = List.assoc g preds in (pmap, symb)
-              | None ->
-                let InterfaceInfo (li, fields, methods, preds, interfs) = List.assoc tn interfmap0 in
-                let (_, pmap, family, symb) = List.assoc g preds in
-                (pmap, symb)
+          try lookup_inst_pred tn g
           with Not_found -> assert_false h env l ("Definition of predicate " ^ g ^ " is missing from implementing class") None
         in
         let target = match e_opt with None -> List.assoc "this" env | Some e -> ev e in
@@ -415,13 +428,16 @@ module Assertions(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
     )
   
   let rec produce_asn_core tpenv h ghostenv env p coef size_first size_all (assuming: bool) cont: symexec_result =
-    produce_asn_core_with_post tpenv h ghostenv env p coef size_first size_all (assuming: bool) (fun h env ghostenv post -> cont h env ghostenv)
+    profile_phase_cps "produce" $. fun exit_phase ->
+    produce_asn_core_with_post tpenv h ghostenv env p coef size_first size_all (assuming: bool) (fun h env ghostenv post -> exit_phase (fun () -> cont h env ghostenv))
     
   let produce_asn tpenv h ghostenv (env: (string * termnode) list) p coef size_first size_all cont =
-    produce_asn_core_with_post tpenv h ghostenv env p coef size_first size_all false (fun h env ghostenv post -> cont h env ghostenv)
+    profile_phase_cps "produce" $. fun exit_phase ->
+    produce_asn_core_with_post tpenv h ghostenv env p coef size_first size_all false (fun h env ghostenv post -> exit_phase (fun () -> cont h env ghostenv))
   
   let produce_asn_with_post tpenv h ghostenv (env: (string * termnode) list) p coef size_first size_all cont =
-    produce_asn_core_with_post tpenv h ghostenv env p coef size_first size_all false cont
+    profile_phase_cps "produce" $. fun exit_phase ->
+    produce_asn_core_with_post tpenv h ghostenv env p coef size_first size_all false (fun h env ghostenv post -> exit_phase (fun () -> cont h env ghostenv post))
   
   (* Region: consumption of assertions *)
   
@@ -532,10 +548,28 @@ module Assertions(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
       if coef == real_unit && coefpat == real_unit_pat && coef0 == real_unit then cont chunk ghostenv env coef0 [] else
       let match_term_coefpat t =
         let t = real_mul l coef t in
+        match (real_lit_value t, real_lit_value coef0) with
+          (Some n, Some n0) ->
+          (* Both coefficients are literals: decide the cases below without the prover and count the queries they would have taken *)
+          if eq_num n n0 then begin
+            if t != coef0 then !stats#fractionQueriesAvoided 1;
+            cont chunk ghostenv env coef0 []
+          end else if eq_num (mult_num n (num_of_int 2)) n0 then begin
+            !stats#fractionQueriesAvoided 2;
+            let chunk' = Chunk (g', targs0, t, ts0, size0) in
+            cont chunk' ghostenv env t [chunk']
+          end else if sign_num n > 0 && lt_num n n0 then begin
+            !stats#fractionQueriesAvoided 4;
+            cont (Chunk (g', targs0, t, ts0, size0)) ghostenv env t [Chunk (g', targs0, real_lit (sub_num n0 n), ts0, size0)]
+          end else begin
+            !stats#fractionQueriesAvoided (if sign_num n > 0 then 4 else 3);
+            None
+          end
+        | _ ->
         if definitely_equal t coef0 then
           cont chunk ghostenv env coef0 []
         else
-          let half_coef0 = ctxt#mk_real_mul real_half coef0 in
+          let half_coef0 = match real_lit_value coef0 with Some n0 -> real_lit (div_num n0 (num_of_int 2)) | None -> ctxt#mk_real_mul real_half coef0 in
           if definitely_equal t half_coef0 then
             let chunk' = Chunk (g', targs0, half_coef0, ts0, size0) in
             cont chunk' ghostenv env half_coef0 [chunk']
@@ -593,11 +627,11 @@ module Assertions(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
     | Some v -> v
 
   let read_field h env l t fparent fname =
-    let (_, (_, _, _, _, f_symb, _, _)) = List.assoc (fparent, fname) field_pred_map in
+    let (_, (_, _, _, _, f_symb, _, _)) = lookup_field_pred fparent fname in
     lookup_points_to_chunk h env l f_symb t
   
   let read_static_field h env l fparent fname =
-    let (_, (_, _, _, _, f_symb, _, _)) = List.assoc (fparent, fname) field_pred_map in
+    let (_, (_, _, _, _, f_symb, _, _)) = lookup_field_pred fparent fname in
     match extract (function Chunk (g, targs, coef, arg0::args, size) when predname_eq (f_symb, true) g -> Some arg0 | _ -> None) h with
       None -> assert_false h env l ("No matching heap chunk: " ^ ctxt#pprint f_symb) None
     | Some (v, _) -> v
@@ -736,6 +770,96 @@ module Assertions(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
   
   let consume_chunk_recursion_depth = ref 0
   
+  (* Region: heap index *)
+  
+  (* consume_chunk_core finds the chunks of a literal predicate symbol through a heap index, which lists for each predicate
+     symbol the heap cells that start with a chunk of that symbol, in heap order. The cells whose chunk has a predicate that
+     is not a literal symbol may match any symbol; they are listed separately. Each cell is paired with its position counted
+     from the end of the heap, so that the entries for a heap's tail remain valid when chunks are added in front of it or when a
+     consume rebuilds the part of the heap before the consumed chunk. The index of such a heap is derived from the index of the
+     heap it came from rather than rebuilt; the indexes of the last few heaps are kept.
+     The index is not keyed on the first argument as well: an earlier chunk whose first argument is provably equal to, but not
+     the same term as, the required one must still be consumed in preference to a later one. *)
+  type heap_index = {
+    indexed_heap: termnode chunk list;
+    indexed_heap_length: int;
+    literal_buckets: (termnode * (int * termnode chunk list) list) list;
+    nonliteral_bucket: (int * termnode chunk list) list
+  }
+  
+  let heap_indexes: heap_index list ref = ref []
+  
+  let remember_heap_index index =
+    heap_indexes := index::(match !heap_indexes with i1::i2::i3::i4::i5::i6::i7::_ -> [i1; i2; i3; i4; i5; i6; i7] | is -> is)
+  
+  (* Adds the cells [cells], given in reverse heap order, to the buckets; the first one gets position [pos]. *)
+  let rec add_to_buckets literal_buckets nonliteral_bucket pos cells =
+    match cells with
+      [] -> (literal_buckets, nonliteral_bucket)
+    | (Chunk ((g, true), _, _, _, _)::_ as cell)::cells ->
+      let rec add buckets =
+        match buckets with
+          [] -> [(g, [(pos, cell)])]
+        | (g', entries)::buckets when g' == g -> (g, (pos, cell)::entries)::buckets
+        | bucket::buckets -> bucket::add buckets
+      in
+      add_to_buckets (add literal_buckets) nonliteral_bucket (pos + 1) cells
+    | cell::cells -> add_to_buckets literal_buckets ((pos, cell)::nonliteral_bucket) (pos + 1) cells
+  
+  (* Returns the first [n] cells of [h], in reverse order. *)
+  let front_cells n h =
+    let rec iter n cells h =
+      if n = 0 then cells else
+      match h with
+        [] -> cells
+      | _::h' -> iter (n - 1) (h::cells) h'
+    in
+    iter n [] h
+  
+  let heap_index h =
+    let find_index h = try_find (fun index -> index.indexed_heap == h) !heap_indexes in
+    match find_index h with
+      Some index -> index
+    | None ->
+      (* Chunks are typically produced onto the front of a heap that was indexed already. *)
+      let rec find_base k cells h' =
+        match find_index h' with
+          Some base -> Some (base, k, cells)
+        | None ->
+          match h' with
+            _::h'' when k < 8 -> find_base (k + 1) (h'::cells) h''
+          | _ -> None
+      in
+      let index =
+        match find_base 0 [] h with
+          Some (base, k, cells) ->
+          let (literal_buckets, nonliteral_bucket) = add_to_buckets base.literal_buckets base.nonliteral_bucket base.indexed_heap_length cells in
+          {indexed_heap=h; indexed_heap_length=base.indexed_heap_length + k; literal_buckets=literal_buckets; nonliteral_bucket=nonliteral_bucket}
+        | None ->
+          let cells = front_cells max_int h in
+          let (literal_buckets, nonliteral_bucket) = add_to_buckets [] [] 0 cells in
+          {indexed_heap=h; indexed_heap_length=List.length cells; literal_buckets=literal_buckets; nonliteral_bucket=nonliteral_bucket}
+      in
+      remember_heap_index index;
+      index
+  
+  (* Records the index of the heap [h'] that results from consuming the chunk at position [pos] of the indexed heap [index]:
+     the cells before it and the cell itself are dropped from the buckets, and the first [front_length] cells of [h'] are added. *)
+  let derive_heap_index index pos front_length h' =
+    let trim entries = match entries with (pos', _)::_ when pos' >= pos -> List.filter (fun (pos', _) -> pos' < pos) entries | _ -> entries in
+    let literal_buckets =
+      flatmap (fun ((g, entries) as bucket) -> match trim entries with [] -> [] | entries' when entries' == entries -> [bucket] | entries' -> [(g, entries')]) index.literal_buckets
+    in
+    let (literal_buckets, nonliteral_bucket) = add_to_buckets literal_buckets (trim index.nonliteral_bucket) pos (front_cells front_length h') in
+    remember_heap_index {indexed_heap=h'; indexed_heap_length=pos + front_length; literal_buckets=literal_buckets; nonliteral_bucket=nonliteral_bucket}
+  
+  (* Merges two lists of index entries that are in heap order. *)
+  let rec merge_index_entries entries1 entries2 =
+    match (entries1, entries2) with
+      ([], entries) | (entries, []) -> entries
+    | ((pos1, _) as entry1)::entries1', ((pos2, _) as entry2)::entries2' ->
+      if pos1 > pos2 then entry1::merge_index_entries entries1' entries2 else entry2::merge_index_entries entries1 entries2'
+  
   (** consume_chunk_core attempts to consume a chunk matching the specified predicate assertion from the specified heap.
       If no matching chunk is found in the heap, automation rules are tried (e.g. auto-open and auto-close rules).
       Parameters:
@@ -770,10 +894,35 @@ module Assertions(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
     let old_depth = !consume_chunk_recursion_depth in
     let rec consume_chunk_core_core h =
       begin fun cont ->
+      match g with
+        (g_symb, true) ->
+        (* The chunks of other literal predicate symbols would not match, so only the cells listed in the index for [g_symb]
+           and those of chunks with a non-literal predicate are tried, in heap order. *)
+        let index = heap_index h in
+        let entries = match try_assq g_symb index.literal_buckets with None -> [] | Some entries -> entries in
+        let rec iter entries =
+          match entries with
+            [] -> cont []
+          | (pos, (chunk::h' as cell))::entries ->
+            !stats#consumeChunkScan;
+            match_chunk ghostenv h' env env' l g targs coef coefpat inputParamCount pats tps0 tps chunk $. fun result ->
+            match result with
+              None -> iter entries
+            | Some (chunk, coef, ts, size, ghostenv, env, env', newChunks) ->
+              !stats#consumeChunkIndexHit;
+              let rec prefix hprefix h = if h == cell then hprefix else match h with chunk::h -> prefix (chunk::hprefix) h | [] -> assert false in
+              let hprefix = prefix [] h in
+              let h'' = newChunks @ hprefix @ h' in
+              derive_heap_index index pos (List.length newChunks + List.length hprefix) h'';
+              cont [(chunk, h'', coef, ts, size, ghostenv, env, env')]
+        in
+        iter (merge_index_entries entries index.nonliteral_bucket)
+      | _ ->
       let rec iter hprefix h =
         match h with
           [] -> cont []
         | chunk::h ->
+          !stats#consumeChunkScan;
           match_chunk ghostenv h env env' l g targs coef coefpat inputParamCount pats tps0 tps chunk $. fun result ->
           match result with
             None -> iter (chunk::hprefix) h
@@ -938,7 +1087,7 @@ module Assertions(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
     let points_to l coefpat e tp rhs =
       match e with
         WRead (lr, e, fparent, fname, frange, fstatic, fvalue, fghost) ->
-        let (_, (_, _, _, _, symb, _, _)) = List.assoc (fparent, fname) field_pred_map in
+        let (_, (_, _, _, _, symb, _, _)) = lookup_field_pred fparent fname in
         let (inputParamCount, pats) =
           if fstatic then
             (Some 0, [rhs])
@@ -965,7 +1114,7 @@ module Assertions(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
     let pred_asn l coefpat g is_global_predref targs pats0 pats =
       let (g_symb, pats0, pats, types) =
         if is_global_predref then
-           match try_assoc g#name predfammap with
+           match try_lookup_predfam g#name with
             Some (_, _, _, _, symb, _, _) -> ((symb, true), pats0, pats, g#domain)
           | None -> 
             let PredCtorInfo (_, ps1, ps2, inputParamCount, body, funcsym) = List.assoc g#name predctormap in
@@ -986,22 +1135,7 @@ module Assertions(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
       )
     in
     let inst_call_pred l coefpat e_opt tn g index pats =
-      let (pmap, pred_symb) =
-        match try_assoc tn classmap1 with
-          Some (lcn, abstract, fin, methods, fds_opt, ctors, super, interfs, preds, pn, ilist) ->
-          let (_, pmap, _, symb, _) = List.assoc g preds in (pmap, symb)
-        | None ->
-          match try_assoc tn classmap0 with
-            Some {cpreds} ->
-            let (_, pmap, _, symb, _) = List.assoc g cpreds in (pmap, symb)
-          | None ->
-            match try_assoc tn interfmap1 with
-              Some (li, fields, methods, preds, interfs, pn, ilist) -> let (_, pmap, family, symb) = List.assoc g preds in (pmap, symb)
-            | None ->
-              let InterfaceInfo (li, fields, methods, preds, interfs) = List.assoc tn interfmap0 in
-              let (_, pmap, family, symb) = List.assoc g preds in
-              (pmap, symb)
-      in
+      let (pmap, pred_symb) = lookup_inst_pred tn g in
       let target = match e_opt with None -> List.assoc "this" env | Some e -> ev e in
       let index = ev index in
       let types = ObjType tn::ObjType "java.lang.Class"::List.map snd pmap in
@@ -1105,16 +1239,19 @@ module Assertions(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
     )
   
   let rec consume_asn_core rules tpenv h ghostenv env env' p checkDummyFracs coef cont =
+    profile_phase_cps "consume" $. fun exit_phase ->
     consume_asn_core_with_post rules tpenv h ghostenv env env' p checkDummyFracs coef $. fun chunks h ghostenv env env' size_first post ->
-    cont chunks h ghostenv env env' size_first
+    exit_phase (fun () -> cont chunks h ghostenv env env' size_first)
   
   let consume_asn rules tpenv h ghostenv env p checkDummyFracs coef cont =
+    profile_phase_cps "consume" $. fun exit_phase ->
     consume_asn_core_with_post rules tpenv h ghostenv env [] p checkDummyFracs coef $. fun chunks h ghostenv env env' size_first post ->
-    cont chunks h ghostenv env size_first
+    exit_phase (fun () -> cont chunks h ghostenv env size_first)
 
   let rec consume_asn_with_post rules tpenv h ghostenv env p checkDummyFracs coef cont =
+    profile_phase_cps "consume" $. fun exit_phase ->
     consume_asn_core_with_post rules tpenv h ghostenv env [] p checkDummyFracs coef $. fun chunks h ghostenv env env' size_first post ->
-    cont chunks h ghostenv env size_first post
+    exit_phase (fun () -> cont chunks h ghostenv env size_first post)
   
   let term_of_pred_index =
     match language with
@@ -1196,7 +1333,7 @@ module Assertions(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
       match wbody with
         WPointsTo(_, WRead(lr, e, fparent, fname, frange, fstatic, fvalue, fghost), tp, v) ->
         if expr_is_fixed inputParameters e || fstatic then
-          let (_, (_, _, _, _, qsymb, _, _)) = List.assoc (fparent, fname) field_pred_map in
+          let (_, (_, _, _, _, qsymb, _, _)) = lookup_field_pred fparent fname in
           construct_edge qsymb coef None [] [] (if fstatic then [] else [e]) conds
         else
           []
@@ -1204,7 +1341,7 @@ module Assertions(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
         begin match try_assoc q#name xs with
           Some _ -> []
         | None ->
-          begin match try_assoc q#name predfammap with
+          begin match try_lookup_predfam q#name with
             Some (_, qtparams, _, qtps, qsymb, _, _) ->
             begin match q#inputParamCount with
               None -> assert false;
@@ -1234,22 +1371,7 @@ module Assertions(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
           end
         end
       | WInstPredAsn(l2, target_opt, static_type_name, static_type_finality, family_type_string, instance_pred_name, index, args) ->
-        let (pmap, qsymb) =
-          match try_assoc static_type_name classmap1 with
-            Some (lcn, abstract, fin, methods, fds_opt, ctors, super, interfs, preds, pn, ilist) ->
-            let (_, pmap, _, symb, _) = List.assoc instance_pred_name preds in (pmap, symb)
-          | None ->
-            match try_assoc static_type_name classmap0 with
-              Some {cpreds} ->
-              let (_, pmap, _, symb, _) = List.assoc instance_pred_name cpreds in (pmap, symb)
-            | None ->
-              match try_assoc static_type_name interfmap1 with
-                Some (li, fields, methods, preds, interfs, pn, ilist) -> let (_, pmap, family, symb) = List.assoc instance_pred_name preds in (pmap, symb)
-              | None ->
-                let InterfaceInfo (li, fields, methods, preds, interfs) = List.assoc static_type_name interfmap0 in
-                let (_, pmap, family, symb) = List.assoc instance_pred_name preds in
-                (pmap, symb)
-        in
+        let (pmap, qsymb) = lookup_inst_pred static_type_name instance_pred_name in
         if match target_opt with Some e -> expr_is_fixed inputParameters e | None -> true then begin
           let target = match target_opt with Some e -> Some e | None -> Some (WVar(l2, "this", LocalVar)) in
           construct_edge qsymb coef target [] [index] [] conds
@@ -1511,7 +1633,8 @@ module Assertions(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
                           | Some _ -> coef (* todo *)
                         in
                         let new_coef = match wanted_coef with Some coef -> coef | None -> new_coef in
-                        with_context (Executing (h, env, outer_l, ("Auto-closing predicate with coefficient " ^ ctxt#pprint new_coef))) $. fun () ->
+                        (* The coefficient is shown as a pseudo-variable, so that it is pretty-printed only if an error is reported (see pprint_context_stack). *)
+                        with_context (Executing (h, ("(coefficient)", new_coef)::env, outer_l, "Auto-closing predicate")) $. fun () ->
                         consume_asn rules tpenv h ghostenv env outer_wbody checkDummyFracs new_coef $. fun _ h ghostenv env2 size_first ->
                           let outputParams = drop (List.length outer_formal_input_args) outer_formal_args in
                           let outputArgs = List.map (fun (x, tp0) -> let tp = instantiate_type tpenv tp0 in (prover_convert_term (List.assoc x env2) tp0 tp)) outputParams in
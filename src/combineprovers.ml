@@ -36,10 +36,28 @@ type combination_strategy =
   | Sync                        (* Always ask both provers, this is
                                    useful for comparing the provers *)
   | Sequence                    (* Run the second prover only if the
-                                   first answers Unknown *)
-(* other strategies of interest:
-     - run the provers in parallel (if one answers unsat, stop the other one)
-     - run the provers in sequence but the first is stopped after a timeout *)
+                                   first answers Unknown, e.g. because
+                                   it gave up after sequence_time_budget *)
+(* Another strategy, which runs the provers in parallel, is
+   portfolio_context below. *)
+
+(* The time in seconds that the first prover gets for each assume and
+   query under the Sequence strategy; 0.0 means no limit. Set with the
+   -prover_time_budget command-line option. *)
+let sequence_time_budget = ref 0.0
+
+(* Runs f with a time budget of the given number of seconds (see
+   Proverapi.deadline); returns f's result and whether f ran out of
+   time. The prover is never interrupted: it gives up by itself, in a
+   consistent state, with a sound answer. *)
+let with_time_budget seconds f =
+  Proverapi.deadline := Perf.time () +. seconds;
+  Proverapi.deadline_exceeded := false;
+  let result =
+    try f () with e -> Proverapi.deadline := infinity; raise e
+  in
+  Proverapi.deadline := infinity;
+  (result, !Proverapi.deadline_exceeded)
 
 (* In Ocaml, we cannot directly pass a polymorphic function as
    argument but we can encapsulate it in a record. These are the
@@ -65,6 +83,7 @@ class ['a, 'b, 'c, 'd, 'e, 'f] combined_context (p1 : ('a, 'b, 'c) context)
        Right (r.f p2 a b)
     | (Left _, Right _) | (Right _, Left _) -> failwith "map2"
   in
+  let p1_timeout () = !Stats.stats#proverTimeout "P1" in
   let map3 (r : poly_map3) a b c = match (a, b, c) with
     | (Both (a1, a2), Both (b1, b2), Both (c1, c2)) ->
        Both (r.f p1 a1 b1 c1, r.f p2 a2 b2 c2)
@@ -158,13 +177,27 @@ object
     Printf.sprintf "<%s;%s>" s1 s2
   method pprint_sym (s1, s2) = Printf.sprintf "<%s;%s>" (p1#pprint_sym s1) (p2#pprint_sym s2)
   method pprint_sort (s1, s2) = Printf.sprintf "<%s;%s>" (p1#pprint_sort s1) (p2#pprint_sort s2)
-  method push = p1#push; p2#push
-  method pop = p1#pop; p2#pop
+  method push =
+    p1#push;
+    p2#push
+  method pop =
+    p1#pop;
+    p2#pop
   method assume = function
     | Both (t1, t2) -> begin
         match combination_strategy with
         | Sync ->
            combine_assume_result (p1#assume t1, p2#assume t2)
+        | Sequence when !sequence_time_budget > 0.0 ->
+           begin match with_time_budget !sequence_time_budget (fun () -> p1#assume t1) with
+           | (Unsat, _) ->
+              p2#assert_term t2; Unsat
+           | (Unknown, timed_out) ->
+              (* If the first prover ran out of time, it still assumed t1
+                 but may have missed an inconsistency. *)
+              if timed_out then p1_timeout ();
+              p2#assume t2
+           end
         | Sequence ->
            begin match p1#assume t1 with
            | Unknown ->
@@ -181,6 +214,11 @@ object
            let r1 = p1#query t1 in
            let r2 = p2#query t2 in
            r1 || r2
+        | Sequence when !sequence_time_budget > 0.0 ->
+           begin match with_time_budget !sequence_time_budget (fun () -> p1#query t1) with
+           | (true, _) -> true
+           | (false, timed_out) -> if timed_out then p1_timeout (); p2#query t2
+           end
         | Sequence ->
            (* Remark: the "||" operator is lazy *)
            p1#query t1 || p2#query t2
@@ -235,3 +273,79 @@ let combine
     : ('a * 'd, 'b * 'e, ('c, 'f) my_pair) context =
   (new combined_context p1 p2 combination_strategy
    : ('a, 'b, 'c, 'd, 'e, 'f) combined_context :> ('a * 'd, 'b * 'e, ('c, 'f) my_pair) context)
+
+(* Portfolio strategy: the second prover works on each assume and query in
+   the background (e.g. in a separate process) while the first prover
+   works on it in the foreground, and the first definite answer wins. The
+   first prover polls the second one's answer through
+   Proverapi.interrupted, and gives up as soon as the second prover has
+   settled the question; if the first prover settles it first, we abandon
+   the second prover's answer without waiting for it. We count which
+   prover settled each question first. *)
+class ['a, 'b, 'c, 'd, 'e, 'f] portfolio_context (p1 : ('a, 'b, 'c) context)
+        (p2: ('d, 'e, 'f) async_context) =
+object (self)
+  inherit ['a, 'b, 'c, 'd, 'e, 'f] combined_context p1 (p2 :> ('d, 'e, 'f) context) Sync as super
+  val mutable settled_by_p1 = 0
+  val mutable settled_by_p2 = 0
+  val mutable undecided = 0
+  (* Runs ask1 on the first prover while the second one works on the same
+     question; await2, abandon2 and ready2 are the second prover's
+     functions for it (see Proverapi.async_context), where await2 tells
+     whether the answer settles the question. *)
+  method private race ask1 (await2, abandon2, ready2) =
+    let answer2 = ref None in
+    let settled2 () =
+      match !answer2 with
+      | Some settled -> settled
+      | None ->
+         ready2 () && begin
+           let settled = await2 () in
+           answer2 := Some settled;
+           settled
+         end
+    in
+    let interrupted0 = !Proverapi.interrupted in
+    let deadline_exceeded0 = !Proverapi.deadline_exceeded in
+    Proverapi.interrupted := Some settled2;
+    Proverapi.deadline_exceeded := false;
+    let settled1 =
+      try ask1 () with e -> Proverapi.interrupted := interrupted0; raise e
+    in
+    Proverapi.interrupted := interrupted0;
+    Proverapi.deadline_exceeded := deadline_exceeded0;
+    if !answer2 = Some true then begin
+      settled_by_p2 <- settled_by_p2 + 1;
+      true
+    end else if settled1 then begin
+      if !answer2 = None then abandon2 ();
+      settled_by_p1 <- settled_by_p1 + 1;
+      true
+    end else if (match !answer2 with Some settled -> settled | None -> await2 ()) then begin
+      settled_by_p2 <- settled_by_p2 + 1;
+      true
+    end else begin
+      undecided <- undecided + 1;
+      false
+    end
+  method assume = function
+    | Both (t1, t2) ->
+       let (await2, abandon2, ready2) = p2#assume_async t2 in
+       let settled = self#race (fun () -> p1#assume t1 = Unsat) ((fun () -> await2 () = Unsat), abandon2, ready2) in
+       if settled then Unsat else Unknown
+    | Left _ | Right _ -> failwith "Combineprovers.assume"
+  method query = function
+    | Both (t1, t2) ->
+       self#race (fun () -> p1#query t1) (p2#query_async t2)
+    | Left _ | Right _ -> failwith "Combineprovers.query"
+  method stats =
+    let (s, l) = super#stats in
+    (Printf.sprintf "%s\nPortfolio: settled first by P1 %d times, settled first by P2 %d times, settled by neither %d times" s settled_by_p1 settled_by_p2 undecided, l)
+end
+
+let portfolio
+      (p1 : ('a, 'b, 'c) context)
+      (p2 : ('d, 'e, 'f) async_context)
+    : ('a * 'd, 'b * 'e, ('c, 'f) my_pair) context =
+  (new portfolio_context p1 p2
+   : ('a, 'b, 'c, 'd, 'e, 'f) portfolio_context :> ('a * 'd, 'b * 'e, ('c, 'f) my_pair) context)
@@ -328,6 +328,10 @@ let string_of_range_kind = function
   | CommentRange        -> "CommentRange"
   | ErrorRange          -> "ErrorRange"
 
+(* Call counters for Stats.profile_phase_sampled, shared by all lexers and preprocessors so that short files are sampled too. *)
+let lexing_samples = ref 0
+let preprocessing_samples = ref 0
+
 (** The lexer.
     @param reportShouldFail Function that will be called whenever a should-fail directive is found in the source code.
       Should-fail directives are of the form //~ and are used for writing negative VeriFast test inputs. See tests/errors.
@@ -787,17 +791,18 @@ let make_lexer_core keywords ghostKeywords startpos text reportRange inComment i
       None
     | _ -> (text_junk (); multiline_comment ())
   in
+  let next_item count =
+    try
+      match next_token () with
+        Some t -> Some (current_loc(), t)
+      | None -> None
+    with
+      Stream.Error msg when not exceptionOnError -> reportRange ErrorRange (current_loc()); Some (current_loc(), ErrorToken)
+    | Stream.Failure when not exceptionOnError -> reportRange ErrorRange (current_loc()); Some (current_loc(), ErrorToken)
+  in
   (current_loc,
    ignore_eol,
-   Stream.from (fun count ->
-     (try
-        match next_token () with
-          Some t -> Some (current_loc(), t)
-        | None -> None
-      with
-        Stream.Error msg when not exceptionOnError -> reportRange ErrorRange (current_loc()); Some (current_loc(), ErrorToken)
-      | Stream.Failure when not exceptionOnError -> reportRange ErrorRange (current_loc()); Some (current_loc(), ErrorToken)
-      )),
+   Stream.from (if !profiling then profile_phase_sampled lexing_samples "lexing" next_item else next_item),
    in_comment,
    in_ghost_range)
 
@@ -1663,6 +1668,7 @@ let make_sound_preprocessor make_lexer path verbose include_paths dataModel defi
     end
   in
   let current_loc = ref dummy_loc in
+  let next_token = if !profiling then profile_phase_sampled preprocessing_samples "preprocessing" next_token else next_token in
   let next _ =
     let result = next_token () in
     begin match result with
@@ -1,4 +1,127 @@
-open Num
+(* Rational numbers with a fast path for small numerators and denominators.
 
-let num_of_ints p q =
-  Num.div_num (Num.num_of_int p) (Num.num_of_int q)
+   Almost all coefficients that Simplex and Redux manipulate are tiny, but Num represents every
+   non-integral value as a Ratio of big_ints, which is slow to add, multiply and normalize.
+   Here, a number whose normalized numerator and denominator are both at most small_limit in
+   absolute value is represented as SmallNum (p, q) and computed with machine integers; all other
+   numbers are BigNums. Because operands of the fast path are bounded by small_limit, no intermediate
+   result of the fast path can overflow; results that leave the small range become BigNums. *)
+
+type num =
+  SmallNum of int * int (* Numerator and denominator; the denominator is positive and gcd(p, q) = 1 *)
+| BigNum of Num.num (* Never a value that fits in a SmallNum *)
+
+(* Any sum of two products of integers bounded by small_limit fits in an int. *)
+let small_limit = 1 lsl ((Sys.int_size - 3) / 2)
+
+let is_small n = - small_limit <= n && n <= small_limit
+
+let zero_num = SmallNum (0, 1)
+let unit_num = SmallNum (1, 1)
+let neg_unit_num = SmallNum (-1, 1)
+
+let rec gcd a b = if b = 0 then a else gcd b (a mod b)
+
+(* Normalizes p/q, where q > 0 and neither p nor q overflowed. *)
+let num_of_small_fraction p q =
+  if p = 0 then zero_num else
+  let d = gcd (abs p) q in
+  let p = p / d in
+  let q = q / d in
+  if is_small p && q <= small_limit then
+    SmallNum (p, q)
+  else
+    BigNum (Num.div_num (Num.num_of_int p) (Num.num_of_int q))
+
+let num_of_int i = if is_small i then SmallNum (i, 1) else BigNum (Num.num_of_int i)
+
+let num_of_big_num n =
+  match n with
+    Num.Int i -> if is_small i then SmallNum (i, 1) else BigNum n
+  | Num.Big_int b ->
+    if Big_int.is_int_big_int b then num_of_int (Big_int.int_of_big_int b) else BigNum n
+  | Num.Ratio r ->
+    let r = Ratio.normalize_ratio r in
+    let p = Ratio.numerator_ratio r in
+    let q = Ratio.denominator_ratio r in
+    if Big_int.is_int_big_int p && Big_int.is_int_big_int q then
+      let p = Big_int.int_of_big_int p in
+      let q = Big_int.int_of_big_int q in
+      if is_small p && q <= small_limit then SmallNum (p, q) else BigNum n
+    else
+      BigNum n
+
+let big_num_of_num n =
+  match n with
+    SmallNum (p, 1) -> Num.Int p
+  | SmallNum (p, q) -> Num.div_num (Num.Int p) (Num.Int q)
+  | BigNum n -> n
+
+let num_of_ints p q = num_of_big_num (Num.div_num (Num.num_of_int p) (Num.num_of_int q))
+
+let num_of_string s = num_of_big_num (Num.num_of_string s)
+
+let string_of_num n =
+  match n with
+    SmallNum (p, 1) -> string_of_int p
+  | SmallNum (p, q) -> string_of_int p ^ "/" ^ string_of_int q
+  | BigNum n -> Num.string_of_num n
+
+let add_num n1 n2 =
+  match (n1, n2) with
+    (SmallNum (p1, 1), SmallNum (p2, 1)) -> num_of_int (p1 + p2)
+  | (SmallNum (p1, q1), SmallNum (p2, q2)) -> num_of_small_fraction (p1 * q2 + p2 * q1) (q1 * q2)
+  | _ -> num_of_big_num (Num.add_num (big_num_of_num n1) (big_num_of_num n2))
+
+let minus_num n =
+  match n with
+    SmallNum (p, q) -> SmallNum (- p, q)
+  | BigNum n -> BigNum (Num.minus_num n)
+
+let sub_num n1 n2 = add_num n1 (minus_num n2)
+
+let mult_num n1 n2 =
+  match (n1, n2) with
+    (SmallNum (p1, 1), SmallNum (p2, 1)) -> num_of_int (p1 * p2)
+  | (SmallNum (p1, q1), SmallNum (p2, q2)) -> num_of_small_fraction (p1 * p2) (q1 * q2)
+  | _ -> num_of_big_num (Num.mult_num (big_num_of_num n1) (big_num_of_num n2))
+
+let div_num n1 n2 =
+  match (n1, n2) with
+    (_, SmallNum (0, _)) -> raise Division_by_zero
+  | (SmallNum (p1, q1), SmallNum (p2, q2)) ->
+    if p2 < 0 then
+      num_of_small_fraction (- p1 * q2) (q1 * (- p2))
+    else
+      num_of_small_fraction (p1 * q2) (q1 * p2)
+  | _ -> num_of_big_num (Num.div_num (big_num_of_num n1) (big_num_of_num n2))
+
+let sign_num n =
+  match n with
+    SmallNum (p, _) -> compare p 0
+  | BigNum n -> Num.sign_num n
+
+let abs_num n =
+  match n with
+    SmallNum (p, q) -> SmallNum (abs p, q)
+  | BigNum n -> BigNum (Num.abs_num n)
+
+let compare_num n1 n2 =
+  match (n1, n2) with
+    (SmallNum (p1, q1), SmallNum (p2, q2)) -> compare (p1 * q2) (p2 * q1)
+  | _ -> Num.compare_num (big_num_of_num n1) (big_num_of_num n2)
+
+(* Both representations are canonical, so a SmallNum never equals a BigNum. *)
+let eq_num n1 n2 =
+  match (n1, n2) with
+    (SmallNum (p1, q1), SmallNum (p2, q2)) -> p1 = p2 && q1 = q2
+  | (BigNum n1, BigNum n2) -> Num.eq_num n1 n2
+  | _ -> false
+
+let (+/) = add_num
+let (-/) = sub_num
+let ( */ ) = mult_num
+let (//) = div_num
+let (=/) = eq_num
+let (<=/) n1 n2 = compare_num n1 n2 <= 0
+let (</) n1 n2 = compare_num n1 n2 < 0
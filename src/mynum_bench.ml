@@ -0,0 +1,90 @@
+(* Micro-benchmark for the small-number fast path in mynum.ml.
+   Build with 'make mynum_bench'; run '../bin/mynum_bench'.
+
+   The first part performs the row operations of Simplex pivots (row += a * pivot row, row /= c)
+   on sparse rational matrices with tiny coefficients, once with Num and once with Mynum.
+   The second part times the Simplex tableau itself on a pivot-heavy system of inequalities. *)
+
+module type NUM = sig
+  type num
+  val num_of_int: int -> num
+  val add_num: num -> num -> num
+  val mult_num: num -> num -> num
+  val div_num: num -> num -> num
+  val minus_num: num -> num
+  val sign_num: num -> int
+end
+
+module Eliminate(N: NUM) = struct
+  (* Gauss-Jordan elimination; returns the number of nonzero entries left, to keep the work observable. *)
+  let run size seed =
+    let random = Random.State.make [|seed|] in
+    let m =
+      Array.init size begin fun i ->
+        Array.init (size + 1) begin fun j ->
+          if j = i then N.num_of_int (1 + Random.State.int random 3)
+          else if Random.State.int random 8 = 0 then N.num_of_int (Random.State.int random 5 - 2)
+          else N.num_of_int 0
+        end
+      end
+    in
+    for k = 0 to size - 1 do
+      let pivot = m.(k).(k) in
+      if N.sign_num pivot <> 0 then begin
+        let row = m.(k) in
+        for j = 0 to size do row.(j) <- N.div_num row.(j) pivot done;
+        for i = 0 to size - 1 do
+          let a = m.(i).(k) in
+          if i <> k && N.sign_num a <> 0 then begin
+            let a = N.minus_num a in
+            let r = m.(i) in
+            for j = 0 to size do
+              if N.sign_num row.(j) <> 0 then r.(j) <- N.add_num r.(j) (N.mult_num a row.(j))
+            done
+          end
+        done
+      end
+    done;
+    Array.fold_left (fun n row -> Array.fold_left (fun n x -> if N.sign_num x <> 0 then n + 1 else n) n row) 0 m
+end
+
+module NumElimination = Eliminate(Num)
+module MynumElimination = Eliminate(Mynum)
+
+let time label f =
+  let t0 = Sys.time () in
+  let result = f () in
+  let t1 = Sys.time () in
+  Printf.printf "%-40s %8.3fs\n" label (t1 -. t0);
+  result
+
+let simplex_system unknown_count constraint_count seed =
+  let random = Random.State.make [|seed|] in
+  let simplex = Simplex.new_simplex () in
+  simplex#register_listeners (fun _ -> ()) (fun _ -> ());
+  let us = Array.init unknown_count (fun i -> simplex#alloc_unknown ("x" ^ string_of_int i) i) in
+  let small () = Mynum.num_of_int (Random.State.int random 7 - 3) in
+  let sat = ref 0 in
+  for round = 1 to 10 do
+    simplex#push;
+    let c = ref 0 in
+    (* Like Redux, stop asserting once the system is unsatisfiable. *)
+    while !c < constraint_count do
+      incr c;
+      let terms = Array.to_list (Array.init 3 (fun _ -> (small (), us.(Random.State.int random unknown_count)))) in
+      match simplex#assert_ge (Mynum.num_of_int (Random.State.int random 20)) terms with
+        Simplex.Sat -> incr sat
+      | Simplex.Unsat -> c := constraint_count
+    done;
+    simplex#pop
+  done;
+  !sat
+
+let () =
+  let size = 120 in
+  let rounds = 20 in
+  let n1 = time "Elimination with Num" (fun () -> let n = ref 0 in for i = 1 to rounds do n := NumElimination.run size i done; !n) in
+  let n2 = time "Elimination with Mynum" (fun () -> let n = ref 0 in for i = 1 to rounds do n := MynumElimination.run size i done; !n) in
+  assert (n1 = n2);
+  let sat = time "Simplex: 10 x 400 inequalities over 60 unknowns" (fun () -> simplex_system 60 400 42) in
+  Printf.printf "Satisfiable assertions: %d\n" sat
@@ -1606,7 +1606,7 @@ let parse_scala_file (path: string) (reportRange: range_kind -> loc0 -> unit): p
 let parse_java_file_old (path: string) (reportRange: range_kind -> loc0 -> unit) reportShouldFail verbose enforceAnnotations: package =
   Stopwatch.start parsing_stopwatch;
   if verbose = -1 then Printf.printf "%10.6fs: >> parsing Java file: %s \n" (Perf.time()) path;
-  let result =
+  let result = profile_phase "parsing" $. fun () ->
   if Filename.check_suffix (Filename.basename path) ".scala" then
     parse_scala_file path reportRange
   else
@@ -1663,7 +1663,7 @@ let parse_c_file (path: string) (reportRange: range_kind -> loc0 -> unit) (repor
             (include_paths: string list) (define_macros: string list) (enforceAnnotations: bool) (dataModel: data_model): ((loc * (include_kind * string * string) * string list * package list) list * package list) = (* ?parse_c_file *)
   Stopwatch.start parsing_stopwatch;
   if verbose = -1 then Printf.printf "%10.6fs: >> parsing C file: %s \n" (Perf.time()) path;
-  let result =
+  let result = profile_phase "parsing" $. fun () ->
     let make_lexer path include_paths ~inGhostRange =
       let text = readFile path in
       make_lexer (common_keywords @ c_keywords) ghost_keywords path text reportRange ~inGhostRange reportShouldFail
@@ -1688,7 +1688,7 @@ let parse_header_file (path: string) (reportRange: range_kind -> loc0 -> unit) (
   Stopwatch.start parsing_stopwatch;
   if verbose = -1 then Printf.printf "%10.6fs: >> parsing Header file: %s \n" (Perf.time()) path;
   let isGhostHeader = Filename.check_suffix path ".gh" in
-  let result =
+  let result = profile_phase "parsing" $. fun () ->
     let make_lexer path include_paths ~inGhostRange =
       let text = readFile path in
       make_lexer (common_keywords @ c_keywords) ghost_keywords path text reportRange ~inGhostRange:inGhostRange reportShouldFail
@@ -1709,6 +1709,93 @@ let parse_header_file (path: string) (reportRange: range_kind -> loc0 -> unit) (
   Stopwatch.stop parsing_stopwatch;
   result
 
+(* Region: the header cache *)
+
+(* With -cache <dir>, the result of parse_header_file is stored in <dir>, together with the digests of the files that were read,
+   and is loaded instead of parsing the header again as long as none of these files changed. The name of a cache entry
+   is derived from the VeriFast executable and all parameters that affect parsing, such as the data model.
+   Only syntax trees are cached: the typechecked header maps contain prover symbols and cannot outlive the prover.
+   The reportRange and reportShouldFail calls made while parsing are stored with the syntax trees and replayed when
+   the entry is used, so that e.g. the IDE's syntax highlighting is the same.
+   A long-running process (see vfconsole's -server mode) additionally keeps the entries in memory. *)
+let header_cache_executable_digest = lazy (try Digest.file Sys.executable_name with Sys_error _ -> "")
+
+let keep_parsed_headers_in_memory = ref false
+let parsed_headers_in_memory: (string, string) Hashtbl.t = Hashtbl.create 10 (* entry name -> entry *)
+
+let parse_header_file_cached (cache_dir: string option) (path: string) (reportRange: range_kind -> loc0 -> unit) (reportShouldFail: loc0 -> unit) (verbose: int)
+         (include_paths: string list) (define_macros: string list) (enforceAnnotations: bool) (dataModel: data_model): ((loc * (include_kind * string * string) * string list * package list) list * package list) =
+  if cache_dir = None && not !keep_parsed_headers_in_memory then
+    parse_header_file path reportRange reportShouldFail verbose include_paths define_macros enforceAnnotations dataModel
+  else
+  let key = (Lazy.force header_cache_executable_digest, path, include_paths, define_macros, enforceAnnotations, dataModel) in
+  let entry_name = "header-" ^ Digest.to_hex (Digest.string (Marshal.to_string key [])) in
+  let digest_file path = try Digest.file path with Sys_error _ -> "" in
+  let time0 = Perf.time () in
+  Stopwatch.start parsing_stopwatch;
+  let entry =
+    match Hashtbl.find_opt parsed_headers_in_memory entry_name with
+      Some entry -> Some entry
+    | None ->
+      match cache_dir with
+        Some dir when Sys.file_exists (concat dir entry_name) ->
+        begin try
+          let chan = open_in_bin (concat dir entry_name) in
+          let entry = really_input_string chan (in_channel_length chan) in
+          close_in chan;
+          Some entry
+        with Sys_error _ | End_of_file -> None
+        end
+      | _ -> None
+  in
+  let cached =
+    match entry with
+      None -> None
+    | Some entry ->
+      match (try Some (Marshal.from_string entry 0: (string * Digest.t) list * float * (range_kind * loc0) list * loc0 list * ((loc * (include_kind * string * string) * string list * package list) list * package list)) with Failure _ | Invalid_argument _ -> None) with
+        Some (files, parse_time, ranges, shouldFailLocs, result) when List.for_all (fun (path, digest) -> digest_file path = digest) files ->
+        if !keep_parsed_headers_in_memory then Hashtbl.replace parsed_headers_in_memory entry_name entry;
+        Some (parse_time, ranges, shouldFailLocs, result)
+      | _ -> None
+  in
+  Stopwatch.stop parsing_stopwatch;
+  match cached with
+    Some (parse_time, ranges, shouldFailLocs, result) ->
+    List.iter (fun (kind, l) -> reportRange kind l) ranges;
+    List.iter reportShouldFail shouldFailLocs;
+    (* Register the typedef names, as parsing the header would have. *)
+    let (headers, ds) = result in
+    (ds::List.map (fun (_, _, _, ds) -> ds) headers) |> List.iter begin List.iter begin fun (PackageDecl (_, _, _, ds)) ->
+      ds |> List.iter (function TypedefDecl (_, _, g) -> register_typedef g | _ -> ())
+    end end;
+    !stats#headerCacheHit (parse_time -. (Perf.time () -. time0));
+    result
+  | None ->
+    let time0 = Perf.time () in
+    let ranges = ref [] in
+    let shouldFailLocs = ref [] in
+    let reportRange kind l = ranges := (kind, l)::!ranges; reportRange kind l in
+    let reportShouldFail l = shouldFailLocs := l::!shouldFailLocs; reportShouldFail l in
+    let (headers, ds) as result = parse_header_file path reportRange reportShouldFail verbose include_paths define_macros enforceAnnotations dataModel in
+    let parse_time = Perf.time () -. time0 in
+    let files = path::List.map (fun (_, (_, _, total_path), _, _) -> total_path) headers in
+    begin try
+      let entry = Marshal.to_string (List.map (fun path -> (path, digest_file path)) files, parse_time, List.rev !ranges, List.rev !shouldFailLocs, result) [] in
+      if !keep_parsed_headers_in_memory then Hashtbl.replace parsed_headers_in_memory entry_name entry;
+      match cache_dir with
+        None -> ()
+      | Some dir ->
+        if not (Sys.file_exists dir) then Unix.mkdir dir 0o755;
+        let entry_path = concat dir entry_name in
+        let tmp_path = Printf.sprintf "%s.%d.tmp" entry_path (Unix.getpid ()) in
+        let chan = open_out_bin tmp_path in
+        output_string chan entry;
+        close_out chan;
+        Sys.rename tmp_path entry_path
+    with Sys_error _ | Unix.Unix_error _ | Invalid_argument _ -> ()
+    end;
+    result
+
 let read_file_lines path =
   let channel = open_in path in
   let lines =
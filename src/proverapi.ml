@@ -7,6 +7,40 @@ let string_of_assume_result = function
   | Unknown -> "unknown"
   | Unsat   -> "unsat"
 
+(* A time budget for the assume, assert_term or query in progress, as a Perf.time () deadline; see
+   Combineprovers.Sequence. A prover that supports it checks the deadline only where it can give up
+   through its ordinary control flow, so that its state stays consistent: it then answers Unknown (or
+   false, for a query), which is sound, and sets deadline_exceeded. *)
+let deadline = ref infinity
+(* Another reason to give up in the same way: set, while another prover works on the same question in the background, to
+   whether that prover has settled the question (see Combineprovers.portfolio_context). *)
+let interrupted: (unit -> bool) option ref = ref None
+(* Set by a prover that gave up, because of the deadline or of interrupted *)
+let deadline_exceeded = ref false
+
+(* The number of should_give_up calls that share one look at the clock and at interrupted *)
+let give_up_poll_interval = 32
+let give_up_poll_countdown = ref 0
+
+(* Whether the prover should give up on the question in progress. A prover may call this at each case split and more often,
+   so without a deadline or interrupted, it costs only a comparison; otherwise, it looks at them only once every
+   give_up_poll_interval calls. Once it returned true, it keeps doing so until deadline_exceeded is reset. *)
+let should_give_up () =
+  match !interrupted with
+    None when !deadline = infinity -> false
+  | interrupted ->
+    !deadline_exceeded ||
+    begin
+      decr give_up_poll_countdown;
+      !give_up_poll_countdown <= 0 &&
+      begin
+        give_up_poll_countdown := give_up_poll_interval;
+        let give_up = Perf.time () > !deadline || match interrupted with None -> false | Some interrupted -> interrupted () in
+        if give_up then deadline_exceeded := true;
+        give_up
+      end
+    end
+
 type ctor_symbol = CtorByOrdinal of int | NumberCtor of num
 type symbol_kind = Ctor of ctor_symbol | Fixpoint of int | Uninterp
 
@@ -66,3 +100,15 @@ class virtual ['typenode, 'symbol, 'termnode] context =
     method virtual assume_forall: string (* description for diagnostic traces *) -> 'termnode list -> ('typenode) list -> 'termnode -> unit
     method virtual simplify: 'termnode -> 'termnode option
   end
+
+(* A prover that can work on a question in the background, e.g. because it runs in a separate process.
+   assume_async and query_async send the question and return three functions: the first waits for the answer;
+   the second abandons the question, after which the answer is dropped without being waited for; the third tells,
+   without blocking, whether the answer is available. Exactly one of the first two must be called before the next call
+   of any other method; the third may be called any number of times before that. *)
+class virtual ['typenode, 'symbol, 'termnode] async_context =
+  object
+    inherit ['typenode, 'symbol, 'termnode] context
+    method virtual assume_async: 'termnode -> (unit -> assume_result) * (unit -> unit) * (unit -> bool)
+    method virtual query_async: 'termnode -> (unit -> bool) * (unit -> unit) * (unit -> bool)
+  end
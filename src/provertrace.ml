@@ -0,0 +1,584 @@
+(* Recording and replaying the calls that VeriFast makes on a prover.
+
+   tracing_context wraps a prover following the API of proverapi.ml and writes every call that
+   builds or uses a term (mk_*, mk_symbol, set_fpclauses, push, pop, assert_term, assume, query,
+   assume_forall, ...) to a compact binary trace. The vfprover-replay tool reads such a trace and
+   replays it against any registered prover, which gives prover benchmarks that do not depend on
+   the front end.
+
+   Terms and symbols are identified by the order in which they were created. A fixpoint clause is
+   a function from terms to a term; it is recorded once, when set_fpclauses is called, by applying
+   it to placeholder terms. The result is a template: the list of calls that the clause makes,
+   which is replayed each time the prover applies the clause. Calls made by a clause while the
+   prover applies it are not recorded. Each template has a scope of its own: a reference to a term
+   or symbol says how many scopes up it lives and which one it is. References within a scope are
+   stored as the distance back from the most recently created term or symbol, so that they are
+   usually a single byte. *)
+
+open Num
+open Proverapi
+
+let trace_header = "VFPT1"
+
+type ref_ = int * int (* Number of scopes up; distance back (in the current scope) or index (in an enclosing scope) *)
+
+(* Fixed-arity term constructors, by opcode; opcode 0 is unused. *)
+let term_ops = [|
+  ("", 0);
+  ("mk_boxed_int", 1); ("mk_unboxed_int", 1); ("mk_boxed_real", 1); ("mk_unboxed_real", 1);
+  ("mk_boxed_bool", 1); ("mk_unboxed_bool", 1);
+  ("mk_true", 0); ("mk_false", 0); ("mk_and", 2); ("mk_or", 2); ("mk_not", 1);
+  ("mk_ifthenelse", 3); ("mk_iff", 2); ("mk_implies", 2); ("mk_eq", 2);
+  ("mk_add", 2); ("mk_sub", 2); ("mk_mul", 2); ("mk_div", 2); ("mk_mod", 2); ("mk_lt", 2); ("mk_le", 2);
+  ("mk_real_add", 2); ("mk_real_sub", 2); ("mk_real_mul", 2); ("mk_real_lt", 2); ("mk_real_le", 2)
+|]
+
+type op =
+  Term of int * ref_ list (* Opcode in term_ops; arguments *)
+| App of ref_ * ref_ list
+| IntLit of int
+| IntLitOfString of string
+| RealLit of int
+| RealLitOfNum of string
+| Bound of int * int (* Index; type code *)
+| Simplify of ref_ * bool (* Whether the prover returned a term, which then counts as a created term *)
+| Symbol of string * int list * int * symbol_kind
+| SetFpclauses of ref_ * int * clause list
+| Push
+| Pop
+| AssertTerm of ref_
+| Assume of ref_ * assume_result
+| Query of ref_ * bool
+| BeginFormal
+| EndFormal
+| AssumeForall of string * ref_ list * int list * ref_
+and clause = {
+  clause_ctor: ref_;
+  xcount: int; (* The clause's parameters are the xcount arguments of the fixpoint, then the ycount arguments of the constructor *)
+  ycount: int;
+  body: op list;
+  result: ref_
+}
+
+let op_name op =
+  match op with
+    Term (code, _) -> fst term_ops.(code)
+  | App _ -> "mk_app"
+  | IntLit _ -> "mk_intlit"
+  | IntLitOfString _ -> "mk_intlit_of_string"
+  | RealLit _ -> "mk_reallit"
+  | RealLitOfNum _ -> "mk_reallit_of_num"
+  | Bound _ -> "mk_bound"
+  | Simplify _ -> "simplify"
+  | Symbol _ -> "mk_symbol"
+  | SetFpclauses _ -> "set_fpclauses"
+  | Push -> "push"
+  | Pop -> "pop"
+  | AssertTerm _ -> "assert_term"
+  | Assume _ -> "assume"
+  | Query _ -> "query"
+  | BeginFormal -> "begin_formal"
+  | EndFormal -> "end_formal"
+  | AssumeForall _ -> "assume_forall"
+
+(* Region: encoding *)
+
+let write_varint b n =
+  let rec iter n =
+    if n < 0x80 then
+      Buffer.add_char b (Char.chr n)
+    else begin
+      Buffer.add_char b (Char.chr (0x80 lor (n land 0x7f)));
+      iter (n lsr 7)
+    end
+  in
+  iter n
+
+let write_int b n = write_varint b ((n lsl 1) lxor (n asr (Sys.int_size - 1)))
+
+let write_string b s = write_varint b (String.length s); Buffer.add_string b s
+
+let write_ref b (up, n) = write_varint b up; write_varint b n
+
+let write_list b write xs = write_varint b (List.length xs); List.iter (write b) xs
+
+let rec write_op b op =
+  let code c = Buffer.add_char b (Char.chr c) in
+  match op with
+    Term (c, ts) -> code c; List.iter (write_ref b) ts
+  | App (s, ts) -> code 32; write_ref b s; write_list b write_ref ts
+  | IntLit n -> code 33; write_int b n
+  | IntLitOfString s -> code 34; write_string b s
+  | RealLit n -> code 35; write_int b n
+  | RealLitOfNum s -> code 36; write_string b s
+  | Bound (i, tp) -> code 37; write_varint b i; write_varint b tp
+  | Simplify (t, simplified) -> code 38; write_ref b t; write_varint b (if simplified then 1 else 0)
+  | Symbol (name, domain, range, kind) ->
+    code 40; write_string b name; write_list b write_varint domain; write_varint b range;
+    begin match kind with
+      Uninterp -> write_varint b 0
+    | Fixpoint k -> write_varint b 1; write_varint b k
+    | Ctor (CtorByOrdinal k) -> write_varint b 2; write_varint b k
+    | Ctor (NumberCtor n) -> write_varint b 3; write_string b (string_of_num n)
+    end
+  | SetFpclauses (s, k, clauses) ->
+    code 41; write_ref b s; write_varint b k;
+    write_list b begin fun b {clause_ctor; xcount; ycount; body; result} ->
+      write_ref b clause_ctor; write_varint b xcount; write_varint b ycount;
+      List.iter (write_op b) body;
+      code 42;
+      write_ref b result
+    end clauses
+  | Push -> code 48
+  | Pop -> code 49
+  | AssertTerm t -> code 50; write_ref b t
+  | Assume (t, result) -> code 51; write_ref b t; write_varint b (match result with Unknown -> 0 | Unsat -> 1)
+  | Query (t, result) -> code 52; write_ref b t; write_varint b (if result then 1 else 0)
+  | BeginFormal -> code 53
+  | EndFormal -> code 54
+  | AssumeForall (descr, triggers, tps, body) ->
+    code 55; write_string b descr; write_list b write_ref triggers; write_list b write_varint tps; write_ref b body
+
+(* Region: decoding *)
+
+let read_varint ic =
+  let rec iter shift n =
+    let c = input_byte ic in
+    let n = n lor ((c land 0x7f) lsl shift) in
+    if c < 0x80 then n else iter (shift + 7) n
+  in
+  iter 0 0
+
+let read_int ic = let z = read_varint ic in (z lsr 1) lxor (- (z land 1))
+
+let read_string ic = let n = read_varint ic in really_input_string ic n
+
+let read_ref ic = let up = read_varint ic in let n = read_varint ic in (up, n)
+
+let read_list ic read =
+  let rec iter n = if n = 0 then [] else let x = read ic in x::iter (n - 1) in
+  iter (read_varint ic)
+
+let rec repeat n f = if n = 0 then [] else let x = f () in x::repeat (n - 1) f
+
+(* Reads one op; returns None at the end of a clause body. *)
+let rec read_op ic =
+  let c = input_byte ic in
+  if 0 < c && c < Array.length term_ops then
+    Some (Term (c, repeat (snd term_ops.(c)) (fun () -> read_ref ic)))
+  else
+  match c with
+    32 -> let s = read_ref ic in Some (App (s, read_list ic read_ref))
+  | 33 -> Some (IntLit (read_int ic))
+  | 34 -> Some (IntLitOfString (read_string ic))
+  | 35 -> Some (RealLit (read_int ic))
+  | 36 -> Some (RealLitOfNum (read_string ic))
+  | 37 -> let i = read_varint ic in Some (Bound (i, read_varint ic))
+  | 38 -> let t = read_ref ic in Some (Simplify (t, read_varint ic = 1))
+  | 40 ->
+    let name = read_string ic in
+    let domain = read_list ic read_varint in
+    let range = read_varint ic in
+    let kind =
+      match read_varint ic with
+        0 -> Uninterp
+      | 1 -> Fixpoint (read_varint ic)
+      | 2 -> Ctor (CtorByOrdinal (read_varint ic))
+      | 3 -> Ctor (NumberCtor (num_of_string (read_string ic)))
+      | k -> failwith (Printf.sprintf "Prover trace: bad symbol kind %d" k)
+    in
+    Some (Symbol (name, domain, range, kind))
+  | 41 ->
+    let s = read_ref ic in
+    let k = read_varint ic in
+    let clauses =
+      read_list ic begin fun ic ->
+        let clause_ctor = read_ref ic in
+        let xcount = read_varint ic in
+        let ycount = read_varint ic in
+        let rec read_body () = match read_op ic with None -> [] | Some op -> op::read_body () in
+        let body = read_body () in
+        let result = read_ref ic in
+        {clause_ctor; xcount; ycount; body; result}
+      end
+    in
+    Some (SetFpclauses (s, k, clauses))
+  | 42 -> None
+  | 48 -> Some Push
+  | 49 -> Some Pop
+  | 50 -> Some (AssertTerm (read_ref ic))
+  | 51 -> let t = read_ref ic in Some (Assume (t, if read_varint ic = 1 then Unsat else Unknown))
+  | 52 -> let t = read_ref ic in Some (Query (t, read_varint ic = 1))
+  | 53 -> Some BeginFormal
+  | 54 -> Some EndFormal
+  | 55 ->
+    let descr = read_string ic in
+    let triggers = read_list ic read_ref in
+    let tps = read_list ic read_varint in
+    Some (AssumeForall (descr, triggers, tps, read_ref ic))
+  | c -> failwith (Printf.sprintf "Prover trace: bad opcode %d" c)
+
+(* Reads the top-level ops of a trace file. *)
+let read_trace path =
+  let ic = open_in_bin path in
+  let header = try really_input_string ic (String.length trace_header) with End_of_file -> "" in
+  if header <> trace_header then begin close_in ic; failwith (path ^ ": not a prover trace") end;
+  let rec iter ops =
+    match try Some (read_op ic) with End_of_file -> None with
+      None -> close_in ic; List.rev ops
+    | Some None -> close_in ic; failwith (path ^ ": unexpected end of clause body")
+    | Some (Some op) -> iter (op::ops)
+  in
+  iter []
+
+(* Region: recording *)
+
+let type_bool_code = 0
+let type_int_code = 1
+let type_real_code = 2
+let type_inductive_code = 3
+
+type scope = {
+  parent: scope option;
+  mutable ops: op list; (* In reverse order; unused in the top-level scope, whose ops go straight to the trace file *)
+  mutable term_count: int;
+  mutable symbol_count: int
+}
+
+(* The node is None for a placeholder or a term built from placeholders while recording a clause.
+   The scope is None for a term that was built while the prover applied a clause; such terms are not recorded. *)
+type 'c traced_term = {term_scope: scope option; term_index: int; node: 'c option}
+type 'b traced_symbol = {symbol_scope: scope option; symbol_index: int; arity: int; sym: 'b option}
+
+let node_of t =
+  match t.node with
+    Some n -> n
+  | None -> failwith "Prover trace: a term built from the parameters of a fixpoint clause escaped the clause"
+
+(* ['a, 'b, 'c] tracing_context is an (int * 'a, 'b traced_symbol, 'c traced_term) context;
+   the int is the code of the type. *)
+class ['a, 'b, 'c] tracing_context (p: ('a, 'b, 'c) context) (out: out_channel) =
+  let top = {parent = None; ops = []; term_count = 0; symbol_count = 0} in
+  let buffer = Buffer.create 65536 in
+  let () = Buffer.add_string buffer trace_header in
+  let scope = ref top in
+  (* Greater than zero while the prover applies a clause. *)
+  let untraced = ref 0 in
+  let emit op =
+    let s = !scope in
+    if s == top then begin
+      write_op buffer op;
+      if Buffer.length buffer >= 65536 then begin Buffer.output_buffer out buffer; Buffer.clear buffer end
+    end else
+      s.ops <- op::s.ops
+  in
+  let make_ref target index count =
+    let rec iter up s =
+      if s == target then
+        if up = 0 then (0, count s - index) else (up, index)
+      else
+        match s.parent with
+          Some s -> iter (up + 1) s
+        | None -> failwith "Prover trace: a term or symbol escaped the fixpoint clause that created it"
+    in
+    iter 0 !scope
+  in
+  let term_ref t =
+    match t.term_scope with
+      None -> failwith "Prover trace: a term built while applying a fixpoint clause escaped the clause"
+    | Some s -> make_ref s t.term_index (fun s -> s.term_count)
+  in
+  let symbol_ref s =
+    match s.symbol_scope with
+      None -> failwith "Prover trace: a symbol created while applying a fixpoint clause escaped the clause"
+    | Some sc -> make_ref sc s.symbol_index (fun s -> s.symbol_count)
+  in
+  let symbol_of s =
+    match s.sym with
+      Some s -> s
+    | None -> failwith "Prover trace: a symbol created while recording a fixpoint clause escaped the clause"
+  in
+  let alloc_term node =
+    let s = !scope in
+    let i = s.term_count in
+    s.term_count <- i + 1;
+    {term_scope = Some s; term_index = i; node}
+  in
+  let untraced_term n = {term_scope = None; term_index = -1; node = Some n} in
+  (* Records a call that creates a term; f performs the call on the prover. *)
+  let term_op mk_op f =
+    if !untraced > 0 then untraced_term (f ()) else begin
+      let op = mk_op () in
+      let node = if !scope == top then Some (f ()) else None in
+      emit op;
+      alloc_term node
+    end
+  in
+  (* Records a call that returns nothing. Inside a clause, the call is only recorded. *)
+  let effect mk_op f =
+    if !untraced > 0 then f () else begin
+      let op = mk_op () in
+      if !scope == top then f ();
+      emit op
+    end
+  in
+  let check_top name =
+    if !scope != top then failwith ("Prover trace: " ^ name ^ " inside a fixpoint clause is not supported")
+  in
+  let untraced_clause fbody xs ys =
+    incr untraced;
+    let result = try fbody (List.map untraced_term xs) (List.map untraced_term ys) with e -> decr untraced; raise e in
+    decr untraced;
+    node_of result
+  in
+  let record_clause s c fbody =
+    let clause_ctor = symbol_ref c in
+    let outer = !scope in
+    scope := {parent = Some outer; ops = []; term_count = 0; symbol_count = 0};
+    let body_scope = !scope in
+    let xs = repeat s.arity (fun () -> alloc_term None) in
+    let ys = repeat c.arity (fun () -> alloc_term None) in
+    let result = try term_ref (fbody xs ys) with e -> scope := outer; raise e in
+    scope := outer;
+    {clause_ctor; xcount = s.arity; ycount = c.arity; body = List.rev body_scope.ops; result}
+  in
+object
+  method set_verbosity v = p#set_verbosity v
+  method type_bool = (type_bool_code, p#type_bool)
+  method type_int = (type_int_code, p#type_int)
+  method type_real = (type_real_code, p#type_real)
+  method type_inductive = (type_inductive_code, p#type_inductive)
+  method mk_boxed_int t = term_op (fun () -> Term (1, [term_ref t])) (fun () -> p#mk_boxed_int (node_of t))
+  method mk_unboxed_int t = term_op (fun () -> Term (2, [term_ref t])) (fun () -> p#mk_unboxed_int (node_of t))
+  method mk_boxed_real t = term_op (fun () -> Term (3, [term_ref t])) (fun () -> p#mk_boxed_real (node_of t))
+  method mk_unboxed_real t = term_op (fun () -> Term (4, [term_ref t])) (fun () -> p#mk_unboxed_real (node_of t))
+  method mk_boxed_bool t = term_op (fun () -> Term (5, [term_ref t])) (fun () -> p#mk_boxed_bool (node_of t))
+  method mk_unboxed_bool t = term_op (fun () -> Term (6, [term_ref t])) (fun () -> p#mk_unboxed_bool (node_of t))
+  method mk_symbol name (domain: (int * 'a) list) ((range_code, range): int * 'a) kind =
+    let arity = List.length domain in
+    let create () = p#mk_symbol name (List.map snd domain) range kind in
+    if !untraced > 0 then
+      {symbol_scope = None; symbol_index = -1; arity; sym = Some (create ())}
+    else begin
+      let sym = if !scope == top then Some (create ()) else None in
+      emit (Symbol (name, List.map fst domain, range_code, kind));
+      let s = !scope in
+      let i = s.symbol_count in
+      s.symbol_count <- i + 1;
+      {symbol_scope = Some s; symbol_index = i; arity; sym}
+    end
+  method set_fpclauses (s: 'b traced_symbol) (k: int) (cs: ('b traced_symbol * ('c traced_term list -> 'c traced_term list -> 'c traced_term)) list) =
+    let set_inner_fpclauses () =
+      p#set_fpclauses (symbol_of s) k (List.map (fun (c, fbody) -> (symbol_of c, untraced_clause fbody)) cs)
+    in
+    if !untraced > 0 then set_inner_fpclauses () else begin
+      let sref = symbol_ref s in
+      let clauses = List.map (fun (c, fbody) -> record_clause s c fbody) cs in
+      emit (SetFpclauses (sref, k, clauses));
+      if !scope == top then set_inner_fpclauses ()
+    end
+  method mk_app s ts =
+    term_op (fun () -> let sref = symbol_ref s in App (sref, List.map term_ref ts)) (fun () -> p#mk_app (symbol_of s) (List.map node_of ts))
+  method mk_true = term_op (fun () -> Term (7, [])) (fun () -> p#mk_true)
+  method mk_false = term_op (fun () -> Term (8, [])) (fun () -> p#mk_false)
+  method mk_and t1 t2 = term_op (fun () -> Term (9, [term_ref t1; term_ref t2])) (fun () -> p#mk_and (node_of t1) (node_of t2))
+  method mk_or t1 t2 = term_op (fun () -> Term (10, [term_ref t1; term_ref t2])) (fun () -> p#mk_or (node_of t1) (node_of t2))
+  method mk_not t = term_op (fun () -> Term (11, [term_ref t])) (fun () -> p#mk_not (node_of t))
+  method mk_ifthenelse t1 t2 t3 =
+    term_op (fun () -> Term (12, [term_ref t1; term_ref t2; term_ref t3])) (fun () -> p#mk_ifthenelse (node_of t1) (node_of t2) (node_of t3))
+  method mk_iff t1 t2 = term_op (fun () -> Term (13, [term_ref t1; term_ref t2])) (fun () -> p#mk_iff (node_of t1) (node_of t2))
+  method mk_implies t1 t2 = term_op (fun () -> Term (14, [term_ref t1; term_ref t2])) (fun () -> p#mk_implies (node_of t1) (node_of t2))
+  method mk_eq t1 t2 = term_op (fun () -> Term (15, [term_ref t1; term_ref t2])) (fun () -> p#mk_eq (node_of t1) (node_of t2))
+  method mk_intlit n = term_op (fun () -> IntLit n) (fun () -> p#mk_intlit n)
+  method mk_intlit_of_string s = term_op (fun () -> IntLitOfString s) (fun () -> p#mk_intlit_of_string s)
+  method mk_add t1 t2 = term_op (fun () -> Term (16, [term_ref t1; term_ref t2])) (fun () -> p#mk_add (node_of t1) (node_of t2))
+  method mk_sub t1 t2 = term_op (fun () -> Term (17, [term_ref t1; term_ref t2])) (fun () -> p#mk_sub (node_of t1) (node_of t2))
+  method mk_mul t1 t2 = term_op (fun () -> Term (18, [term_ref t1; term_ref t2])) (fun () -> p#mk_mul (node_of t1) (node_of t2))
+  method mk_div t1 t2 = term_op (fun () -> Term (19, [term_ref t1; term_ref t2])) (fun () -> p#mk_div (node_of t1) (node_of t2))
+  method mk_mod t1 t2 = term_op (fun () -> Term (20, [term_ref t1; term_ref t2])) (fun () -> p#mk_mod (node_of t1) (node_of t2))
+  method mk_lt t1 t2 = term_op (fun () -> Term (21, [term_ref t1; term_ref t2])) (fun () -> p#mk_lt (node_of t1) (node_of t2))
+  method mk_le t1 t2 = term_op (fun () -> Term (22, [term_ref t1; term_ref t2])) (fun () -> p#mk_le (node_of t1) (node_of t2))
+  method mk_reallit n = term_op (fun () -> RealLit n) (fun () -> p#mk_reallit n)
+  method mk_reallit_of_num n = term_op (fun () -> RealLitOfNum (string_of_num n)) (fun () -> p#mk_reallit_of_num n)
+  method mk_real_add t1 t2 = term_op (fun () -> Term (23, [term_ref t1; term_ref t2])) (fun () -> p#mk_real_add (node_of t1) (node_of t2))
+  method mk_real_sub t1 t2 = term_op (fun () -> Term (24, [term_ref t1; term_ref t2])) (fun () -> p#mk_real_sub (node_of t1) (node_of t2))
+  method mk_real_mul t1 t2 = term_op (fun () -> Term (25, [term_ref t1; term_ref t2])) (fun () -> p#mk_real_mul (node_of t1) (node_of t2))
+  method mk_real_lt t1 t2 = term_op (fun () -> Term (26, [term_ref t1; term_ref t2])) (fun () -> p#mk_real_lt (node_of t1) (node_of t2))
+  method mk_real_le t1 t2 = term_op (fun () -> Term (27, [term_ref t1; term_ref t2])) (fun () -> p#mk_real_le (node_of t1) (node_of t2))
+  method pprint t = match t.node with Some n -> p#pprint n | None -> "<fixpoint clause template>"
+  method pprint_sort ((_, tp): int * 'a) = p#pprint_sort tp
+  method pprint_sym s = match s.sym with Some s -> p#pprint_sym s | None -> "<fixpoint clause template>"
+  method push = effect (fun () -> Push) (fun () -> p#push)
+  method pop = effect (fun () -> Pop) (fun () -> p#pop)
+  method assert_term t = effect (fun () -> AssertTerm (term_ref t)) (fun () -> p#assert_term (node_of t))
+  method assume t =
+    if !untraced > 0 then p#assume (node_of t) else begin
+      check_top "assume";
+      let tref = term_ref t in
+      let result = p#assume (node_of t) in
+      emit (Assume (tref, result));
+      result
+    end
+  method query t =
+    if !untraced > 0 then p#query (node_of t) else begin
+      check_top "query";
+      let tref = term_ref t in
+      let result = p#query (node_of t) in
+      emit (Query (tref, result));
+      result
+    end
+  method stats = p#stats
+  method begin_formal = effect (fun () -> BeginFormal) (fun () -> p#begin_formal)
+  method end_formal = effect (fun () -> EndFormal) (fun () -> p#end_formal)
+  method mk_bound i ((code, tp): int * 'a) = term_op (fun () -> Bound (i, code)) (fun () -> p#mk_bound i tp)
+  method assume_forall descr triggers (tps: (int * 'a) list) body =
+    effect
+      (fun () -> AssumeForall (descr, List.map term_ref triggers, List.map fst tps, term_ref body))
+      (fun () -> p#assume_forall descr (List.map node_of triggers) (List.map snd tps) (node_of body))
+  method simplify t =
+    if !untraced > 0 then
+      match p#simplify (node_of t) with None -> None | Some n -> Some (untraced_term n)
+    else begin
+      check_top "simplify";
+      let tref = term_ref t in
+      let result = p#simplify (node_of t) in
+      emit (Simplify (tref, result <> None));
+      match result with None -> None | Some n -> Some (alloc_term (Some n))
+    end
+  (* Writes out the rest of the trace and closes the trace file. *)
+  method close =
+    Buffer.output_buffer out buffer;
+    Buffer.clear buffer;
+    close_out out
+end
+
+(* Region: replaying *)
+
+type ('b, 'c) replay_scope = {
+  replay_parent: ('b, 'c) replay_scope option;
+  terms: (int, 'c) Hashtbl.t;
+  mutable terms_created: int;
+  symbols: (int, 'b) Hashtbl.t;
+  mutable symbols_created: int
+}
+
+(* time kind f calls f, which performs a top-level call of the given kind on the prover, and returns its result. *)
+type replay_timer = {time: 'r. string -> (unit -> 'r) -> 'r}
+
+(* Replays the ops against prover ctxt; returns the number of assumes and queries whose answer differs from the trace.
+   Calls that clauses make while the prover applies them are part of the time of the top-level call. *)
+let replay (ctxt: ('a, 'b, 'c) context) (timer: replay_timer) (ops: op list) =
+  let mismatches = ref 0 in
+  let type_of_code code =
+    match code with
+      0 -> ctxt#type_bool
+    | 1 -> ctxt#type_int
+    | 2 -> ctxt#type_real
+    | 3 -> ctxt#type_inductive
+    | _ -> failwith (Printf.sprintf "Prover trace: bad type code %d" code)
+  in
+  let new_scope parent = {replay_parent = parent; terms = Hashtbl.create 64; terms_created = 0; symbols = Hashtbl.create 16; symbols_created = 0} in
+  let lookup table count scope (up, n) =
+    if up = 0 then
+      Hashtbl.find (table scope) (count scope - n)
+    else
+      let rec iter up scope =
+        if up = 0 then Hashtbl.find (table scope) n else
+        match scope.replay_parent with Some scope -> iter (up - 1) scope | None -> failwith "Prover trace: bad reference"
+      in
+      iter up scope
+  in
+  let term scope r = lookup (fun s -> s.terms) (fun s -> s.terms_created) scope r in
+  let symbol scope r = lookup (fun s -> s.symbols) (fun s -> s.symbols_created) scope r in
+  let add_term scope t = Hashtbl.replace scope.terms scope.terms_created t; scope.terms_created <- scope.terms_created + 1 in
+  let add_symbol scope s = Hashtbl.replace scope.symbols scope.symbols_created s; scope.symbols_created <- scope.symbols_created + 1 in
+  let apply_term_op code ts =
+    match (code, ts) with
+      (1, [t]) -> ctxt#mk_boxed_int t
+    | (2, [t]) -> ctxt#mk_unboxed_int t
+    | (3, [t]) -> ctxt#mk_boxed_real t
+    | (4, [t]) -> ctxt#mk_unboxed_real t
+    | (5, [t]) -> ctxt#mk_boxed_bool t
+    | (6, [t]) -> ctxt#mk_unboxed_bool t
+    | (7, []) -> ctxt#mk_true
+    | (8, []) -> ctxt#mk_false
+    | (9, [t1; t2]) -> ctxt#mk_and t1 t2
+    | (10, [t1; t2]) -> ctxt#mk_or t1 t2
+    | (11, [t]) -> ctxt#mk_not t
+    | (12, [t1; t2; t3]) -> ctxt#mk_ifthenelse t1 t2 t3
+    | (13, [t1; t2]) -> ctxt#mk_iff t1 t2
+    | (14, [t1; t2]) -> ctxt#mk_implies t1 t2
+    | (15, [t1; t2]) -> ctxt#mk_eq t1 t2
+    | (16, [t1; t2]) -> ctxt#mk_add t1 t2
+    | (17, [t1; t2]) -> ctxt#mk_sub t1 t2
+    | (18, [t1; t2]) -> ctxt#mk_mul t1 t2
+    | (19, [t1; t2]) -> ctxt#mk_div t1 t2
+    | (20, [t1; t2]) -> ctxt#mk_mod t1 t2
+    | (21, [t1; t2]) -> ctxt#mk_lt t1 t2
+    | (22, [t1; t2]) -> ctxt#mk_le t1 t2
+    | (23, [t1; t2]) -> ctxt#mk_real_add t1 t2
+    | (24, [t1; t2]) -> ctxt#mk_real_sub t1 t2
+    | (25, [t1; t2]) -> ctxt#mk_real_mul t1 t2
+    | (26, [t1; t2]) -> ctxt#mk_real_lt t1 t2
+    | (27, [t1; t2]) -> ctxt#mk_real_le t1 t2
+    | _ -> failwith (Printf.sprintf "Prover trace: bad term opcode %d" code)
+  in
+  let rec run scope op =
+    let time f = match scope.replay_parent with None -> timer.time (op_name op) f | Some _ -> f () in
+    match op with
+      Term (code, ts) -> let ts = List.map (term scope) ts in add_term scope (time (fun () -> apply_term_op code ts))
+    | App (s, ts) ->
+      let s = symbol scope s in
+      let ts = List.map (term scope) ts in
+      add_term scope (time (fun () -> ctxt#mk_app s ts))
+    | IntLit n -> add_term scope (time (fun () -> ctxt#mk_intlit n))
+    | IntLitOfString s -> add_term scope (time (fun () -> ctxt#mk_intlit_of_string s))
+    | RealLit n -> add_term scope (time (fun () -> ctxt#mk_reallit n))
+    | RealLitOfNum s -> let n = num_of_string s in add_term scope (time (fun () -> ctxt#mk_reallit_of_num n))
+    | Bound (i, tp) -> let tp = type_of_code tp in add_term scope (time (fun () -> ctxt#mk_bound i tp))
+    | Simplify (t, simplified) ->
+      let t = term scope t in
+      let result = time (fun () -> ctxt#simplify t) in
+      if simplified then add_term scope (match result with Some t -> t | None -> t)
+    | Symbol (name, domain, range, kind) ->
+      let domain = List.map type_of_code domain in
+      let range = type_of_code range in
+      add_symbol scope (time (fun () -> ctxt#mk_symbol name domain range kind))
+    | SetFpclauses (s, k, clauses) ->
+      let s = symbol scope s in
+      let clauses =
+        List.map
+          begin fun {clause_ctor; xcount; ycount; body; result} ->
+            (symbol scope clause_ctor,
+             fun xs ys ->
+               let body_scope = new_scope (Some scope) in
+               List.iter (add_term body_scope) xs;
+               List.iter (add_term body_scope) ys;
+               if body_scope.terms_created <> xcount + ycount then failwith "Prover trace: a fixpoint clause was applied to the wrong number of arguments";
+               List.iter (run body_scope) body;
+               term body_scope result)
+          end
+          clauses
+      in
+      time (fun () -> ctxt#set_fpclauses s k clauses)
+    | Push -> time (fun () -> ctxt#push)
+    | Pop -> time (fun () -> ctxt#pop)
+    | AssertTerm t -> let t = term scope t in time (fun () -> ctxt#assert_term t)
+    | Assume (t, expected) ->
+      let t = term scope t in
+      let result = time (fun () -> ctxt#assume t) in
+      if result <> expected then incr mismatches
+    | Query (t, expected) ->
+      let t = term scope t in
+      let result = time (fun () -> ctxt#query t) in
+      if result <> expected then incr mismatches
+    | BeginFormal -> time (fun () -> ctxt#begin_formal)
+    | EndFormal -> time (fun () -> ctxt#end_formal)
+    | AssumeForall (descr, triggers, tps, body) ->
+      let triggers = List.map (term scope) triggers in
+      let tps = List.map type_of_code tps in
+      let body = term scope body in
+      time (fun () -> ctxt#assume_forall descr triggers tps body)
+  in
+  List.iter (run (new_scope None)) ops;
+  !mismatches
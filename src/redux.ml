@@ -50,6 +50,28 @@ let rec try_assoc key al =
 
 let flatmap f xs = List.concat (List.map f xs)
 
+(* Bitwise operations on integers viewed as infinite two's-complement bit strings. These are the
+   semantics of VeriFast's bitand, bitor, bitxor, bitnot, shiftleft and shiftright symbols. Big_int's
+   and_big_int and or_big_int support only nonnegative operands; the other cases use De Morgan. *)
+let bitnot_num n = minus_num n -/ Int 1
+
+let rec bitand_num n1 n2 =
+  match (sign_num n1 >= 0, sign_num n2 >= 0) with
+    (true, true) -> num_of_big_int (and_big_int (big_int_of_num n1) (big_int_of_num n2))
+  | (false, false) -> bitnot_num (bitor_num (bitnot_num n1) (bitnot_num n2))
+  | (false, true) -> n2 -/ bitand_num n2 (bitnot_num n1)
+  | (true, false) -> n1 -/ bitand_num n1 (bitnot_num n2)
+and bitor_num n1 n2 =
+  if sign_num n1 >= 0 && sign_num n2 >= 0 then
+    num_of_big_int (or_big_int (big_int_of_num n1) (big_int_of_num n2))
+  else
+    bitnot_num (bitand_num (bitnot_num n1) (bitnot_num n2))
+
+let bitxor_num n1 n2 = bitor_num n1 n2 -/ bitand_num n1 n2
+
+(* Shifts by more than this many bits are left to the axioms. *)
+let max_shift_amount = 1024
+
 type ('symbol, 'termnode) term =
   TermNode of 'termnode
 | Iff of ('symbol, 'termnode) term * ('symbol, 'termnode) term
@@ -99,6 +121,165 @@ let term_subst bound_env t =
   in
   iter t
 
+(* Structural hashing and equality of terms; symbols and term nodes are compared by identity. *)
+let term_hash_to_depth depth t =
+  let rec iter depth t =
+    if depth = 0 then 0 else
+    let iter = iter (depth - 1) in
+    let combine tag hs = List.fold_left (fun h h' -> h * 31 + h') tag hs in
+    match t with
+      TermNode n -> combine 1 [Hashtbl.hash n]
+    | Iff (t1, t2) -> combine 2 [iter t1; iter t2]
+    | Eq (t1, t2) -> combine 3 [iter t1; iter t2]
+    | Le (t1, t2) -> combine 4 [iter t1; iter t2]
+    | Lt (t1, t2) -> combine 5 [iter t1; iter t2]
+    | Not t -> combine 6 [iter t]
+    | And (t1, t2) -> combine 7 [iter t1; iter t2]
+    | Or (t1, t2) -> combine 8 [iter t1; iter t2]
+    | Add (t1, t2) -> combine 9 [iter t1; iter t2]
+    | Sub (t1, t2) -> combine 10 [iter t1; iter t2]
+    | Mul (t1, t2) -> combine 11 [iter t1; iter t2]
+    | NumLit n -> combine 12 [Hashtbl.hash n]
+    | App (s, ts, _) -> combine 13 (Hashtbl.hash s::List.map iter ts)
+    | IfThenElse (t1, t2, t3) -> combine 14 [iter t1; iter t2; iter t3]
+    | RealLe (t1, t2) -> combine 15 [iter t1; iter t2]
+    | RealLt (t1, t2) -> combine 16 [iter t1; iter t2]
+    | True -> 17
+    | False -> 18
+    | BoundVar i -> combine 19 [i]
+    | Implies (t1, t2) -> combine 20 [iter t1; iter t2]
+  in
+  iter depth t land max_int
+
+let term_hash t = term_hash_to_depth 8 t
+
+(* Subterms of hash-consed terms are hash-consed, so a shallow hash discriminates well enough. *)
+let hashcons_depth = 3
+
+(* The maximum number of decisions replayed to check whether a learned clause needs a decision; see perform_pending_splits. *)
+let clause_minimization_replay_limit = 8
+
+let rec term_eq t1 t2 =
+  t1 == t2 ||
+  match (t1, t2) with
+    (TermNode n1, TermNode n2) -> n1 == n2
+  | (Iff (t11, t12), Iff (t21, t22)) | (Eq (t11, t12), Eq (t21, t22))
+  | (Le (t11, t12), Le (t21, t22)) | (Lt (t11, t12), Lt (t21, t22))
+  | (And (t11, t12), And (t21, t22)) | (Or (t11, t12), Or (t21, t22))
+  | (Add (t11, t12), Add (t21, t22)) | (Sub (t11, t12), Sub (t21, t22)) | (Mul (t11, t12), Mul (t21, t22))
+  | (RealLe (t11, t12), RealLe (t21, t22)) | (RealLt (t11, t12), RealLt (t21, t22))
+  | (Implies (t11, t12), Implies (t21, t22)) -> term_eq t11 t21 && term_eq t12 t22
+  | (Not t1, Not t2) -> term_eq t1 t2
+  | (NumLit n1, NumLit n2) -> eq_num n1 n2
+  | (App (s1, ts1, _), App (s2, ts2, _)) -> s1 == s2 && List.length ts1 = List.length ts2 && List.for_all2 term_eq ts1 ts2
+  | (IfThenElse (t11, t12, t13), IfThenElse (t21, t22, t23)) -> term_eq t11 t21 && term_eq t12 t22 && term_eq t13 t23
+  | (True, True) | (False, False) -> true
+  | (BoundVar i1, BoundVar i2) -> i1 = i2
+  | _ -> false
+
+(* Equality of terms whose subterms are hash-consed. *)
+let term_shallow_eq t1 t2 =
+  match (t1, t2) with
+    (TermNode n1, TermNode n2) -> n1 == n2
+  | (Iff (t11, t12), Iff (t21, t22)) | (Eq (t11, t12), Eq (t21, t22))
+  | (Le (t11, t12), Le (t21, t22)) | (Lt (t11, t12), Lt (t21, t22))
+  | (And (t11, t12), And (t21, t22)) | (Or (t11, t12), Or (t21, t22))
+  | (Add (t11, t12), Add (t21, t22)) | (Sub (t11, t12), Sub (t21, t22)) | (Mul (t11, t12), Mul (t21, t22))
+  | (RealLe (t11, t12), RealLe (t21, t22)) | (RealLt (t11, t12), RealLt (t21, t22))
+  | (Implies (t11, t12), Implies (t21, t22)) -> t11 == t21 && t12 == t22
+  | (Not t1, Not t2) -> t1 == t2
+  | (NumLit n1, NumLit n2) -> eq_num n1 n2
+  | (App (s1, ts1, tn1), App (s2, ts2, tn2)) ->
+    s1 == s2 &&
+    begin match (tn1, tn2) with (None, None) -> true | (Some tn1, Some tn2) -> tn1 == tn2 | _ -> false end &&
+    List.length ts1 = List.length ts2 && List.for_all2 (==) ts1 ts2
+  | (IfThenElse (t11, t12, t13), IfThenElse (t21, t22, t23)) -> t11 == t21 && t12 == t22 && t13 == t23
+  | (True, True) | (False, False) -> true
+  | (BoundVar i1, BoundVar i2) -> i1 = i2
+  | _ -> false
+
+(* A ground value is built from constructors and literals only. *)
+let rec is_ground_value t =
+  match t with
+    NumLit _ | True | False -> true
+  | App (s, ts, _) -> begin match s#kind with Ctor _ -> List.for_all is_ground_value ts | _ -> false end
+  | _ -> false
+
+let rec ground_value_eq v1 v2 =
+  match (v1, v2) with
+    (NumLit n1, NumLit n2) -> eq_num n1 n2
+  | (True, True) | (False, False) -> true
+  | (App (s1, vs1, _), App (s2, vs2, _)) -> s1 == s2 && List.for_all2 ground_value_eq vs1 vs2
+  | _ -> false
+
+exception Not_ground
+
+(* The maximum number of fixpoint unfoldings of one ground evaluation *)
+let ground_eval_budget = 10000
+
+let find_ground_eval_memo table h t =
+  let rec iter entries =
+    match entries with
+      [] -> None
+    | (t', v)::entries -> if term_eq t t' then Some v else iter entries
+  in
+  iter (Hashtbl.find_all table h)
+
+(* Looks up the entry for term t in a table keyed by term hash whose entries are (term, value) pairs. *)
+let find_term_entry table h t =
+  let rec iter entries =
+    match entries with
+      [] -> None
+    | (t', x)::entries -> if t' == t then Some x else iter entries
+  in
+  iter (Hashtbl.find_all table h)
+
+(* E-matching code trees. The trigger patterns of all axioms whose top-level symbol is f are compiled
+   into one tree, stored in symbol f. Matching an application f(v1, ..., vn) runs the tree on the stack
+   of values [v1; ...; vn]; each instruction consumes the value on top of the stack. Patterns with a
+   common prefix share that part of the tree, and with it the child and merge listeners that matching
+   leaves behind for applications and equalities that do not exist yet. *)
+type 'symbol ematch_instr =
+  EBind (* Bind the value to the next register *)
+| ECompare of int (* The value must equal the given register *)
+| ENumber of num (* The value must equal the given number *)
+| EDescend of 'symbol (* Replace the value by the arguments of an application of the given symbol in its class *)
+
+let ematch_instr_eq i1 i2 =
+  match (i1, i2) with
+    (EBind, EBind) -> true
+  | (ECompare r1, ECompare r2) -> r1 = r2
+  | (ENumber n1, ENumber n2) -> eq_num n1 n2
+  | (EDescend s1, EDescend s2) -> s1 == s2
+  | _ -> false
+
+type ematch_axiom = {
+  axiom_id: int;
+  axiom_description: string;
+  mutable axiom_instance_count: int;
+  mutable axiom_ticks: int64 (* Time spent asserting the instances *)
+}
+
+type ('symbol, 'termnode) ematch_code = {
+  mutable ematch_branches: ('symbol ematch_instr * ('symbol, 'termnode) ematch_code) list;
+  mutable ematch_yields: ('symbol, 'termnode) ematch_yield list (* The patterns that end here *)
+}
+and ('symbol, 'termnode) ematch_yield = {
+  yield_axiom: ematch_axiom;
+  yield_registers: int array; (* The bound variable held by each register *)
+  yield_body: ('symbol, 'termnode) term
+}
+
+let new_ematch_code () = {ematch_branches = []; ematch_yields = []}
+
+(* Entries of the context's undo trail. The common cases are recorded as tagged entries rather than closures. *)
+type ('termnode, 'valuenode) undo_entry =
+  UndoNothing
+| UndoTermnode of 'termnode (* Pop the termnode's own state stack. *)
+| UndoValuenode of 'valuenode (* Pop the valuenode's own state stack. *)
+| UndoCongruence of (int * int list) (* Remove the most recent congruence table entry for this key. *)
+| UndoAction of (unit -> unit)
+
 module NumMap = Map.Make (struct type t = num let compare a b = compare_num a b end)
 
 let zero_num = num_of_int 0
@@ -125,12 +306,14 @@ class symbol (kind: symbol_kind) (name: string) =
         )
         cs;
       fpclauses <- Some a
-    val mutable apply_listeners = []
-    method applied term = List.iter (fun listener -> listener term) apply_listeners
-    method add_apply_listener ctxt listener =
-      let listeners = apply_listeners in
-      apply_listeners <- listener::listeners;
-      ctxt#register_popaction (fun () -> apply_listeners <- listeners)
+    val ematch_code: (symbol, termnode) ematch_code = new_ematch_code ()
+    method ematch_code = ematch_code
+    val mutable applications: termnode list = [] (* So that axioms added later can match them *)
+    method applications = applications
+    method add_application ctxt term =
+      let terms = applications in
+      applications <- term::terms;
+      ctxt#register_popaction (fun () -> applications <- terms)
   end
 and termnode (ctxt: context) s initial_children =
   object (self)
@@ -141,14 +324,18 @@ and termnode (ctxt: context) s initial_children =
     val mutable children: valuenode list = initial_children
     val mutable value = new valuenode ctxt
     val mutable reduced = false
+    val scope_alive = ctxt#scope_alive
     method kind = symbol#kind
     method symbol = symbol
     method children = children
+    method initial_children = initial_children
+    (* Whether the scope in which this node was created has not been popped; see context#live_termnode. *)
+    method alive = !scope_alive
     method push =
       if context#pushdepth <> pushdepth then
       begin
         popstack <- (pushdepth, children, value, reduced)::popstack;
-        context#register_popaction (fun () -> self#pop);
+        context#register_undo (UndoTermnode (self :> termnode));
         pushdepth <- context#pushdepth
       end
     method pop =
@@ -163,8 +350,8 @@ and termnode (ctxt: context) s initial_children =
     method value = value
     method to_poly =
       match value#as_number with
-        None -> (zero_num, [((self :> termnode), unit_num)])
-      | Some n -> (n, [])
+        None -> (Mynum.zero_num, [((self :> termnode), Mynum.unit_num)])
+      | Some n -> (Mynum.num_of_big_num n, [])
     method is_ctor = match symbol#kind with Ctor _ -> true | _ -> false
     initializer begin
       let rec iter k (vs: valuenode list) =
@@ -175,8 +362,9 @@ and termnode (ctxt: context) s initial_children =
           iter (k + 1) vs
       in
       iter 0 initial_children;
+      if initial_children <> [] then ctxt#congruence_register (self :> termnode);
       value#set_initial_child (self :> termnode);
-      symbol#applied (self :> termnode);
+      ctxt#ematch_application (self :> termnode);
       match symbol#kind with
         Ctor j -> ()
       | Fixpoint k ->
@@ -236,6 +424,7 @@ and termnode (ctxt: context) s initial_children =
               else if v2 = ctxt#false_node#value then
                 ignore (ctxt#assert_eq value ctxt#false_node#value)
             end
+          | (("bitand"|"bitor"|"bitxor"|"bitnot"|"shiftleft"|"shiftright"), _) -> self#reduce_bitop true
           | _ -> ()
         end
     end
@@ -253,6 +442,114 @@ and termnode (ctxt: context) s initial_children =
       children <- replace 0 children;
       if symbol#kind = Uninterp && (symbol#name = "==" || symbol#name = "<==>") then
         match children with [v1; v2] when v1 = v2 -> ctxt#add_redex (fun () -> ctxt#assert_eq value ctxt#true_node#value) | _ -> ()
+    (* Bit-level theory. If all operands are constants, the value is computed; if one operand is a constant,
+       the operation is either simplified away or bounded by linear facts for Simplex, e.g. 0 <= x & m <= m
+       for m >= 0. Called when the node is created and whenever an operand becomes a constant. *)
+    method reduce_bitop created =
+      let num v = match v#as_number with Some n when is_integer_num n -> Some n | _ -> None in
+      let shift_amount v =
+        match num v with
+          Some n when sign_num n >= 0 && n <=/ Int max_shift_amount -> Some (power_num (Int 2) n)
+        | _ -> None
+      in
+      let r = (self :> termnode) in
+      let eq_const n = ctxt#report_bitop_fact; ctxt#add_redex (fun () -> ctxt#assert_eq value (ctxt#get_numnode n)#value) in
+      let eq_node (t: termnode) = ctxt#report_bitop_fact; ctxt#add_redex (fun () -> ctxt#assert_eq value t#value) in
+      (* c + sum of scale * t = 0 *)
+      let linear_eq c ts =
+        ctxt#report_bitop_fact;
+        ctxt#add_redex (fun () -> ctxt#simplex_assert_eq (Mynum.num_of_big_num c) (List.map (fun (scale, (t: termnode)) -> (Mynum.num_of_big_num scale, t#value#mk_unknown)) ts))
+      in
+      (* c + sum of scale * t >= 0 *)
+      let linear_ge c ts =
+        ctxt#report_bitop_fact;
+        ctxt#add_redex (fun () -> ctxt#simplex_assert_ge (Mynum.num_of_big_num c) (List.map (fun (scale, (t: termnode)) -> (Mynum.num_of_big_num scale, t#value#mk_unknown)) ts))
+      in
+      let one = Int 1 in
+      let minus_one = Int (-1) in
+      let with_constant v1 v2 f =
+        match (num v1, num v2) with
+          (Some _, Some _) -> ()
+        | (Some m, None) -> f m v2#initial_child
+        | (None, Some m) -> f m v1#initial_child
+        | (None, None) -> ()
+      in
+      match (symbol#name, children) with
+        ("bitnot", [v]) ->
+        begin match num v with
+          Some n -> eq_const (bitnot_num n)
+        | None -> if created then linear_eq minus_one [(minus_one, r); (minus_one, v#initial_child)]
+        end
+      | ("bitand", [v1; v2]) ->
+        begin match (num v1, num v2) with
+          (Some n1, Some n2) -> eq_const (bitand_num n1 n2)
+        | (None, None) -> if created && v1 == v2 then eq_node v1#initial_child
+        | _ ->
+          with_constant v1 v2 $. fun m x ->
+          if sign_num m = 0 then eq_const m
+          else if m =/ minus_one then eq_node x
+          else if sign_num m > 0 then begin
+            linear_ge (Int 0) [(one, r)];
+            linear_ge m [(minus_one, r)]
+          end else begin
+            (* x & m clears the finitely many bits that are clear in m, so x + m + 1 <= x & m <= x *)
+            linear_ge (Int 0) [(one, x); (minus_one, r)];
+            linear_ge (minus_num m -/ one) [(one, r); (minus_one, x)]
+          end
+        end
+      | ("bitor", [v1; v2]) ->
+        begin match (num v1, num v2) with
+          (Some n1, Some n2) -> eq_const (bitor_num n1 n2)
+        | (None, None) -> if created && v1 == v2 then eq_node v1#initial_child
+        | _ ->
+          with_constant v1 v2 $. fun m x ->
+          if sign_num m = 0 then eq_node x
+          else if m =/ minus_one then eq_const m
+          else if sign_num m > 0 then begin
+            (* x <= x | m <= x + m *)
+            linear_ge (Int 0) [(one, r); (minus_one, x)];
+            linear_ge m [(one, x); (minus_one, r)]
+          end else begin
+            (* m <= x | m <= -1 *)
+            linear_ge (minus_num m) [(one, r)];
+            linear_ge minus_one [(minus_one, r)]
+          end
+        end
+      | ("bitxor", [v1; v2]) ->
+        begin match (num v1, num v2) with
+          (Some n1, Some n2) -> eq_const (bitxor_num n1 n2)
+        | (None, None) -> if created && v1 == v2 then eq_const (Int 0)
+        | _ ->
+          with_constant v1 v2 $. fun m x ->
+          if sign_num m = 0 then eq_node x
+          else if m =/ minus_one then linear_eq minus_one [(minus_one, r); (minus_one, x)]
+          else if sign_num m > 0 then begin
+            (* x - m <= x ^ m <= x + m *)
+            linear_ge m [(one, r); (minus_one, x)];
+            linear_ge m [(one, x); (minus_one, r)]
+          end else begin
+            (* x ^ m = bitnot (x ^ bitnot m), so -x + m <= x ^ m <= -x - m - 2 *)
+            linear_ge (minus_num m) [(one, r); (one, x)];
+            linear_ge (minus_num m -/ Int 2) [(minus_one, r); (minus_one, x)]
+          end
+        end
+      | ("shiftleft", [v1; v2]) ->
+        begin match (num v1, shift_amount v2) with
+          (Some n, Some p) -> eq_const (n */ p)
+        | (None, Some p) -> linear_eq (Int 0) [(minus_one, r); (p, v1#initial_child)]
+        | _ -> ()
+        end
+      | ("shiftright", [v1; v2]) ->
+        begin match (num v1, shift_amount v2) with
+          (Some n, Some p) -> eq_const (floor_num (n // p))
+        | (None, Some p) ->
+          (* p * (x >> k) <= x <= p * (x >> k) + p - 1 *)
+          let x = v1#initial_child in
+          linear_ge (Int 0) [(one, x); (minus_num p, r)];
+          linear_ge (p -/ one) [(p, r); (minus_one, x)]
+        | _ -> ()
+        end
+      | _ -> ()
     method child_ctorchild_added k =
       if symbol#kind = Fixpoint k then
         ctxt#add_redex (fun () -> self#reduce)
@@ -284,10 +581,11 @@ and termnode (ctxt: context) s initial_children =
           begin match v2#as_number with
             None ->
             let t2 = v2#initial_child in
-            ctxt#add_redex (fun () -> ctxt#simplex_assert_eq zero_num [neg_unit_num, value#mk_unknown; n1, t2#value#mk_unknown])
+            ctxt#add_redex (fun () -> ctxt#simplex_assert_eq Mynum.zero_num [Mynum.neg_unit_num, value#mk_unknown; Mynum.num_of_big_num n1, t2#value#mk_unknown])
           | Some n2 ->
             ctxt#add_redex (fun () -> ctxt#assert_eq value (ctxt#get_numnode (n1 */ n2))#value)
           end
+        | (("bitand"|"bitor"|"bitxor"|"bitnot"|"shiftleft"|"shiftright"), _, _) -> self#reduce_bitop false
         | _ -> ()
     method parent_ctorchild_added =
       match (symbol#name, children) with
@@ -306,33 +604,33 @@ and termnode (ctxt: context) s initial_children =
       | ("<=", [v1; v2]) ->
         begin
           if value = ctxt#true_node#value then
-            ctxt#add_redex (fun () -> ctxt#assert_le v1#initial_child zero_num v2#initial_child)
+            ctxt#add_redex (fun () -> ctxt#assert_le v1#initial_child Mynum.zero_num v2#initial_child)
           else
-            ctxt#add_redex (fun () -> ctxt#assert_le v2#initial_child unit_num v1#initial_child)
+            ctxt#add_redex (fun () -> ctxt#assert_le v2#initial_child Mynum.unit_num v1#initial_child)
         end
       | ("<", [v1; v2]) ->
         begin
           if value = ctxt#true_node#value then
-            ctxt#add_redex (fun () -> ctxt#assert_le v1#initial_child unit_num v2#initial_child)
+            ctxt#add_redex (fun () -> ctxt#assert_le v1#initial_child Mynum.unit_num v2#initial_child)
           else
-            ctxt#add_redex (fun () -> ctxt#assert_le v2#initial_child zero_num v1#initial_child)
+            ctxt#add_redex (fun () -> ctxt#assert_le v2#initial_child Mynum.zero_num v1#initial_child)
         end
       | ("<=/", [v1; v2]) ->
         begin
           if value = ctxt#true_node#value then
-            ctxt#add_redex (fun () -> ctxt#assert_le v1#initial_child zero_num v2#initial_child)
+            ctxt#add_redex (fun () -> ctxt#assert_le v1#initial_child Mynum.zero_num v2#initial_child)
           else begin
-            ctxt#add_redex (fun () -> ctxt#assert_le v2#initial_child zero_num v1#initial_child);
+            ctxt#add_redex (fun () -> ctxt#assert_le v2#initial_child Mynum.zero_num v1#initial_child);
             ctxt#add_redex (fun () -> ctxt#assert_neq v1#initial_child#value v2#initial_child#value)
           end
         end
       | ("</", [v1; v2]) ->
         begin
           if value = ctxt#true_node#value then begin
-            ctxt#add_redex (fun () -> ctxt#assert_le v1#initial_child zero_num v2#initial_child);
+            ctxt#add_redex (fun () -> ctxt#assert_le v1#initial_child Mynum.zero_num v2#initial_child);
             ctxt#add_redex (fun () -> ctxt#assert_neq v1#initial_child#value v2#initial_child#value)
           end else
-            ctxt#add_redex (fun () -> ctxt#assert_le v2#initial_child zero_num v1#initial_child)
+            ctxt#add_redex (fun () -> ctxt#assert_le v2#initial_child Mynum.zero_num v1#initial_child)
         end
       | ("&&", [v1; v2]) ->
         if value = ctxt#true_node#value then
@@ -359,8 +657,6 @@ and termnode (ctxt: context) s initial_children =
       | _ -> ()
     method matches s vs =
       List.mem symbol s && children = vs
-    method lookup_equivalent_parent_of v =
-      v#lookup_parent [symbol] children
     method reduce =
       if not reduced then
       begin
@@ -435,7 +731,7 @@ and valuenode (ctxt: context) =
       if ctxt#pushdepth <> pushdepth then
       begin
         popstack <- (pushdepth, children, parents, ctorchild, unknown, neqs, child_listeners, merge_listeners)::popstack;
-        ctxt#register_popaction (fun () -> self#pop);
+        ctxt#register_undo (UndoValuenode (self :> valuenode));
         pushdepth <- ctxt#pushdepth
       end
     method pop =
@@ -503,12 +799,15 @@ and valuenode (ctxt: context) =
       vnew#add_neq (self :> valuenode)
     method lookup_parent s vs =
       let result =
-      let rec iter ns =
-        match ns with
+      let rec iter ss =
+        match ss with
           [] -> None
-        | (n, _)::ns -> if n#matches s vs then Some n else iter ns
+        | s::ss ->
+          match ctxt#congruence_find s vs with
+            None -> iter ss
+          | result -> result
       in
-      iter parents
+      iter s
       in
       if ctxt#verbosity > 20 then trace "%d.lookup_parent %s returns %s" (Oo.id self) (String.concat ", " (List.map (fun s -> sprintf "%s(%d)" s#name (Oo.id s)) s)) (match result with None -> "None" | Some v -> v#pprint);
       result
@@ -543,7 +842,7 @@ and valuenode (ctxt: context) =
             let Ctor (NumberCtor n) = t#symbol#kind in
             context#add_redex (fun () ->
               ctxt#reportExportingConstant;
-              context#simplex_assert_eq n [(neg_unit_num, u)]
+              context#simplex_assert_eq (Mynum.num_of_big_num n) [(Mynum.neg_unit_num, u)]
             )
         in
         match (ctorchild, v#ctorchild) with
@@ -559,11 +858,14 @@ and valuenode (ctxt: context) =
         flatmap
           (fun (n, k) ->
              let result =
-               match n#lookup_equivalent_parent_of v with
-                 None ->
-                 []
-               | Some n' ->
+               match context#congruence_find n#symbol n#children with
+                 Some n' when n' != n ->
                  [(n, n')]
+               | Some _ ->
+                 []
+               | None ->
+                 context#congruence_register n;
+                 []
              in
              v#add_parent (n, k);
              result
@@ -612,7 +914,7 @@ and valuenode (ctxt: context) =
           begin
             (* print_endline ("Exporting equality to Simplex: " ^ u1#name ^ " = " ^ u2#name); *)
             ctxt#reportExportingEquality;
-            match ctxt#simplex_assert_eq zero_num [unit_num, u1; neg_unit_num, u2] with
+            match ctxt#simplex_assert_eq Mynum.zero_num [Mynum.unit_num, u1; Mynum.neg_unit_num, u2] with
               Unsat3 -> Unsat
             | _ -> process_ctorchildren()
           end
@@ -679,27 +981,76 @@ and context () =
     val simplex = Simplex.new_simplex ()
     val mutable popstack = []
     val mutable pushdepth = 0
-    val mutable popactionlist: (unit -> unit) list = []
+    val mutable scope_alive = ref true (* Set to false when the current scope is popped *)
+    val trail: (termnode, valuenode) undo_entry Util.undo_trail = Util.create_undo_trail UndoNothing
     val mutable simplex_eqs = []
     val mutable simplex_consts = []
-    val mutable redexes = []
+    val redexes = Queue.create ()
     val mutable unsat = false
     val mutable implications = []
     val mutable pending_splits_front = initialPendingSplitsFrontNode
     val mutable pending_splits_back = initialPendingSplitsFrontNode
+    val mutable learned_clauses = [] (* (split, decisions): the split is refuted by these decisions; see perform_pending_splits *)
     val mutable formal_depth = 0  (* If formal_depth = 0, App terms are eagerly turned into E-graph nodes. *)
+    (* Maps (symbol, children) to the termnode with that symbol and those children, so that
+       node lookup and congruence detection do not need to scan a valuenode's parents.
+       Keys use object ids; entries added since the last push are removed on pop. Entries whose
+       node's children have changed since are stale and are filtered out by congruence_find. *)
+    val congruence_table: (int * int list, termnode) Hashtbl.t = Hashtbl.create 10000
     (* For diagnostics only. *)
     val mutable values = []
     
     (* Statistics *)
+    val mutable bitop_fact_count = 0
     val mutable max_truenode_childcount = 0
     val mutable max_falsenode_childcount = 0
+    val mutable congruence_probe_count = 0
+    val mutable congruence_hit_count = 0
     val mutable assume_core_count = 0
     val mutable split_count = 0
+    val mutable learned_clause_count = 0
+    val mutable learned_clause_hit_count = 0
+    val mutable clause_decisions_dropped_count = 0
+    val mutable backjump_count = 0
     val mutable simplex_assert_ge_count = 0
     val mutable simplex_assert_eq_count = 0
     val mutable simplex_assert_neq_count = 0
-    val mutable axioms: (string * int ref) list = []
+    val mutable axioms: ematch_axiom list = []
+    val mutable axiom_count = 0
+    val ematch_instances: (int * valuenode list, unit) Hashtbl.t = Hashtbl.create 1000 (* Keyed by axiom and the values of the bound terms *)
+    val mutable ematch_duplicate_count = 0
+    (* Query results, keyed by term_hash. An entry is valid only in the fact epoch in which it was computed.
+       A new epoch starts whenever a fact is asserted or a term is created; pop restores the epoch of the
+       corresponding push, so that sibling branches share the queries asked before they split. *)
+    val query_cache: (int, (symbol, termnode) term * int * bool) Hashtbl.t = Hashtbl.create 1000
+    (* The keys of the entries added in the current epoch since the last push. When a new epoch starts,
+       these entries can never become valid again, so they are evicted. *)
+    val mutable query_cache_epoch_keys = []
+    val mutable fact_epoch = 0
+    val mutable fact_epoch_count = 0
+    val mutable query_count = 0
+    val mutable query_cache_hit_count = 0
+    (* Terms built through mk_* are hash-consed, so that structurally equal terms are physically equal.
+       Like the caches of their term nodes and polynomial normal forms, the table is keyed by
+       term_hash_to_depth hashcons_depth and entries added after a push are removed by the pop. *)
+    val hashcons_table: (int, (symbol, termnode) term) Hashtbl.t = Hashtbl.create 10000
+    val termnode_cache: (int, ((symbol, termnode) term * termnode)) Hashtbl.t = Hashtbl.create 10000
+    val poly_cache: (int, ((symbol, termnode) term * (Mynum.num * (termnode * Mynum.num) list))) Hashtbl.t = Hashtbl.create 1000
+    val mutable hashcons_count = 0
+    val mutable hashcons_hit_count = 0
+    val mutable termnode_cache_count = 0
+    val mutable termnode_cache_hit_count = 0
+    val mutable poly_cache_count = 0
+    val mutable poly_cache_hit_count = 0
+    (* Results of ground fixpoint applications, keyed by term_hash; they do not depend on the path. *)
+    val ground_eval_memo: (int, ((symbol, termnode) term * (symbol, termnode) term)) Hashtbl.t = Hashtbl.create 1000
+    val mutable ground_eval_count = 0
+    val mutable ground_eval_memo_hit_count = 0
+    val mutable ground_eval_over_budget_count = 0
+    val mutable ematch_depth = 0
+    val mutable ematch_ticks = 0L
+    (* The number of case split branches being explored (see perform_pending_splits) *)
+    val mutable split_branch_depth = 0
     val assumes_with_pending_splits = Array.make 30 0
     val mutable assumes_with_more_pending_splits = 0
     
@@ -709,6 +1060,7 @@ and context () =
     
     method set_verbosity v = verbosity <- v
     
+    method report_bitop_fact = bitop_fact_count <- bitop_fact_count + 1
     method report_truenode_childcount n =
       if n > max_truenode_childcount then max_truenode_childcount <- n
     method report_falsenode_childcount n =
@@ -718,14 +1070,21 @@ and context () =
     method reportExportingConstant =
       simplex_assert_eq_count <- simplex_assert_eq_count + 1
     method stats =
-      let axiomTriggerCounts = axioms |> List.filter (fun (k, v) -> !v > 0) in
-      let maxAxiomNameLength = List.fold_left (fun n (k, v) -> max n (String.length k)) 0 axiomTriggerCounts in
+      let triggeredAxioms = axioms |> List.filter (fun a -> a.axiom_instance_count > 0) in
+      let maxAxiomNameLength = List.fold_left (fun n a -> max n (String.length a.axiom_description)) 0 triggeredAxioms in
       let axiomTriggerCounts =
-        axiomTriggerCounts
-          |> List.sort (fun (k1, v1) (k2, v2) -> compare !v1 !v2)
-          |> List.map (fun (k, v) -> Printf.sprintf "    %-*s %5d\n" maxAxiomNameLength k !v)
+        triggeredAxioms
+          |> List.sort (fun a1 a2 -> compare a1.axiom_instance_count a2.axiom_instance_count)
+          |> List.map (fun a -> Printf.sprintf "    %-*s %5d\n" maxAxiomNameLength a.axiom_description a.axiom_instance_count)
           |> String.concat ""
       in
+      let rec take n xs = match xs with x::xs when n > 0 -> x::take (n - 1) xs | _ -> [] in
+      let axiomTimings =
+        triggeredAxioms
+          |> List.sort (fun a1 a2 -> compare a2.axiom_ticks a1.axiom_ticks)
+          |> take 10
+          |> List.map (fun a -> ("Time spent asserting instances of axiom " ^ a.axiom_description, a.axiom_ticks))
+      in
       let assumesWithPendingSplits =
         assumes_with_pending_splits
           |> Array.fold_left (fun (i, xs) n -> (i + 1, (i, n)::xs))  (0, [])
@@ -742,48 +1101,101 @@ and context () =
           # toplevel assumes and queries (with # pending case splits) = %s\n\
           assume_core_count = %d\n\
           number of case splits = %d\n\
+          learned clauses = %d (used: %d; decisions dropped: %d); backjumps = %d\n\
           simplex_assert_ge_count = %d\n\
           simplex_assert_eq_count = %d\n\
           simplex_assert_neq_count = %d\n\
           max_truenode_childcount = %d\n\
           max_falsenode_childcount = %d\n\
+          congruence table probes = %d (hits: %d)\n\
+          duplicate axiom instances suppressed = %d\n\
+          queries = %d (answered from the query cache: %d)\n\
+          terms constructed = %d (shared: %d)\n\
+          term node lookups = %d (cached: %d); polynomial normalizations = %d (cached: %d)\n\
+          ground fixpoint evaluations = %d (memoized applications: %d; over budget: %d)\n\
+          bit-level facts = %d\n\
+          undo trail high-water mark = %d (Simplex: %d)\n\
+          simplex bounds tightened = %d (implied constants: %d; implied equalities: %d)\n\
           axiom triggered counts:\n%s\n\
         "
         pendingSplitsInfo
         assume_core_count
         split_count
+        learned_clause_count
+        learned_clause_hit_count
+        clause_decisions_dropped_count
+        backjump_count
         simplex_assert_ge_count
         simplex_assert_eq_count
         simplex_assert_neq_count
         max_truenode_childcount
         max_falsenode_childcount
+        congruence_probe_count
+        congruence_hit_count
+        ematch_duplicate_count
+        query_count
+        query_cache_hit_count
+        hashcons_count
+        hashcons_hit_count
+        termnode_cache_count
+        termnode_cache_hit_count
+        poly_cache_count
+        poly_cache_hit_count
+        ground_eval_count
+        ground_eval_memo_hit_count
+        ground_eval_over_budget_count
+        bitop_fact_count
+        trail.Util.trail_high_water_mark
+        simplex#get_trail_high_water_mark
+        (let (count, _, _) = simplex#get_bound_stats in count)
+        (let (_, count, _) = simplex#get_bound_stats in count)
+        (let (_, _, count) = simplex#get_bound_stats in count)
         axiomTriggerCounts
       in
-        (text, ["Time spent in query, assume, push, pop", Stopwatch.ticks stopwatch; "Time spent in Simplex", simplex#get_ticks])
+        (text, ["Time spent in query, assume, push, pop", Stopwatch.ticks stopwatch; "Time spent in Simplex", simplex#get_ticks; "Time spent in E-matching", ematch_ticks] @ axiomTimings)
     
     initializer
-      let eq_listener u1 u2 =
-        if verbosity > 10 then trace "Receiving equality from Simplex: %s(%s) = %s(%s)" (the (unknown_tag u1))#pprint (Simplex.print_unknown u1) (the (unknown_tag u2))#pprint (Simplex.print_unknown u2);
-        simplex_eqs <- (u1, u2)::simplex_eqs
+      let eq_listener eqs =
+        if verbosity > 10 then eqs |> List.iter (fun (u1, u2) -> trace "Receiving equality from Simplex: %s(%s) = %s(%s)" (the (unknown_tag u1))#pprint (Simplex.print_unknown u1) (the (unknown_tag u2))#pprint (Simplex.print_unknown u2));
+        simplex_eqs <- eqs @ simplex_eqs
       in
-      let const_listener u n =
-        if verbosity > 10 then trace "Receiving constant from Simplex: %s(%s) = %s" (the (unknown_tag u))#pprint (Simplex.print_unknown u) (string_of_num n);
-        simplex_consts <- (u, n)::simplex_consts
+      let const_listener consts =
+        if verbosity > 10 then consts |> List.iter (fun (u, n) -> trace "Receiving constant from Simplex: %s(%s) = %s" (the (unknown_tag u))#pprint (Simplex.print_unknown u) (Mynum.string_of_num n));
+        simplex_consts <- consts @ simplex_consts
       in
       simplex#register_listeners eq_listener const_listener;
+      simplex#set_give_up (fun () -> self#may_give_up);
       ttrue <- Some (self#get_node (self#mk_symbol "true" [] () (Ctor (CtorByOrdinal 0))) []);
       tfalse <- Some (self#get_node (self#mk_symbol "false" [] () (Ctor (CtorByOrdinal 1))) [])
     
     method simplex = simplex
+    
+    (* Whether to give up (see Proverapi.should_give_up) in the middle of E-matching or of a Simplex assertion. That is only
+       safe inside a case split branch, which is popped afterwards: elsewhere, skipping the work would lose it for good. *)
+    method private may_give_up = split_branch_depth > 0 && Proverapi.should_give_up ()
     method eq_symbol = eq_symbol
     method iff_symbol = iff_symbol
     
     method register_valuenode v =
       values <- v::values
     
+    method congruence_find (s: symbol) (vs: valuenode list): termnode option =
+      congruence_probe_count <- congruence_probe_count + 1;
+      match Hashtbl.find_opt congruence_table (Oo.id s, List.map Oo.id vs) with
+        Some n as result when n#matches [s] vs ->
+        congruence_hit_count <- congruence_hit_count + 1;
+        result
+      | _ -> None
+    
+    method congruence_register (n: termnode) =
+      let key = (Oo.id n#symbol, List.map Oo.id n#children) in
+      Hashtbl.add congruence_table key n;
+      self#register_undo (UndoCongruence key)
+    
     method get_numnode n =
       try
-        NumMap.find n numnodes
+        let node = NumMap.find n numnodes in
+        if node#alive then node else raise Not_found
       with
         Not_found ->
         (* print_endline ("Creating intlit node for " ^ string_of_int n); *)
@@ -817,25 +1229,37 @@ and context () =
     method mk_unboxed_real (t: (symbol, termnode) term) = t
     method mk_boxed_bool (t: (symbol, termnode) term) = t
     method mk_unboxed_bool (t: (symbol, termnode) term) = t
+    method private hashcons (t: (symbol, termnode) term): (symbol, termnode) term =
+      hashcons_count <- hashcons_count + 1;
+      let h = term_hash_to_depth hashcons_depth t in
+      let rec iter ts =
+        match ts with
+          [] ->
+          Hashtbl.add hashcons_table h t;
+          self#register_popaction (fun () -> Hashtbl.remove hashcons_table h);
+          t
+        | t'::ts -> if term_shallow_eq t t' then (hashcons_hit_count <- hashcons_hit_count + 1; t') else iter ts
+      in
+      iter (Hashtbl.find_all hashcons_table h)
     method mk_true: (symbol, termnode) term = True
     method mk_false: (symbol, termnode) term = False
-    method mk_and (t1: (symbol, termnode) term) (t2: (symbol, termnode) term): (symbol, termnode) term = And (t1, t2)
-    method mk_or (t1: (symbol, termnode) term) (t2: (symbol, termnode) term): (symbol, termnode) term = Or (t1, t2)
-    method mk_not (t: (symbol, termnode) term): (symbol, termnode) term = Not t
+    method mk_and (t1: (symbol, termnode) term) (t2: (symbol, termnode) term): (symbol, termnode) term = self#hashcons (And (t1, t2))
+    method mk_or (t1: (symbol, termnode) term) (t2: (symbol, termnode) term): (symbol, termnode) term = self#hashcons (Or (t1, t2))
+    method mk_not (t: (symbol, termnode) term): (symbol, termnode) term = self#hashcons (Not t)
     method mk_ifthenelse (t1: (symbol, termnode) term) (t2: (symbol, termnode) term) (t3: (symbol, termnode) term): (symbol, termnode) term =
-      IfThenElse (t1, t2, t3)
-    method mk_iff (t1: (symbol, termnode) term) (t2: (symbol, termnode) term): (symbol, termnode) term = Iff (t1, t2)
-    method mk_implies (t1: (symbol, termnode) term) (t2: (symbol, termnode) term): (symbol, termnode) term = Implies (t1, t2)
-    method mk_eq (t1: (symbol, termnode) term) (t2: (symbol, termnode) term): (symbol, termnode) term = Eq (t1, t2)
-    method mk_intlit (n: int): (symbol, termnode) term = NumLit (num_of_int n)
-    method mk_intlit_of_string (s: string): (symbol, termnode) term = NumLit (num_of_string s)
-    method mk_add (t1: (symbol, termnode) term) (t2: (symbol, termnode) term): (symbol, termnode) term = Add (t1, t2)
-    method mk_sub (t1: (symbol, termnode) term) (t2: (symbol, termnode) term): (symbol, termnode) term = Sub (t1, t2)
-    method mk_mul (t1: (symbol, termnode) term) (t2: (symbol, termnode) term): (symbol, termnode) term = Mul (t1, t2)
+      self#hashcons (IfThenElse (t1, t2, t3))
+    method mk_iff (t1: (symbol, termnode) term) (t2: (symbol, termnode) term): (symbol, termnode) term = self#hashcons (Iff (t1, t2))
+    method mk_implies (t1: (symbol, termnode) term) (t2: (symbol, termnode) term): (symbol, termnode) term = self#hashcons (Implies (t1, t2))
+    method mk_eq (t1: (symbol, termnode) term) (t2: (symbol, termnode) term): (symbol, termnode) term = self#hashcons (Eq (t1, t2))
+    method mk_intlit (n: int): (symbol, termnode) term = self#hashcons (NumLit (num_of_int n))
+    method mk_intlit_of_string (s: string): (symbol, termnode) term = self#hashcons (NumLit (num_of_string s))
+    method mk_add (t1: (symbol, termnode) term) (t2: (symbol, termnode) term): (symbol, termnode) term = self#hashcons (Add (t1, t2))
+    method mk_sub (t1: (symbol, termnode) term) (t2: (symbol, termnode) term): (symbol, termnode) term = self#hashcons (Sub (t1, t2))
+    method mk_mul (t1: (symbol, termnode) term) (t2: (symbol, termnode) term): (symbol, termnode) term = self#hashcons (Mul (t1, t2))
     method eval_term t =
       match t with
         NumLit n -> Some n
-      | TermNode t -> t#value#as_number
+      | TermNode t -> (self#live_termnode t)#value#as_number
       | Add (t1, t2) ->
         begin match self#eval_term t1, self#eval_term t2 with
           Some n1, Some n2 -> Some (n1 +/ n2)
@@ -851,27 +1275,32 @@ and context () =
           Some n1, Some n2 -> Some (n1 */ n2)
         | _ -> None
         end
+      | App (s, ts, _) when (match s#kind with Fixpoint _ -> true | _ -> false) && List.for_all is_ground_value ts ->
+        begin match self#ground_eval t with
+          Some (NumLit n) -> Some n
+        | _ -> None
+        end
       | _ -> None
     method mk_div (t1: (symbol, termnode) term) (t2: (symbol, termnode) term): (symbol, termnode) term =
       match self#eval_term t1, self#eval_term t2 with
-        Some n1, Some n2 -> NumLit (quo_num n1 n2)
+        Some n1, Some n2 -> self#hashcons (NumLit (quo_num n1 n2))
       | _ -> self#mk_app int_div_symbol [t1;t2]
     method mk_mod(t1: (symbol, termnode) term) (t2: (symbol, termnode) term): (symbol, termnode) term =
       match self#eval_term t1, self#eval_term t2 with
-        Some n1, Some n2 -> NumLit (mod_num n1 n2)
+        Some n1, Some n2 -> self#hashcons (NumLit (mod_num n1 n2))
       | _ -> self#mk_app int_mod_symbol [t1;t2]
-    method mk_lt (t1: (symbol, termnode) term) (t2: (symbol, termnode) term): (symbol, termnode) term = Lt (t1, t2)
-    method mk_le (t1: (symbol, termnode) term) (t2: (symbol, termnode) term): (symbol, termnode) term = Le (t1, t2)
-    method mk_reallit (n: int): (symbol, termnode) term = NumLit (num_of_int n)
-    method mk_reallit_of_num (n: num): (symbol, termnode) term = NumLit n
-    method mk_real_add (t1: (symbol, termnode) term) (t2: (symbol, termnode) term): (symbol, termnode) term = Add (t1, t2)
-    method mk_real_sub (t1: (symbol, termnode) term) (t2: (symbol, termnode) term): (symbol, termnode) term = Sub (t1, t2)
-    method mk_real_mul (t1: (symbol, termnode) term) (t2: (symbol, termnode) term): (symbol, termnode) term = Mul (t1, t2)
-    method mk_real_lt (t1: (symbol, termnode) term) (t2: (symbol, termnode) term): (symbol, termnode) term = RealLt (t1, t2)
-    method mk_real_le (t1: (symbol, termnode) term) (t2: (symbol, termnode) term): (symbol, termnode) term = RealLe (t1, t2)
+    method mk_lt (t1: (symbol, termnode) term) (t2: (symbol, termnode) term): (symbol, termnode) term = self#hashcons (Lt (t1, t2))
+    method mk_le (t1: (symbol, termnode) term) (t2: (symbol, termnode) term): (symbol, termnode) term = self#hashcons (Le (t1, t2))
+    method mk_reallit (n: int): (symbol, termnode) term = self#hashcons (NumLit (num_of_int n))
+    method mk_reallit_of_num (n: num): (symbol, termnode) term = self#hashcons (NumLit n)
+    method mk_real_add (t1: (symbol, termnode) term) (t2: (symbol, termnode) term): (symbol, termnode) term = self#hashcons (Add (t1, t2))
+    method mk_real_sub (t1: (symbol, termnode) term) (t2: (symbol, termnode) term): (symbol, termnode) term = self#hashcons (Sub (t1, t2))
+    method mk_real_mul (t1: (symbol, termnode) term) (t2: (symbol, termnode) term): (symbol, termnode) term = self#hashcons (Mul (t1, t2))
+    method mk_real_lt (t1: (symbol, termnode) term) (t2: (symbol, termnode) term): (symbol, termnode) term = self#hashcons (RealLt (t1, t2))
+    method mk_real_le (t1: (symbol, termnode) term) (t2: (symbol, termnode) term): (symbol, termnode) term = self#hashcons (RealLe (t1, t2))
     
     method string_of_simplex_poly n ts =
-      Printf.sprintf "%s [%s]" (Num.string_of_num n) (String.concat "; " (List.map (fun (scale, u) -> Num.string_of_num scale ^ ", " ^ (the (Simplex.unknown_tag u))#pprint) ts))
+      Printf.sprintf "%s [%s]" (Mynum.string_of_num n) (String.concat "; " (List.map (fun (scale, u) -> Mynum.string_of_num scale ^ ", " ^ (the (Simplex.unknown_tag u))#pprint) ts))
 
     method simplex_assert_eq n ts =
       if verbosity > 10 then trace "Redux.simplex_assert_eq %s" (self#string_of_simplex_poly n ts);
@@ -879,6 +1308,12 @@ and context () =
         Simplex.Unsat -> Unsat3
       | Simplex.Sat -> Unknown3
     
+    method simplex_assert_ge n ts =
+      simplex_assert_ge_count <- simplex_assert_ge_count + 1;
+      match self#assert_ge n ts with
+        Simplex.Unsat -> Unsat3
+      | Simplex.Sat -> Unknown3
+    
     method simplex_assert_neq n ts =
       if verbosity > 10 then trace "Redux.simplex_assert_neq %s" (self#string_of_simplex_poly n ts);
       simplex#assert_neq n ts
@@ -888,12 +1323,12 @@ and context () =
       (* print_endline ("Assume: " ^ self#pprint t); *)
       let rec assume_true t =
         match t with
-          TermNode t -> self#assume_eq t self#true_node
+          TermNode t -> self#assume_eq (self#live_termnode t) self#true_node
         | Eq (t1, t2) when self#is_poly t1 || self#is_poly t2 ->
-          let (n, ts) = self#to_poly (Sub (t2, t1)) in
+          let (n, ts) = self#to_poly (self#mk_sub t2 t1) in
           begin match ts with
-            [] -> if sign_num n = 0 then Valid3 else Unsat3
-          | [(t, scale)] -> self#assume_eq t (self#get_numnode (minus_num n // scale))
+            [] -> if Mynum.sign_num n = 0 then Valid3 else Unsat3
+          | [(t, scale)] -> self#assume_eq t (self#get_numnode (Mynum.big_num_of_num (Mynum.div_num (Mynum.minus_num n) scale)))
           | _ ->
             self#do_and_reduce (fun () ->
               simplex_assert_eq_count <- simplex_assert_eq_count + 1;
@@ -905,9 +1340,9 @@ and context () =
         | Iff (t1, True) -> assume_true t1
         | Iff (False, t2) -> assume_false t2
         | Iff (t1, False) -> assume_false t1
-        | Le (t1, t2) -> self#assume_le t1 zero_num t2
-        | Lt (t1, t2) -> self#assume_le t1 unit_num t2
-        | RealLe (t1, t2) -> self#assume_le t1 zero_num t2
+        | Le (t1, t2) -> self#assume_le t1 Mynum.zero_num t2
+        | Lt (t1, t2) -> self#assume_le t1 Mynum.unit_num t2
+        | RealLe (t1, t2) -> self#assume_le t1 Mynum.zero_num t2
         | RealLt (t1, t2) -> self#assume_core (And (Not (Eq (t1, t2)), (RealLe (t1, t2))))
         | And (t1, t2) ->
           begin
@@ -925,17 +1360,17 @@ and context () =
         | t -> self#assume_eq (self#termnode_of_term t) self#true_node
       and assume_false t =
         match t with
-          TermNode t -> self#assume_eq t self#false_node
+          TermNode t -> self#assume_eq (self#live_termnode t) self#false_node
         | Iff (t1, True) -> assume_false t1
         | Iff (t1, False) -> assume_true t1
         | Iff (True, t2) -> assume_false t2
         | Iff (False, t2) -> assume_true t2
         | Eq (t1, t2) when self#is_poly t1 || self#is_poly t2 ->
-          let (offset, terms) = self#to_poly (Sub (t2, t1)) in
+          let (offset, terms) = self#to_poly (self#mk_sub t2 t1) in
           (* printff "assume_false(Eq): poly: %s\n" (self#pprint_poly (offset, terms)); *)
           begin match terms with
-            [] -> if sign_num offset = 0 then Unsat3 else Valid3
-          | [(t, n)] -> self#assume_neq t (self#get_numnode (minus_num offset // n))
+            [] -> if Mynum.sign_num offset = 0 then Unsat3 else Valid3
+          | [(t, n)] -> self#assume_neq t (self#get_numnode (Mynum.big_num_of_num (Mynum.div_num (Mynum.minus_num offset) n)))
           | terms ->
             self#do_and_reduce $. fun () ->
             simplex_assert_neq_count <- simplex_assert_neq_count + 1;
@@ -944,8 +1379,8 @@ and context () =
             | Simplex.Sat -> Unknown3
           end
         | Eq (t1, t2) -> self#assume_neq (self#termnode_of_term t1) (self#termnode_of_term t2)
-        | Le (t1, t2) -> self#assume_le t2 unit_num t1
-        | Lt (t1, t2) -> self#assume_le t2 zero_num t1
+        | Le (t1, t2) -> self#assume_le t2 Mynum.unit_num t1
+        | Lt (t1, t2) -> self#assume_le t2 Mynum.zero_num t1
         | RealLe (t1, t2) -> assume_true (RealLt (t2, t1))
         | RealLt (t1, t2) -> assume_true (RealLe (t2, t1))
         | Not t -> assume_true t
@@ -989,7 +1424,15 @@ and context () =
       else
         assumes_with_more_pending_splits <- assumes_with_more_pending_splits + 1;
     
+    method private new_fact_epoch =
+      (* The entries of the current epoch are the most recent bindings of their keys. *)
+      List.iter (fun h -> Hashtbl.remove query_cache h) query_cache_epoch_keys;
+      query_cache_epoch_keys <- [];
+      fact_epoch_count <- fact_epoch_count + 1;
+      fact_epoch <- fact_epoch_count
+    
     method assert_term t =
+      self#new_fact_epoch;
       let time0 = if verbosity > 0 then begin trace_entering "Redux.assert_term(%s)" (self#pprint t); Perf.time() end else 0.0 in
       Stopwatch.start stopwatch;
       self#register_pending_splits_count;
@@ -999,6 +1442,7 @@ and context () =
       if verbosity > 0 then begin let time1 = Perf.time() in trace_exiting "Redux.assert_term: %.6f seconds" (time1 -. time0) end
     
     method assume t =
+      self#new_fact_epoch;
       let time0 = if verbosity > 0 then begin trace_entering "Redux.assume(%s)" (self#pprint t); Perf.time() end else 0.0 in
       Stopwatch.start stopwatch;
       self#register_pending_splits_count;
@@ -1010,40 +1454,82 @@ and context () =
     method query (t: (symbol, termnode) term): bool =
       if verbosity > 0 then trace_entering "Redux.query(%s)" (self#pprint t);
       Stopwatch.start stopwatch;
-      assert (not self#prune_pending_splits);
-      self#register_pending_splits_count;
-      self#push_internal;
-      let result = self#assume_internal (Not t) in
-      self#pop_internal;
+      query_count <- query_count + 1;
+      let h = term_hash t in
+      let cached = Hashtbl.find_all query_cache h |> List.filter (fun (t', epoch, _) -> epoch = fact_epoch && term_eq t t') in
+      let result =
+        match cached with
+          (_, _, result)::_ ->
+          query_cache_hit_count <- query_cache_hit_count + 1;
+          if verbosity > 0 then trace "Redux.query: answered from the query cache";
+          result
+        | [] ->
+          assert (not self#prune_pending_splits);
+          self#register_pending_splits_count;
+          let deadlineExceeded0 = !Proverapi.deadline_exceeded in
+          Proverapi.deadline_exceeded := false;
+          self#push_internal;
+          let result = self#assume_internal (Not t) in
+          self#pop_internal;
+          let result = result = Unsat in
+          (* Pushing reduces pending redexes, which may create terms, so record the epoch after the query.
+             A query that ran out of time is not cached: without a time budget, it might succeed. *)
+          if not !Proverapi.deadline_exceeded then begin
+            let entry = (t, fact_epoch, result) in
+            Hashtbl.add query_cache h entry;
+            query_cache_epoch_keys <- h::query_cache_epoch_keys;
+            (* Unless the entry was evicted already. *)
+            self#register_popaction (fun () -> match Hashtbl.find_opt query_cache h with Some e when e == entry -> Hashtbl.remove query_cache h | _ -> ())
+          end;
+          Proverapi.deadline_exceeded := !Proverapi.deadline_exceeded || deadlineExceeded0;
+          result
+      in
       Stopwatch.stop stopwatch;
       if verbosity > 0 then trace_exiting "Redux.query";
-      result = Unsat
+      result
     
     method get_type (term: (symbol, termnode) term) = ()
 
     method termnode_of_poly n ts =
       match ts with
-        [] -> self#get_numnode n
-      | [(t, scale)] when sign_num n = 0 && scale =/ num_of_int 1 -> t
+        [] -> self#get_numnode (Mynum.big_num_of_num n)
+      | [(t, scale)] when Mynum.sign_num n = 0 && Mynum.eq_num scale Mynum.unit_num -> t
       | _ ->
         let s = "{" ^ self#pprint_poly (n, ts) ^ "}" in
         let tnode = self#get_node (new symbol Uninterp s) [] in
         let u = tnode#value#mk_unknown in
-        ignore (self#simplex_assert_eq n ((neg_unit_num, u)::List.map (fun (t, scale) -> (scale, t#value#mk_unknown)) ts));
+        ignore (self#simplex_assert_eq n ((Mynum.neg_unit_num, u)::List.map (fun (t, scale) -> (scale, t#value#mk_unknown)) ts));
         assert (self#pump_simplex_eqs <> Unsat3);
         tnode
     
     method termnode_of_term t =
+      match t with
+        TermNode t -> self#live_termnode t
+      | True -> self#true_node
+      | False -> self#false_node
+      | App (s, ts, Some t) when t#alive -> if verbosity > 20 then trace "termnode_of_term: using cached App termnode %s" t#pprint; t
+      | _ ->
+        termnode_cache_count <- termnode_cache_count + 1;
+        let h = term_hash_to_depth hashcons_depth t in
+        match find_term_entry termnode_cache h t with
+          Some tn -> termnode_cache_hit_count <- termnode_cache_hit_count + 1; tn
+        | None ->
+          let tn = self#termnode_of_term_core t in
+          Hashtbl.add termnode_cache h (t, tn);
+          self#register_popaction (fun () -> Hashtbl.remove termnode_cache h);
+          tn
+    
+    method private termnode_of_term_core t =
       let get_node s ts = self#get_node s (List.map (fun t -> (self#termnode_of_term t)#value) ts) in
       match t with
         t when self#is_poly t ->
         let (n, ts) = self#to_poly t in
         self#termnode_of_poly n ts
-      | TermNode t -> t
+      | TermNode t -> self#live_termnode t
       | True -> self#true_node
       | False -> self#false_node
-      | App (s, ts, None) -> get_node s ts
-      | App (s, ts, Some t) -> if verbosity > 20 then trace "termnode_of_term: using cached App termnode %s" t#pprint; t
+      | App (s, ts, Some t) when t#alive -> if verbosity > 20 then trace "termnode_of_term: using cached App termnode %s" t#pprint; t
+      | App (s, ts, _) -> get_node s ts
       | IfThenElse (t1, t2, t3) -> self#get_ifthenelsenode t1 t2 t3
       | Iff (t1, t2) -> get_node iff_symbol [t1; t2]
       | Eq (t1, t2) -> get_node eq_symbol [t1; t2]
@@ -1066,17 +1552,37 @@ and context () =
       (* print_endline "Push"; *)
       self#reduce;
       if not unsat then begin
-        assert (redexes = []);
+        assert (Queue.is_empty redexes);
         assert (simplex_eqs = []);
         assert (simplex_consts = [])
       end;
-      popstack <- (pushdepth, popactionlist, values, unsat)::popstack;
+      popstack <- (pushdepth, Util.undo_trail_mark trail, values, unsat)::popstack;
       pushdepth <- pushdepth + 1;
-      popactionlist <- [];
+      let epoch = fact_epoch in
+      let epochKeys = query_cache_epoch_keys in
+      query_cache_epoch_keys <- [];
+      self#register_popaction (fun () -> fact_epoch <- epoch; query_cache_epoch_keys <- epochKeys);
+      let scopeAlive = scope_alive in
+      let alive = ref true in
+      scope_alive <- alive;
+      self#register_popaction (fun () -> alive := false; scope_alive <- scopeAlive);
       simplex#push
     
+    method scope_alive = scope_alive
+    
+    (* Terms may outlive the scope in which they were built (see VeriFast's -merge_states); the term nodes that such a term
+       refers to are then no longer part of the E-graph. Such a node is rebuilt from its symbol and arguments when it is used.
+       What the popped scope knew about the node is lost; the rebuilt node of a nullary symbol is unconstrained. *)
+    method live_termnode (t: termnode) =
+      if t#alive then t else
+      self#get_node t#symbol (List.map (fun v -> (self#live_termnode v#initial_child)#value) t#initial_children)
+    
+    (* Changes made at push depth 0 are never undone, so they are not recorded. *)
+    method register_undo e =
+      if pushdepth > 0 then Util.undo_trail_record trail e
+    
     method register_popaction action =
-      popactionlist <- action::popactionlist
+      self#register_undo (UndoAction action)
 
     method pop =
       Stopwatch.start stopwatch;
@@ -1085,22 +1591,27 @@ and context () =
       
     method pop_internal =
       (* print_endline "Pop"; *)
-      redexes <- [];
+      Queue.clear redexes;
       simplex_eqs <- [];
       simplex_consts <- [];
       simplex#pop;
       match popstack with
-        (pushdepth0, popactionlist0, values0, unsat0)::popstack0 ->
-        List.iter (fun action -> action()) popactionlist;
+        (pushdepth0, mark, values0, unsat0)::popstack0 ->
+        Util.undo_trail_undo_to trail mark begin function
+          UndoNothing -> ()
+        | UndoTermnode n -> n#pop
+        | UndoValuenode v -> v#pop
+        | UndoCongruence key -> Hashtbl.remove congruence_table key
+        | UndoAction action -> action ()
+        end;
         pushdepth <- pushdepth0;
-        popactionlist <- popactionlist0;
         values <- values0;
         unsat <- unsat0;
         popstack <- popstack0
       | [] -> failwith "Popstack is empty"
 
     method add_redex n =
-      redexes <- redexes @ [n] (* Add to end; order matters due to axiom precondition checks. *)
+      Queue.add n redexes (* Add to end; order matters due to axiom precondition checks. *)
     
     method add_implication p q =
       let is = implications in
@@ -1173,42 +1684,136 @@ and context () =
       in
       iter 0 pending_splits_front
     
-    (** If this method returns true, then the current theory is unsatisfiable. *)
+    (** If this method returns true, then the current theory is unsatisfiable.
+        The splits are explored depth-first, in order; assuming a branch of a split is a decision.
+        When both branches of a split are refuted outright, we check on the way back whether they
+        are still refuted without the most recent decision, and so on: the other branches of the
+        decisions that took no part in the conflict cannot help, so we backjump past them. The
+        decisions that did take part are recorded as a learned clause, so that a later search under
+        the same decisions (e.g. for the next query) refutes the split without asserting its
+        branches. On the way back from each decision, the learned clauses are minimized by dropping
+        the decision if the conflict does not need it, so that they also fire in the other branch.
+        Learned clauses are undone by the enclosing pop. *)
     method perform_pending_splits cont =
-      let rec iter assumptions currentNode =
+      let new_clauses = ref [] in
+      (* The number of the latest of the given decisions (numbered from 1), if they are all on the trail. *)
+      let decision_level depth assumptions ts =
+        let rec level t i assumptions =
+          match assumptions with
+            [] -> None
+          | a::assumptions -> if a == t then Some (depth - i) else level t (i + 1) assumptions
+        in
+        List.fold_left (fun m t -> match (m, level t 0 assumptions) with (Some m, Some l) -> Some (max m l) | _ -> None) (Some 0) ts
+      in
+      let rec learned_level depth assumptions node clauses =
+        match clauses with
+          [] -> None
+        | (node', ts)::clauses ->
+          match (if node' == node then decision_level depth assumptions ts else None) with
+            None -> learned_level depth assumptions node clauses
+          | level -> level
+      in
+      let refuted_outright t =
+        self#push_internal;
+        let result = self#assume_with_implications t in
+        self#pop_internal;
+        result = Unsat3
+      in
+      (* Whether split node is still refuted outright under decisions ts without decision t, given that the decisions
+         on the trail are the given assumptions (which do not include t). Replays the decisions of ts that are not on
+         the trail; if there are too many of them, t is kept. *)
+      let refuted_without t assumptions node ts =
+        let replay = List.filter (fun t' -> t' != t && not (List.memq t' assumptions)) ts in
+        List.length replay <= clause_minimization_replay_limit &&
+        match !node with
+          Some (`SplitNode (b1, b2, _)) ->
+          self#push_internal;
+          let rec assume_all ts = match ts with [] -> true | t::ts -> self#assume_with_implications t <> Unsat3 && assume_all ts in
+          let result = not (assume_all (List.rev replay)) || refuted_outright b1 && refuted_outright b2 in
+          self#pop_internal;
+          result
+        | _ -> false
+      in
+      (* Returns None if cont returns false for some combination of decisions. Otherwise, returns
+         Some (level, refutedSplit), meaning that the splits from currentNode on are refuted by the
+         first level decisions alone; if refutedSplit is Some node, then that is because both
+         branches of split node are refuted outright under these decisions. *)
+      let rec search depth assumptions currentNode =
         match !currentNode with
-          None -> cont assumptions
+          None -> if cont assumptions then Some (depth, None) else None
         | Some (`SplitNode (branch1, branch2, nextNode)) as currentNodeValue->
+          let learnedLevel =
+            match learned_level depth assumptions currentNode !new_clauses with
+              None -> learned_level depth assumptions currentNode learned_clauses
+            | level -> level
+          in
+          match learnedLevel with
+            Some level ->
+            learned_clause_hit_count <- learned_clause_hit_count + 1;
+            Some (level, None)
+          | None when Proverapi.should_give_up () ->
+            (* Out of time, or another prover settled the question (see Proverapi.deadline): give up as if this split had
+               a consistent branch. *)
+            if verbosity >= 2 then trace "Giving up; not splitting";
+            Proverapi.deadline_exceeded := true;
+            None
+          | None ->
           split_count <- split_count + 1;
-          if verbosity >= 2 then trace_entering "splitting on (%s, %s) (depth: %d)" (self#pprint branch1) (self#pprint branch2) (List.length assumptions);
-          self#push_internal;
-          if verbosity >= 2 then begin trace "First branch: %s" (self#pprint branch1); indent () end;
-          let result = self#assume_with_implications branch1 in
-          if verbosity >= 2 then begin unindent (); trace "Branch yields %s" (match result with Unsat3 -> "Unsat" | Unknown3 -> "Unknown" | Valid3 -> "Valid") end;
-          let continue = result = Unsat3 || result = Valid3 && assumptions = [] || iter (branch1::assumptions) nextNode in
-          self#pop_internal;
-          if assumptions = [] && result <> Unknown3 then
-          begin
-            if verbosity >= 2 then trace "Pruning split";
-            self#register_popaction (fun () -> pending_splits_front <- currentNode);
-            pending_splits_front <- nextNode;
-            let result = if result = Unsat3 then self#assume_with_implications branch2 else Valid3 in
-            let continue = result = Unsat3 || iter [] nextNode in
-            if verbosity >= 2 then trace_exiting "splitting";
-            continue
-          end
-          else
-          let continue = continue && (result = Valid3 ||
+          if verbosity >= 2 then trace_entering "splitting on (%s, %s) (depth: %d)" (self#pprint branch1) (self#pprint branch2) depth;
+          let explore branch =
+            split_branch_depth <- split_branch_depth + 1;
+            self#push_internal;
+            if verbosity >= 2 then begin trace "Branch: %s" (self#pprint branch); indent () end;
+            let result = self#assume_with_implications branch in
+            if verbosity >= 2 then begin unindent (); trace "Branch yields %s" (match result with Unsat3 -> "Unsat" | Unknown3 -> "Unknown" | Valid3 -> "Valid") end;
+            let outcome =
+              if result = Unsat3 || result = Valid3 && depth = 0 then Some (depth + 1, None) else search (depth + 1) (branch::assumptions) nextNode
+            in
+            self#pop_internal;
+            split_branch_depth <- split_branch_depth - 1;
+            new_clauses := !new_clauses |> List.map begin fun ((node, ts) as clause) ->
+              if List.memq branch ts && refuted_without branch assumptions node ts then begin
+                clause_decisions_dropped_count <- clause_decisions_dropped_count + 1;
+                (node, List.filter (fun t -> t != branch) ts)
+              end else
+                clause
+            end;
+            let outcome =
+              match outcome with
+                Some (level, Some node) when level = depth + 1 ->
+                begin match !node with
+                  Some (`SplitNode (b1, b2, _)) when refuted_outright b1 && refuted_outright b2 -> Some (depth, Some node)
+                | _ ->
+                  learned_clause_count <- learned_clause_count + 1;
+                  let ts = branch::assumptions in
+                  new_clauses := (node, ts)::!new_clauses;
+                  let Some level = decision_level (depth + 1) ts ts in
+                  Some (level, None)
+                end
+              | _ -> outcome
+            in
+            (result, outcome)
+          in
+          let (result1, outcome1) = explore branch1 in
+          let outcome =
+            if depth = 0 && result1 <> Unknown3 then
             begin
-              self#push_internal;
-              if verbosity >= 2 then begin trace "Second branch %s" (self#pprint branch2); indent () end;
-              let result = self#assume_with_implications branch2 in
-              if verbosity >= 2 then begin unindent (); trace "Branch yields %s" (match result with Unsat3 -> "Unsat" | Unknown3 -> "Unknown" | Valid3 -> "Valid") end;
-              let continue = result = Unsat3 || iter (branch2::assumptions) nextNode in
-              self#pop_internal;
-              if assumptions = [] && not continue then
+              if verbosity >= 2 then trace "Pruning split";
+              self#register_popaction (fun () -> pending_splits_front <- currentNode);
+              pending_splits_front <- nextNode;
+              let result = if result1 = Unsat3 then self#assume_with_implications branch2 else Valid3 in
+              if result = Unsat3 then Some (0, None) else search 0 [] nextNode
+            end
+            else
+            match outcome1 with
+              None -> None
+            | Some (level, _) when level <= depth -> backjump_count <- backjump_count + 1; outcome1
+            | Some _ when result1 = Valid3 -> Some (depth, None)
+            | Some _ ->
+              let (result2, outcome2) = explore branch2 in
+              if depth = 0 && outcome2 = None then
               begin
-                match result with
+                match result2 with
                   Unsat3 ->
                   (* Next time, immediately assume the first branch. *)
                   self#register_popaction (fun () -> currentNode := currentNodeValue);
@@ -1218,14 +1823,22 @@ and context () =
                   pending_splits_front <- nextNode
                 | Unknown3 -> ()
               end;
-              continue
-            end
-            )
+              match outcome2 with
+                None -> None
+              | Some (level, _) when level <= depth -> outcome2
+              | Some _ -> Some (depth, if result1 = Unsat3 && result2 = Unsat3 then Some currentNode else None)
           in
           if verbosity >= 2 then trace_exiting "splitting";
-          continue
+          outcome
       in
-      iter [] pending_splits_front
+      let outcome = search 0 [] pending_splits_front in
+      if !new_clauses <> [] then
+      begin
+        let clauses = learned_clauses in
+        self#register_popaction (fun () -> learned_clauses <- clauses);
+        learned_clauses <- !new_clauses @ clauses
+      end;
+      outcome <> None
     
     method prune_pending_splits =
       let rec iter () =
@@ -1243,9 +1856,18 @@ and context () =
       let s = new symbol kind name in if List.length domain = 0 then ignore (self#get_node s []); s
     
     method set_fpclauses (s: symbol) (k: int) (cs: (symbol * ((symbol, termnode) term list -> (symbol, termnode) term list -> (symbol, termnode) term)) list) =
+      self#new_fact_epoch;
       s#set_fpclauses cs
 
     method mk_app (s: symbol) (ts: (symbol, termnode) term list): (symbol, termnode) term =
+      let value =
+        match s#kind with
+          Fixpoint _ when formal_depth = 0 && List.for_all is_ground_value ts -> self#ground_eval (App (s, ts, None))
+        | _ -> None
+      in
+      match value with
+        Some v -> self#term_of_ground_value v
+      | None ->
       let termnode =
         if formal_depth = 0 then
           let ts = List.map self#termnode_of_term ts in
@@ -1256,7 +1878,7 @@ and context () =
         else
           None
       in
-      App (s, ts, termnode)
+      self#hashcons (App (s, ts, termnode))
     
     method pprint (t: (symbol, termnode) term): string =
       match t with
@@ -1289,12 +1911,12 @@ and context () =
         [] ->
         begin
         match s#node with
-          None ->
+          Some n when n#alive -> n
+        | _ ->
           (* print_endline ("Creating node for nullary symbol " ^ s#name); *)
           let node = new termnode (self :> context) s vs in
           s#set_node node;
           node
-        | Some n -> n
         end
       | v::_ ->
         begin
@@ -1332,14 +1954,14 @@ and context () =
     method assume_eq (t1: termnode) (t2: termnode) = self#reduce; self#assert_eq_and_reduce t1#value t2#value
     
     method assert_ge c ts =
-      if verbosity > 10 then trace "simplex#assert_ge %s [%s]" (string_of_num c) (String.concat "; " (List.map (fun (c, u) -> Printf.sprintf "%s*%s(%s)" (string_of_num c) (the (unknown_tag u))#pprint (print_unknown u)) ts));
+      if verbosity > 10 then trace "simplex#assert_ge %s [%s]" (Mynum.string_of_num c) (String.concat "; " (List.map (fun (c, u) -> Printf.sprintf "%s*%s(%s)" (Mynum.string_of_num c) (the (unknown_tag u))#pprint (print_unknown u)) ts));
       simplex#assert_ge c ts
     
     method assert_le t1 offset t2 =
       let (n1, ts1) = t1#to_poly in
       let (n2, ts2) = t2#to_poly in
-      let offset = n2 -/ n1 -/ offset in
-      let ts1 = List.map (fun (t, scale) -> (minus_num scale, t#value#mk_unknown)) ts1 in
+      let offset = Mynum.sub_num (Mynum.sub_num n2 n1) offset in
+      let ts1 = List.map (fun (t, scale) -> (Mynum.minus_num scale, t#value#mk_unknown)) ts1 in
       let ts2 = List.map (fun (t, scale) -> (scale, t#value#mk_unknown)) ts2 in
       simplex_assert_ge_count <- simplex_assert_ge_count + 1;
       match self#assert_ge offset (ts1 @ ts2) with
@@ -1355,9 +1977,22 @@ and context () =
       | _ -> false
     
     method pprint_poly (offset, terms) =
-      String.concat " + " (string_of_num offset::List.map (fun (t, scale) -> Printf.sprintf "%s*%s" (string_of_num scale) (t#pprint)) terms)
+      String.concat " + " (Mynum.string_of_num offset::List.map (fun (t, scale) -> Printf.sprintf "%s*%s" (Mynum.string_of_num scale) (t#pprint)) terms)
 
+    (* Coefficients are Mynum numbers; see mynum.ml. *)
     method to_poly t =
+      poly_cache_count <- poly_cache_count + 1;
+      let h = term_hash_to_depth hashcons_depth t in
+      match find_term_entry poly_cache h t with
+        Some p -> poly_cache_hit_count <- poly_cache_hit_count + 1; p
+      | None ->
+        let p = self#to_poly_core t in
+        Hashtbl.add poly_cache h (t, p);
+        self#register_popaction (fun () -> Hashtbl.remove poly_cache h);
+        p
+    
+    method private to_poly_core t =
+      let open Mynum in
       let merge_term t scale ts =
         let rec iter ts =
           match ts with
@@ -1388,7 +2023,7 @@ and context () =
       in
       let rec iter scale t =
         match t with
-          NumLit n -> (mult_num scale n, [])
+          NumLit n -> (mult_num scale (num_of_big_num n), [])
         | Add (t1, t2) ->
           let (n1, ts1) = iter scale t1 in
           let (n2, ts2) = iter scale t2 in
@@ -1425,15 +2060,15 @@ and context () =
           let t = self#termnode_of_term t in
           begin match t#value#as_number with
             None -> (zero_num, [(t, scale)])
-          | Some n -> (mult_num scale n, [])
+          | Some n -> (mult_num scale (num_of_big_num n), [])
           end
       in
       iter unit_num t
     
     method assume_le t1 offset t2 =   (* t1 + offset <= t2 *)
-      let (offset', terms) = self#to_poly (Sub (t2, t1)) in
-      let offset = sub_num offset' offset in
-      if terms = [] then if sign_num offset < 0 then Unsat3 else Valid3 else
+      let (offset', terms) = self#to_poly (self#mk_sub t2 t1) in
+      let offset = Mynum.sub_num offset' offset in
+      if terms = [] then if Mynum.sign_num offset < 0 then Unsat3 else Valid3 else
       begin
       self#do_and_reduce (fun () ->
         simplex_assert_ge_count <- simplex_assert_ge_count + 1;
@@ -1481,8 +2116,8 @@ and context () =
             | (u, c)::consts ->
               simplex_consts <- consts;
               let Some tn = unknown_tag u in
-              if verbosity > 7 then trace "Importing constant from Simplex: %s(%s) = %s" tn#pprint (Simplex.print_unknown u) (string_of_num c);
-              match (self#assert_eq_core true tn#value (self#get_numnode c)#value, result) with
+              if verbosity > 7 then trace "Importing constant from Simplex: %s(%s) = %s" tn#pprint (Simplex.print_unknown u) (Mynum.string_of_num c);
+              match (self#assert_eq_core true tn#value (self#get_numnode (Mynum.big_num_of_num c))#value, result) with
                 (Unsat3, _) -> Unsat3
               | (r, Valid3) -> iter r
               | _ -> iter Unknown3
@@ -1501,14 +2136,12 @@ and context () =
     
     method reduce0 =
       let rec reduce_step result =
-        match redexes with
-          [] -> result
-        | f::redexes0 ->
-          redexes <- redexes0;
-          match (f(), result) with
-            (Unsat3, _) -> Unsat3
-          | (r, Valid3) -> iter r
-          | _ -> iter Unknown3
+        if Queue.is_empty redexes then result else
+        let f = Queue.take redexes in
+        match (f (), result) with
+          (Unsat3, _) -> Unsat3
+        | (r, Valid3) -> iter r
+        | _ -> iter Unknown3
       and iter result =
         match (self#pump_simplex_eqs, result) with
           (Unsat3, _) -> Unsat3
@@ -1521,7 +2154,7 @@ and context () =
       result
     
     method reduce =
-      let do_trace = verbosity > 4 && redexes <> [] || verbosity > 20 in
+      let do_trace = verbosity > 4 && not (Queue.is_empty redexes) || verbosity > 20 in
       if do_trace then trace_entering "Redux.reduce";
       let result =
       if not reducing then
@@ -1561,9 +2194,10 @@ and context () =
       
     method begin_formal = formal_depth <- formal_depth + 1
     method end_formal = formal_depth <- formal_depth - 1
-    method mk_bound (i: int) (s: unit): (symbol, termnode) term = BoundVar i
+    method mk_bound (i: int) (s: unit): (symbol, termnode) term = self#hashcons (BoundVar i)
     method assume_forall (description: string) (pats: ((symbol, termnode) term) list) (tps: unit list) (body: (symbol, termnode) term): unit =
       if tps = [] then ignore (self#assume body) else
+      let () = self#new_fact_epoch in
       let pats =
         if pats = [] then
           let check_pat pat =
@@ -1612,59 +2246,213 @@ and context () =
       in
       if pats = [] then failwith (Printf.sprintf "Redux could not find suitable triggers for axiom %s" (self#pprint body));
       (* printff "Axiom (%s) %s asserted\n" (String.concat ", " (List.map self#pprint pats)) (self#pprint body); *)
-      let triggeredCounter = ref 0 in
-      axioms <- (description, triggeredCounter)::axioms;
-      pats |> List.iter (fun pat ->
-        match pat with
-          App (symb, args, _) ->
-          (* We ignore existing applications of this symbol for now. *)
-          symb#add_apply_listener (self :> context) (fun term ->
-            (* printff "Axiom %s: toplevel symbol listener triggered\n" (self#pprint body); *)
-            let rec match_pats bound_env oldvals pats cont =
-              match (oldvals, pats) with
-                ([], []) -> cont bound_env
-              | (oldval::oldvals, pat::pats) ->
-                match_pat bound_env oldval#initial_child#value pat (fun bound_env -> match_pats bound_env oldvals pats cont)
-            and match_pat bound_env value pat cont =
-              let term = value#initial_child in
+      let axiom = {axiom_id = axiom_count; axiom_description = description; axiom_instance_count = 0; axiom_ticks = 0L} in
+      axiom_count <- axiom_count + 1;
+      axioms <- axiom::axioms;
+      let compile_trigger args =
+        let registers = ref [] in (* Bound variables, most recently bound first *)
+        let rec compile pats instrs =
+          match pats with
+            [] -> instrs
+          | pat::pats ->
+            let instrs =
               match pat with
                 BoundVar i ->
-                begin match try_assoc i bound_env with
-                  None -> cont ((i, term)::bound_env)
-                | Some term' ->
-                  if term#value = term'#value then
-                    cont bound_env
-                  else
-                    term#value#add_merge_listener (fun () -> if term#value = term'#value then (cont bound_env; false) else true)
+                let rec register rs = match rs with [] -> None | r::rs -> if r = i then Some (List.length rs) else register rs in
+                begin match register !registers with
+                  Some r -> ECompare r::instrs
+                | None -> registers := i::!registers; EBind::instrs
                 end
-              | App (symb, args, _) ->
-                let match_term term =
-                  if term#symbol = symb then
-                    match_pats bound_env term#children args cont
-                in
-                value#children |> List.iter match_term;
-                value#add_child_listener match_term
-              | NumLit n ->
-                let nnode = self#get_numnode n in
-                if nnode#value = term#value then
-                  cont bound_env
-                else
-                  term#value#add_merge_listener (fun () -> if term#value = nnode#value then (cont bound_env; false) else true)
+              | App (symb, args, _) -> compile args (EDescend symb::instrs)
+              | NumLit n -> ENumber n::instrs
               | _ -> failwith (Printf.sprintf "Redux does not support subpattern %s; it currently supports only symbol applications and bound variables as subpatterns." (self#pprint pat))
             in
-            match_pats [] term#children args (fun bound_env ->
-              incr triggeredCounter;
-              if verbosity >= 3 then trace "Redux: Axiom %s triggered" description;
-              if verbosity >= 4 then trace "Redux: Axiom %s triggered with" (self#pprint body);
-              let body = term_subst bound_env body in
-              if verbosity >= 4 then List.iter (fun (i, t) -> trace "            bound.%d = %s" i t#pprint) bound_env;
-              self#add_redex (fun () ->
-                (* printff "Asserting axiom body %s\n" (self#pprint body); *)
-                self#assume_core body
-              )
-            )
-          )
+            compile pats instrs
+        in
+        let instrs = List.rev (compile args []) in
+        (instrs, Array.of_list (List.rev !registers))
+      in
+      pats |> List.iter (fun pat ->
+        match pat with
+          App (symb, args, _) ->
+          let (instrs, registers) = compile_trigger args in
+          let yield = {yield_axiom = axiom; yield_registers = registers; yield_body = body} in
+          self#add_ematch_code symb#ematch_code instrs yield;
+          (* Match the applications that exist already. *)
+          let code = List.fold_right (fun instr code -> {ematch_branches = [(instr, code)]; ematch_yields = []}) instrs {ematch_branches = []; ematch_yields = [yield]} in
+          self#timed_ematch (fun () -> List.iter (fun term -> self#run_ematch_code code [] term#children) (List.rev symb#applications))
         | _ -> failwith "Redux supports only symbol applications at the top level of axiom triggers."
       )
-    method simplify (t: (symbol, termnode) term): ((symbol, termnode) term) option = None
+    
+    method private add_ematch_code code instrs yield =
+      match instrs with
+        [] ->
+        let yields = code.ematch_yields in
+        code.ematch_yields <- yield::yields;
+        self#register_popaction (fun () -> code.ematch_yields <- yields)
+      | instr::instrs ->
+        let rec find branches =
+          match branches with
+            [] -> None
+          | (instr', code)::branches -> if ematch_instr_eq instr' instr then Some code else find branches
+        in
+        match find code.ematch_branches with
+          Some code -> self#add_ematch_code code instrs yield
+        | None ->
+          let branch = new_ematch_code () in
+          let branches = code.ematch_branches in
+          code.ematch_branches <- (instr, branch)::branches;
+          self#register_popaction (fun () -> code.ematch_branches <- branches);
+          self#add_ematch_code branch instrs yield
+    
+    method ematch_application (term: termnode) =
+      self#new_fact_epoch;
+      let symb = term#symbol in
+      symb#add_application (self :> context) term;
+      let code = symb#ematch_code in
+      if code.ematch_branches <> [] || code.ematch_yields <> [] then
+        self#timed_ematch (fun () -> self#run_ematch_code code [] term#children)
+    
+    method private timed_ematch f =
+      if ematch_depth > 0 then f () else
+      if self#may_give_up then
+        (* Skip the instantiation; the split branch is popped anyway. *)
+        ()
+      else
+      begin
+        ematch_depth <- 1;
+        let ticks0 = Stopwatch.processor_ticks () in
+        let stop () =
+          ematch_ticks <- Int64.add ematch_ticks (Int64.sub (Stopwatch.processor_ticks ()) ticks0);
+          ematch_depth <- 0
+        in
+        try f (); stop () with e -> stop (); raise e
+      end
+    
+    (* Runs E-matching code on a stack of values; registers holds the bound terms, most recently bound first. *)
+    method private run_ematch_code code registers values =
+      List.iter (fun yield -> self#ematch_yield yield registers) code.ematch_yields;
+      match values with
+        [] -> ()
+      | value::values ->
+        let value = value#initial_child#value in
+        let term = value#initial_child in
+        code.ematch_branches |> List.iter begin fun (instr, code) ->
+          let when_equal term' =
+            if term#value == term'#value then
+              self#run_ematch_code code registers values
+            else
+              term#value#add_merge_listener (fun () ->
+                if term#value == term'#value then (self#timed_ematch (fun () -> self#run_ematch_code code registers values); false) else true
+              )
+          in
+          match instr with
+            EBind -> self#run_ematch_code code (term::registers) values
+          | ECompare r -> when_equal (List.nth registers (List.length registers - 1 - r))
+          | ENumber n -> when_equal (self#get_numnode n)
+          | EDescend symb ->
+            let match_term t =
+              if t#symbol == symb then self#run_ematch_code code registers (t#children @ values)
+            in
+            value#children |> List.iter match_term;
+            value#add_child_listener (fun t -> self#timed_ematch (fun () -> match_term t))
+        end
+    
+    method private ematch_yield yield registers =
+      let axiom = yield.yield_axiom in
+      (* An instance whose bound terms are equal to those of an earlier instance on this path is redundant. *)
+      let key = (axiom.axiom_id, List.map (fun t -> t#value) registers) in
+      if Hashtbl.mem ematch_instances key then
+        ematch_duplicate_count <- ematch_duplicate_count + 1
+      else begin
+        Hashtbl.add ematch_instances key ();
+        self#register_popaction (fun () -> Hashtbl.remove ematch_instances key);
+        self#instantiate_axiom yield registers
+      end
+    
+    method private instantiate_axiom yield registers =
+      let axiom = yield.yield_axiom in
+      axiom.axiom_instance_count <- axiom.axiom_instance_count + 1;
+      if verbosity >= 3 then trace "Redux: Axiom %s triggered" axiom.axiom_description;
+      if verbosity >= 4 then trace "Redux: Axiom %s triggered with" (self#pprint yield.yield_body);
+      let n = List.length registers in
+      let bound_env = List.mapi (fun k term -> (yield.yield_registers.(n - 1 - k), term)) registers in
+      let body = term_subst bound_env yield.yield_body in
+      if verbosity >= 4 then List.iter (fun (i, t) -> trace "            bound.%d = %s" i t#pprint) bound_env;
+      self#add_redex (fun () ->
+        (* printff "Asserting axiom body %s\n" (self#pprint body); *)
+        let ticks0 = Stopwatch.processor_ticks () in
+        let result = self#assume_core body in
+        axiom.axiom_ticks <- Int64.add axiom.axiom_ticks (Int64.sub (Stopwatch.processor_ticks ()) ticks0);
+        result
+      )
+    method simplify (t: (symbol, termnode) term): ((symbol, termnode) term) option =
+      if is_ground_value t then None else
+      match self#ground_eval t with
+        Some v -> Some (self#term_of_ground_value v)
+      | None -> None
+    
+    (* Ground evaluation. Fixpoint applications whose arguments are ground values are evaluated by
+       applying the fixpoint's clauses (which VeriFast compiles from the fixpoint bodies) with
+       formal_depth > 0, so that the body terms do not become E-graph nodes, and evaluating the body on
+       the spot. Returns None if t is not ground or the evaluation exceeds ground_eval_budget. *)
+    method ground_eval (t: (symbol, termnode) term): (symbol, termnode) term option =
+      let steps = ref 0 in
+      match (try Some (self#ground_eval_core steps t) with Not_ground -> None) with
+        Some v -> ground_eval_count <- ground_eval_count + 1; Some v
+      | None -> if !steps > ground_eval_budget then ground_eval_over_budget_count <- ground_eval_over_budget_count + 1; None
+    
+    method private ground_eval_core steps t =
+      let eval t = self#ground_eval_core steps t in
+      let num_of t = match eval t with NumLit n -> n | _ -> raise Not_ground in
+      let truth t = match eval t with True -> true | False -> false | _ -> raise Not_ground in
+      let bool b = if b then True else False in
+      match t with
+        NumLit _ | True | False -> t
+      | TermNode n -> begin match (self#live_termnode n)#value#as_number with Some n -> NumLit n | None -> raise Not_ground end
+      | App (s, ts, _) ->
+        begin match s#kind with
+          Ctor (NumberCtor n) -> NumLit n
+        | Ctor (CtorByOrdinal _) -> App (s, List.map eval ts, None)
+        | Fixpoint k -> self#ground_apply steps s k (List.map eval ts)
+        | Uninterp -> raise Not_ground
+        end
+      | Add (t1, t2) -> NumLit (num_of t1 +/ num_of t2)
+      | Sub (t1, t2) -> NumLit (num_of t1 -/ num_of t2)
+      | Mul (t1, t2) -> NumLit (num_of t1 */ num_of t2)
+      | Eq (t1, t2) | Iff (t1, t2) -> bool (ground_value_eq (eval t1) (eval t2))
+      | Not t -> bool (not (truth t))
+      | And (t1, t2) -> bool (truth t1 && truth t2)
+      | Or (t1, t2) -> bool (truth t1 || truth t2)
+      | Implies (t1, t2) -> bool (not (truth t1) || truth t2)
+      | Le (t1, t2) | RealLe (t1, t2) -> bool (le_num (num_of t1) (num_of t2))
+      | Lt (t1, t2) | RealLt (t1, t2) -> bool (lt_num (num_of t1) (num_of t2))
+      | IfThenElse (t1, t2, t3) -> if truth t1 then eval t2 else eval t3
+      | BoundVar _ -> raise Not_ground
+    
+    method private ground_apply steps (s: symbol) k (vs: (symbol, termnode) term list) =
+      let key = App (s, vs, None) in
+      let h = term_hash key in
+      match find_ground_eval_memo ground_eval_memo h key with
+        Some v -> ground_eval_memo_hit_count <- ground_eval_memo_hit_count + 1; v
+      | None ->
+        incr steps;
+        if !steps > ground_eval_budget then raise Not_ground;
+        let clauses = match s#fpclauses with Some clauses -> clauses | None -> raise Not_ground in
+        let (j, cvs) =
+          match List.nth vs k with
+            App (c, cvs, _) -> begin match c#kind with Ctor (CtorByOrdinal j) -> (j, cvs) | _ -> raise Not_ground end
+          | _ -> raise Not_ground
+        in
+        formal_depth <- formal_depth + 1;
+        let body = try clauses.(j) vs cvs with e -> formal_depth <- formal_depth - 1; raise e in
+        formal_depth <- formal_depth - 1;
+        let v = self#ground_eval_core steps body in
+        Hashtbl.add ground_eval_memo h (key, v);
+        v
+    
+    method private term_of_ground_value v =
+      match v with
+        App (s, vs, _) -> self#mk_app s (List.map self#term_of_ground_value vs)
+      | _ -> self#hashcons v
   end
@@ -3,9 +3,16 @@
 open Big_int
 open Num
 open Util
+open Mynum (* Small-integer fast path for the tableau's coefficients *)
 
 let stopwatch = Stopwatch.create ()
 
+(* If true, each assertion is followed by a cheap bound propagation pass; see simplex#propagate_bounds. *)
+let propagate_bounds = ref false
+
+(* The maximum number of rows that one bound propagation pass visits *)
+let bound_propagation_budget = 100
+
 let rec try_assoc k0 kvs =
   match kvs with
     [] -> None
@@ -17,18 +24,42 @@ type ('a, 'b) unknown_pos =
   
 type result = Sat | Unsat
 
+(* Entries of the simplex's undo trail. Each entry records the old value of one field. *)
+type ('unknown, 'pos, 'coeff, 'row, 'column) undo_entry =
+  UndoNothing
+| UndoPos of 'unknown * 'pos option
+| UndoCoeffValue of 'coeff * num
+| UndoRowOwner of 'row * 'unknown
+| UndoRowConstant of 'row * num
+| UndoRowTerms of 'row * ('column * 'coeff) list
+| UndoRowClosed of 'row
+| UndoColumnOwner of 'column * 'unknown
+| UndoColumnTerms of 'column * ('row * 'coeff) list
+| UndoColumnDead of 'column
+| UndoBounds of 'unknown * num option * num option
+
 class ['tag] unknown (context: 'tag simplex) (name: string) (restricted: bool) (tag: 'tag option) (nonzero: bool) =
   object (self)
     val mutable pos: ('tag row, 'tag column) unknown_pos option = None
+    (* Bounds implied by the constraints; maintained only if propagate_bounds is set. *)
+    val mutable lower: num option = if restricted then Some zero_num else None
+    val mutable upper: num option = None
     
     method name = name
     method tag = tag
     method restricted = restricted
     method nonzero = nonzero
     method set_pos p =
-      let oldpos = pos in
-      context#register_popaction (fun () -> pos <- oldpos);
+      context#record_undo (UndoPos ((self :> 'tag unknown), pos));
       pos <- Some p
+    method restore_pos p = pos <- p
+    method lower = lower
+    method upper = upper
+    method set_bounds l u =
+      context#record_undo (UndoBounds ((self :> 'tag unknown), lower, upper));
+      lower <- l;
+      upper <- u
+    method restore_bounds l u = lower <- l; upper <- u
     method pos = match pos with None -> assert false | Some pos -> pos
     method dead = match pos with None -> false | Some (Row row) -> row#closed | Some (Column col) -> col#dead
     method print =
@@ -41,8 +72,7 @@ and ['tag] coeff (context: 'tag simplex) v =
     method value = value
     method set_value_no_undo v = value <- v
     method set_value v =
-      let oldvalue = value in
-      context#register_popaction (fun () -> value <- oldvalue);
+      context#record_undo (UndoCoeffValue ((self :> 'tag coeff), value));
       value <- v
     method add a = self#set_value (value +/ a)
     method divide_by a = self#set_value (value // a)
@@ -76,22 +106,21 @@ and ['tag] row context own c =
     method owner = owner
     method closed = closed
     method set_owner u =
-      let oldowner = owner in
-      context#register_popaction (fun () -> owner <- oldowner);
+      context#record_undo (UndoRowOwner ((self :> 'tag row), owner));
       owner <- u
+    method restore_owner u = owner <- u
     method terms = terms
     method set_constant_no_undo v = constant <- v
     method set_constant v =
-      let oldconstant = constant in
-      context#register_popaction (fun () -> constant <- oldconstant);
+      context#record_undo (UndoRowConstant ((self :> 'tag row), constant));
       constant <- v
     method add_row a r =
       self#set_constant (constant +/ (r#constant */ a));
       List.iter (fun (col, b) -> self#add (b#value */ a) col) r#terms
     method set_terms ts =
-      let oldterms = terms in
-      context#register_popaction (fun () -> terms <- oldterms);
+      context#record_undo (UndoRowTerms ((self :> 'tag row), terms));
       terms <- ts
+    method restore_terms ts = terms <- ts
     method add a col =
       match try_assoc col terms with
         None -> let coef = new coeff context a in self#set_terms ((col, coef)::terms); col#term_added (self :> 'tag row) coef
@@ -111,10 +140,12 @@ and ['tag] row context own c =
     
     method close enqueue =
       assert (not closed);
-      context#register_popaction (fun () -> closed <- false);
+      context#record_undo (UndoRowClosed (self :> 'tag row));
       closed <- true;
       List.iter (fun (col, coef) -> if not col#dead && sign_num coef#value < 0 then col#die enqueue) terms
     
+    method reopen = closed <- false
+    
     method live_terms =
       List.filter (fun (col, coef) -> not col#dead && sign_num coef#value <> 0) terms
 
@@ -167,37 +198,50 @@ and ['tag] column context own =
     
     method owner = owner
     method set_owner u =
-      let oldowner = owner in
-      context#register_popaction (fun () -> owner <- oldowner);
+      context#record_undo (UndoColumnOwner ((self :> 'tag column), owner));
       owner <- u
+    method restore_owner u = owner <- u
     method terms = terms
     method term_added row coef =
-      let oldterms = terms in
-      context#register_popaction (fun () -> terms <- oldterms);
+      context#record_undo (UndoColumnTerms ((self :> 'tag column), terms));
       terms <- (row, coef)::terms
+    method restore_terms ts = terms <- ts
     method dead = dead
+    method revive = dead <- false
     
     method die enqueue =
       assert (not dead);
-      context#register_popaction (fun () -> dead <- false);
+      context#record_undo (UndoColumnDead (self :> 'tag column));
       dead <- true;
       if owner#nonzero then context#set_unsat else
       begin
       if owner#tag <> None then
         context#propagate_eq_constant owner (num_of_int 0);
       List.iter (fun (row, coef) -> if (row#owner#tag <> None || row#owner#nonzero) && sign_num coef#value <> 0 then row#propagate_eq) terms;
-      List.iter (fun (row, coef) -> if row#owner#restricted && sign_num coef#value > 0 then enqueue row#owner) terms
+      List.iter (fun (row, coef) -> if row#owner#restricted && sign_num coef#value > 0 then enqueue row#owner) terms;
+      List.iter (fun (row, coef) -> if sign_num coef#value <> 0 then context#row_changed row) terms
       end
   end
 and ['tag] simplex () =
   object (self)
-    val mutable eq_listener = (fun _ _ -> ())
-    val mutable const_listener = (fun _ _ -> ())
+    val mutable eq_listener = (fun _ -> ())
+    val mutable const_listener = (fun _ -> ())
+    (* Equalities found during the current assertion; they are passed to the listeners in one batch at the end. *)
+    val mutable pending_eqs: ('tag unknown * 'tag unknown) list = []
+    val mutable pending_consts: ('tag unknown * num) list = []
+    val mutable bound_count = 0
+    val mutable bound_constant_count = 0
+    val mutable bound_equality_count = 0
+    (* Polled between the pivots of assert_ge, while may_give_up is set; see set_give_up *)
+    val mutable give_up = (fun () -> false)
+    val mutable may_give_up = false
+    (* The rows that lost a term to a dead column during the current assertion; bound propagation starts from them too. *)
+    val mutable changed_rows: 'tag row list = []
     val mutable uniqueCounter: int = 0
     val mutable unsat: bool = false
     val mutable rows: 'tag row list = []
     val mutable columns: 'tag column list = []
-    val mutable popactions: (unit -> unit) list = []
+    val trail: ('tag unknown, ('tag row, 'tag column) unknown_pos, 'tag coeff, 'tag row, 'tag column) undo_entry undo_trail = create_undo_trail UndoNothing
     val mutable popstack = []
     
     method unsat = unsat
@@ -206,21 +250,37 @@ and ['tag] simplex () =
     method register_listeners feqs fconsts =
       eq_listener <- feqs;
       const_listener <- fconsts
+    
+    (* Makes assert_ge stop maximizing the new row as soon as f returns true, and answer Sat. That is sound, but the
+       sample point may then violate the new row's restriction, so f should return true only while the caller is going to
+       pop the assertion. *)
+    method set_give_up f = give_up <- f
 
-    method register_popaction f = popactions <- f::popactions
+    (* Changes made outside any push/pop scope are never undone, so they are not recorded. *)
+    method record_undo e = if popstack <> [] then undo_trail_record trail e
     method push =
       assert (not unsat);
-      popstack <- (rows, columns, popactions)::popstack;
-      popactions <- []
+      popstack <- (rows, columns, undo_trail_mark trail)::popstack
     method pop =
-      List.iter (fun f -> f()) popactions;
       match popstack with
         [] -> assert false
-      | (oldrows, oldcolumns, oldpopactions)::oldpopstack ->
+      | (oldrows, oldcolumns, mark)::oldpopstack ->
+        undo_trail_undo_to trail mark begin function
+          UndoNothing -> ()
+        | UndoPos (u, p) -> u#restore_pos p
+        | UndoCoeffValue (coef, v) -> coef#set_value_no_undo v
+        | UndoRowOwner (row, u) -> row#restore_owner u
+        | UndoRowConstant (row, c) -> row#set_constant_no_undo c
+        | UndoRowTerms (row, ts) -> row#restore_terms ts
+        | UndoRowClosed row -> row#reopen
+        | UndoColumnOwner (col, u) -> col#restore_owner u
+        | UndoColumnTerms (col, ts) -> col#restore_terms ts
+        | UndoColumnDead col -> col#revive
+        | UndoBounds (u, l, h) -> u#restore_bounds l h
+        end;
         unsat <- false;
         rows <- oldrows;
         columns <- oldcolumns;
-        popactions <- oldpopactions;
         popstack <- oldpopstack
 
     method get_unique_index () =
@@ -294,6 +354,8 @@ and ['tag] simplex () =
       let rec maximize_row () =
         if sign_num row#constant > 0 then
           1
+        else if may_give_up && give_up () then
+          1
         else
         begin
           (* Note: in the Simplify TR, columns with unrestricted owners are preferred over columns with restricted owners. *)
@@ -326,10 +388,122 @@ and ['tag] simplex () =
       maximize_row()
     
     method propagate_equality u1 u2 =
-      eq_listener u1 u2
+      pending_eqs <- (u1, u2)::pending_eqs
 
     method propagate_eq_constant u n =
-      const_listener u n
+      pending_consts <- (u, n)::pending_consts
+    
+    method row_changed row =
+      if !propagate_bounds then changed_rows <- row::changed_rows
+    
+    method private flush_equalities =
+      if pending_eqs <> [] then begin
+        let eqs = pending_eqs in
+        pending_eqs <- [];
+        eq_listener eqs
+      end;
+      if pending_consts <> [] then begin
+        let consts = pending_consts in
+        pending_consts <- [];
+        const_listener consts
+      end
+    
+    (* Narrows the bounds of u to [lo, hi]; enqueues u if they changed. *)
+    method private tighten_bounds enqueue (u: 'tag unknown) lo hi =
+      let better_lower = match (lo, u#lower) with (Some l, Some l0) -> l0 </ l | (Some _, None) -> true | _ -> false in
+      let better_upper = match (hi, u#upper) with (Some h, Some h0) -> h </ h0 | (Some _, None) -> true | _ -> false in
+      if better_lower || better_upper then begin
+        let lo = if better_lower then lo else u#lower in
+        let hi = if better_upper then hi else u#upper in
+        u#set_bounds lo hi;
+        bound_count <- bound_count + 1;
+        match (lo, hi) with
+          (Some l, Some h) when h </ l -> self#set_unsat
+        | (Some l, Some h) when l =/ h ->
+          if u#nonzero && sign_num l = 0 then self#set_unsat else begin
+            if u#tag <> None then begin
+              bound_constant_count <- bound_constant_count + 1;
+              self#propagate_eq_constant u l
+            end;
+            enqueue u
+          end
+        | _ -> enqueue u
+      end
+    
+    (* For row owner = c + a1*x1 + ... + an*xn, derives bounds for the owner from those of the xi and vice versa. *)
+    method private propagate_row_bounds enqueue (row: 'tag row) =
+      if not row#closed then begin
+        let scale a b = match b with None -> None | Some b -> Some (a */ b) in
+        let sum c bs = List.fold_left (fun acc b -> match (acc, b) with (Some acc, Some b) -> Some (acc +/ b) | _ -> None) (Some c) bs in
+        let terms =
+          row#live_terms |> List.map begin fun (col, coef) ->
+            let a = coef#value in
+            let x = col#owner in
+            if sign_num a > 0 then (x, a, scale a x#lower, scale a x#upper) else (x, a, scale a x#upper, scale a x#lower)
+          end
+        in
+        let c = row#constant in
+        let owner = row#owner in
+        self#tighten_bounds enqueue owner (sum c (List.map (fun (_, _, lo, _) -> lo) terms)) (sum c (List.map (fun (_, _, _, hi) -> hi) terms));
+        let rec iter before after =
+          match after with
+            [] -> ()
+          | ((x, a, _, _) as term)::after ->
+            let others = List.rev_append before after in
+            (* a*x = owner - c - (sum of the other terms) *)
+            let lo = sum (minus_num c) (owner#lower::List.map (fun (_, _, _, hi) -> scale neg_unit_num hi) others) in
+            let hi = sum (minus_num c) (owner#upper::List.map (fun (_, _, lo, _) -> scale neg_unit_num lo) others) in
+            let inverse = unit_num // a in
+            if sign_num a > 0 then
+              self#tighten_bounds enqueue x (scale inverse lo) (scale inverse hi)
+            else
+              self#tighten_bounds enqueue x (scale inverse hi) (scale inverse lo);
+            iter (term::before) after
+        in
+        if not unsat then iter [] terms;
+        if not unsat then self#propagate_bound_equality row
+      end
+    
+    (* Derives x = y from a row in which all unknowns but x and y have fixed bounds, and in which x and y cancel out otherwise;
+       e.g. r = 3 + x - y with y fixed at 3 gives r = x. (propagate_eq finds the equalities that hold without bounds.) *)
+    method private propagate_bound_equality (row: 'tag row) =
+      let fixed_value (u: 'tag unknown) = match (u#lower, u#upper) with (Some l, Some h) when l =/ h -> Some l | _ -> None in
+      (* owner = c + a1*x1 + ... + an*xn, as 0 = c + a1*x1 + ... + an*xn - owner *)
+      let terms = (row#owner, neg_unit_num)::List.map (fun (col, coef) -> (col#owner, coef#value)) row#live_terms in
+      let rec iter k free terms =
+        match terms with
+          [] -> Some (k, free)
+        | (u, a)::terms ->
+          match fixed_value u with
+            Some v -> iter (k +/ a */ v) free terms
+          | None -> if List.length free = 2 then None else iter k ((u, a)::free) terms
+      in
+      match iter row#constant [] terms with
+        Some (k, [(x, a); (y, b)]) when sign_num k = 0 && sign_num (a +/ b) = 0 && x#tag <> None && y#tag <> None ->
+        bound_equality_count <- bound_equality_count + 1;
+        self#propagate_equality x y
+      | _ -> ()
+    
+    (* Derives bounds from the rows that mention u, and from the rows that mention the unknowns whose
+       bounds change as a result, without pivoting. Unknowns whose lower and upper bounds meet are reported
+       as constants; crossing bounds make the tableau unsatisfiable. *)
+    method private propagate_bounds (u: 'tag unknown) =
+      let queue = Queue.create () in
+      let enqueue (u: 'tag unknown) =
+        match u#pos with
+          Row row -> Queue.add row queue
+        | Column col -> List.iter (fun (row, coef) -> if sign_num coef#value <> 0 then Queue.add row queue) col#terms
+      in
+      enqueue u;
+      List.iter (fun row -> Queue.add row queue) (List.rev changed_rows);
+      changed_rows <- [];
+      let budget = ref bound_propagation_budget in
+      while not unsat && !budget > 0 && not (Queue.is_empty queue) do
+        decr budget;
+        self#propagate_row_bounds enqueue (Queue.take queue)
+      done
+    
+    method get_bound_stats = (bound_count, bound_constant_count, bound_equality_count)
       
     method close_row row =
       let queue: 'tag unknown list ref = ref [] in
@@ -369,25 +543,35 @@ and ['tag] simplex () =
 
     method assert_ge (c: num) (ts: (num * 'tag unknown) list) =
       Stopwatch.start stopwatch;
+      changed_rows <- [];
       let row = self#row_for_fac c ts in
+      let u = row#owner in
       let result =
         let pivotListener row column = () in
-        match self#sign_of_max_of_row pivotListener row with
+        may_give_up <- true;
+        let sign = self#sign_of_max_of_row pivotListener row in
+        may_give_up <- false;
+        match sign with
           -1 -> Unsat
         | 0 -> self#close_row row; if unsat then Unsat else Sat
         | 1 -> Sat
         | _ -> assert false
       in
+      let result = if result = Sat && !propagate_bounds then (self#propagate_bounds u; if unsat then Unsat else Sat) else result in
+      self#flush_equalities;
       Stopwatch.stop stopwatch;
       result
     
     method get_ticks: int64 = Stopwatch.ticks stopwatch
     
+    method get_trail_high_water_mark = trail.trail_high_water_mark
+    
     method assert_eq (c: num) (ts: (num * 'tag unknown) list) =
       Stopwatch.start stopwatch;
+      changed_rows <- [];
+      let row = self#row_for_fac c ts in
+      let u = row#owner in
       let result =
-        let row = self#row_for_fac c ts in
-        let u = row#owner in
         let pivotListener row column = () in
         match self#sign_of_max_of_row pivotListener row with
           -1 -> Unsat
@@ -418,6 +602,8 @@ and ['tag] simplex () =
         col#die enqueue;
         if unsat then Unsat else Sat
       in
+      let result = if result = Sat && !propagate_bounds then (self#propagate_bounds u; if unsat then Unsat else Sat) else result in
+      self#flush_equalities;
       Stopwatch.stop stopwatch;
       result
     
@@ -431,16 +617,19 @@ and ['tag] simplex () =
 
 type 'tag simplex0 = <
   register_listeners:
-    ('tag unknown -> 'tag unknown -> unit) ->
-    ('tag unknown -> Num.num -> unit) ->
+    (('tag unknown * 'tag unknown) list -> unit) ->
+    (('tag unknown * Mynum.num) list -> unit) ->
     unit;
   push: unit;
   pop: unit;
   alloc_unknown: string -> 'tag -> 'tag unknown;
-  assert_ge: Num.num -> (Num.num * 'tag unknown) list -> result;
-  assert_eq: Num.num -> (Num.num * 'tag unknown) list -> result;
-  assert_neq: Num.num -> (Num.num * 'tag unknown) list -> result;
+  assert_ge: Mynum.num -> (Mynum.num * 'tag unknown) list -> result;
+  assert_eq: Mynum.num -> (Mynum.num * 'tag unknown) list -> result;
+  assert_neq: Mynum.num -> (Mynum.num * 'tag unknown) list -> result;
+  set_give_up: (unit -> bool) -> unit;
   get_ticks: int64;
+  get_bound_stats: int * int * int;
+  get_trail_high_water_mark: int;
   print: string
 >
 
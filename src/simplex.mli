@@ -1,3 +1,6 @@
+(* If true, each assertion is followed by a cheap bound propagation pass. *)
+val propagate_bounds: bool ref
+
 type result = Sat | Unsat
 
 type 'tag unknown
@@ -7,16 +10,19 @@ val unknown_tag: 'tag unknown -> 'tag option
 
 type 'tag simplex0 = <
   register_listeners:
-    ('tag unknown -> 'tag unknown -> unit) ->
-    ('tag unknown -> Num.num -> unit) ->
+    (('tag unknown * 'tag unknown) list -> unit) ->
+    (('tag unknown * Mynum.num) list -> unit) ->
     unit;
   push: unit;
   pop: unit;
   alloc_unknown: string -> 'tag -> 'tag unknown;
-  assert_ge: Num.num -> (Num.num * 'tag unknown) list -> result;
-  assert_eq: Num.num -> (Num.num * 'tag unknown) list -> result;
-  assert_neq: Num.num -> (Num.num * 'tag unknown) list -> result;
+  assert_ge: Mynum.num -> (Mynum.num * 'tag unknown) list -> result;
+  assert_eq: Mynum.num -> (Mynum.num * 'tag unknown) list -> result;
+  assert_neq: Mynum.num -> (Mynum.num * 'tag unknown) list -> result;
+  set_give_up: (unit -> bool) -> unit;
   get_ticks: int64;
+  get_bound_stats: int * int * int;
+  get_trail_high_water_mark: int;
   print: string
 >
 
@@ -14,10 +14,17 @@ open Proverapi
 
 (* This code is largely inspired from the modules for the Z3 prover. *)
 
-class smtlib_context input_fun output (features : string list) =
+class smtlib_context input_fun answer_ready output (features : string list) =
   let statements : Smtlib.statement list ref = ref [] in
   let dump_fmt = Format.formatter_of_out_channel output in
+  (* The solver answers the check-sat commands in order. An answer that is no longer wanted (see
+     query_async) is dropped as soon as it is available, so that the solver never blocks on a full pipe. *)
+  let answers_requested = ref 0 in
+  let answers_read = ref 0 in
+  let answers_abandoned = ref 0 in (* The answers before this one are no longer wanted *)
+  let read_answer () = let ans = input_fun () in incr answers_read; ans in
   let add_statement st =
+    while !answers_read < !answers_abandoned && answer_ready () do ignore (read_answer ()) done;
     Format.fprintf dump_fmt "%a@\n" Smtlib.print_statement st;
     flush output;
     statements := st :: !statements
@@ -66,11 +73,24 @@ class smtlib_context input_fun output (features : string list) =
      until we add an assertion or pop the stack. We do that to avoid
      asking the prover the same question several times. *)
   let last_prover_answer = ref None in
+  let request_answer () =
+    add_statement Smtlib.check_sat;
+    let i = !answers_requested in
+    answers_requested := i + 1;
+    i
+  in
+  let await_answer i =
+    while !answers_read < i do ignore (read_answer ()) done;
+    read_answer ()
+  in
+  let abandon_answer i = answers_abandoned := max !answers_abandoned (i + 1) in
+  let answer_available i =
+    while !answers_read < min i !answers_abandoned && answer_ready () do ignore (read_answer ()) done;
+    !answers_read = i && answer_ready ()
+  in
   let check () =
     match !last_prover_answer with
-    | None ->
-       add_statement Smtlib.check_sat;
-       input_fun ()
+    | None -> await_answer (request_answer ())
     | Some ans -> ans
   in
   let add_assert t =
@@ -82,16 +102,23 @@ class smtlib_context input_fun output (features : string list) =
       end
   in
   let assert_term t = add_assert t; check () in
-  let query t =
+  let start_assume t =
+    add_assert t;
+    let i = request_answer () in
+    ((fun () -> await_answer i), (fun () -> abandon_answer i), (fun () -> answer_available i))
+  in
+  let start_query t =
     if has_features (Smtlib.T.features t) then
       begin
         add_statement Smtlib.push;
-        let result = assert_term (Smtlib.tnot t) = Unsat in
+        add_assert (Smtlib.tnot t);
+        let i = request_answer () in
         add_statement (Smtlib.pop 1);
-        result
+        ((fun () -> await_answer i = Unsat), (fun () -> abandon_answer i), (fun () -> answer_available i))
       end
-    else false   (* Same as an "unknown" answer *)
+    else ((fun () -> false), (fun () -> ()), (fun () -> true))   (* Same as an "unknown" answer *)
   in
+  let query t = let (await, _, _) = start_query t in await () in
   let assume_is_inverse f1 f2 dom2 =
     let x = Smtlib.mk_var 0 dom2 in
     let vx = Smtlib.var x in
@@ -241,6 +268,14 @@ class smtlib_context input_fun output (features : string list) =
       add_statement
         (Smtlib.comment (Printf.sprintf "Assume: %s" (Smtlib.T.to_string t)));
       assert_term t
+    method query_async t =
+      add_statement
+        (Smtlib.comment (Printf.sprintf "Query: %s" (Smtlib.T.to_string t)));
+      start_query t
+    method assume_async t =
+      add_statement
+        (Smtlib.comment (Printf.sprintf "Assume: %s" (Smtlib.T.to_string t)));
+      start_assume t
     method assert_term t =
       add_statement
         (Smtlib.comment (Printf.sprintf "Assert: %s" (Smtlib.T.to_string t)));
@@ -269,18 +304,46 @@ class smtlib_context input_fun output (features : string list) =
 let dump_smtlib_ctxt filename features =
   (new smtlib_context
      (fun _ -> Unknown)
+     (fun _ -> false)
      (open_out filename)
      features
    : smtlib_context :> (Smtlib.sort, Smtlib.symbol, Smtlib.term) context)
 
-let external_smtlib_ctxt command features =
+let external_smtlib_async_ctxt command features =
   let (input, output) = Unix.open_process command in
+  let input_fd = Unix.descr_of_in_channel input in
+  (* We read the solver's output from the file descriptor directly rather than through the in_channel,
+     whose buffer select cannot see: an answer already in the buffer would otherwise not be ready. *)
+  let received = Buffer.create 64 in
+  let chunk = Bytes.create 4096 in
+  let receive () =
+    let n = Unix.read input_fd chunk 0 (Bytes.length chunk) in
+    if n = 0 then raise End_of_file;
+    Buffer.add_subbytes received chunk 0 n
+  in
+  let rec read_line () =
+    let text = Buffer.contents received in
+    match String.index_opt text '\n' with
+    | None -> receive (); read_line ()
+    | Some i ->
+      Buffer.clear received;
+      Buffer.add_substring received text (i + 1) (String.length text - i - 1);
+      String.sub text 0 i
+  in
   (new smtlib_context
      (fun _ ->
-       match input_line input with
+       match read_line () with
        | "unsat" -> Unsat
        | "unknown" -> Unknown
        | _ -> assert false)
+     (fun _ ->
+       Buffer.length received > 0 ||
+       match Unix.select [input_fd] [] [] 0.0 with
+       | ([], _, _) -> false
+       | _ -> true)
      output
      features
-   : smtlib_context :> (Smtlib.sort, Smtlib.symbol, Smtlib.term) context)
+   : smtlib_context :> (Smtlib.sort, Smtlib.symbol, Smtlib.term) async_context)
+
+let external_smtlib_ctxt command features =
+  (external_smtlib_async_ctxt command features :> (Smtlib.sort, Smtlib.symbol, Smtlib.term) context)
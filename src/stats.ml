@@ -5,6 +5,26 @@ open Ast
 
 let parsing_stopwatch = Stopwatch.create ()
 
+(* The statistics of a worker process (see -jobs), to be merged into those of the parent process. *)
+type worker_counts = {
+  worker_stmt_exec_locs: loc list;
+  worker_stmt_exec_on_all_paths: int;
+  worker_exec_steps: int;
+  worker_branches: int;
+  worker_merged_branches: int;
+  worker_prover_assumes: int;
+  worker_definitely_equal_same_terms: int;
+  worker_definitely_equal_queries: int;
+  worker_prover_other_queries: int;
+  worker_consume_chunk_scans: int;
+  worker_consume_chunk_index_hits: int;
+  worker_fraction_queries_avoided: int;
+  worker_verification_cache_hits: int;
+  worker_verification_cache_misses: int;
+  worker_prover_timeouts: (string * loc) list;
+  worker_function_timings: (string * float) list
+}
+
 class stats =
   object (self)
     val startTime = Perf.time()
@@ -16,6 +36,7 @@ class stats =
     val mutable stmtExecLocs = Hashtbl.create 1000;
     val mutable execStepCount = 0
     val mutable branchCount = 0
+    val mutable mergedBranchCount = 0
     val mutable proverAssumeCount = 0
     val mutable definitelyEqualSameTermCount = 0
     val mutable definitelyEqualQueryCount = 0
@@ -23,6 +44,17 @@ class stats =
     val mutable proverStats = ""
     val mutable overhead: <path: string; nonghost_lines: int; ghost_lines: int; mixed_lines: int> list = []
     val mutable functionTimings: (string * float) list = []
+    val mutable consumeChunkScanCount = 0
+    val mutable consumeChunkIndexHitCount = 0
+    val mutable fractionQueriesAvoidedCount = 0
+    val mutable headerCacheHitCount = 0
+    val mutable headerCacheTimeSaved = 0.0
+    val mutable headerMapsReuseCount = 0
+    val mutable headerMapsTimeSaved = 0.0
+    val mutable verificationCacheHitCount = 0
+    val mutable verificationCacheMissCount = 0
+    val mutable currentStmtLoc = dummy_loc
+    val mutable proverTimeouts: (string * loc) list = [] (* Prover and statement *)
     
     method tickLength = let t1 = Perf.time() in let ticks1 = Stopwatch.processor_ticks() in (t1 -. startTime) /. Int64.to_float (Int64.sub ticks1 startTicks)
 
@@ -31,23 +63,72 @@ class stats =
     method closeParsed = closeParsedCount <- closeParsedCount + 1
     method stmtExec (l: loc) =
       stmtExecOnAllPathsCount <- stmtExecOnAllPathsCount + 1;
+      currentStmtLoc <- l;
       Hashtbl.replace stmtExecLocs l l
     method getStmtExec = Hashtbl.length stmtExecLocs
     method getStmtExecLocs = Hashtbl.fold (fun _ loc locs -> loc::locs) stmtExecLocs []
     method getStmtExecOnAllPaths = stmtExecOnAllPathsCount
     method execStep = execStepCount <- execStepCount + 1
     method branch = branchCount <- branchCount + 1
+    method mergedBranch = mergedBranchCount <- mergedBranchCount + 1
     method proverAssume = proverAssumeCount <- proverAssumeCount + 1
     method definitelyEqualSameTerm = definitelyEqualSameTermCount <- definitelyEqualSameTermCount + 1
     method definitelyEqualQuery = definitelyEqualQueryCount <- definitelyEqualQueryCount + 1
     method proverOtherQuery = proverOtherQueryCount <- proverOtherQueryCount + 1
+    method consumeChunkScan = consumeChunkScanCount <- consumeChunkScanCount + 1
+    method consumeChunkIndexHit = consumeChunkIndexHitCount <- consumeChunkIndexHitCount + 1
+    method fractionQueriesAvoided n = fractionQueriesAvoidedCount <- fractionQueriesAvoidedCount + n
     method appendProverStats (text, tickCounts) =
       let tickLength = self#tickLength in
       proverStats <- proverStats ^ text ^ String.concat "" (List.map (fun (lbl, ticks) -> Printf.sprintf "%s: %.6fs\n" lbl (Int64.to_float ticks *. tickLength)) tickCounts)
     method overhead ~path ~nonGhostLineCount ~ghostLineCount ~mixedLineCount =
       let o = object method path = path method nonghost_lines = nonGhostLineCount method ghost_lines = ghostLineCount method mixed_lines = mixedLineCount end in
       overhead <- o::overhead
+    method headerCacheHit timeSaved =
+      headerCacheHitCount <- headerCacheHitCount + 1;
+      headerCacheTimeSaved <- headerCacheTimeSaved +. timeSaved
+    method headerMapsReused timeSaved =
+      headerMapsReuseCount <- headerMapsReuseCount + 1;
+      headerMapsTimeSaved <- headerMapsTimeSaved +. timeSaved
+    method verificationCacheHit = verificationCacheHitCount <- verificationCacheHitCount + 1
+    method verificationCacheMiss = verificationCacheMissCount <- verificationCacheMissCount + 1
+    method proverTimeout prover = proverTimeouts <- (prover, currentStmtLoc)::proverTimeouts
     method recordFunctionTiming funName seconds = if seconds > 0.1 then functionTimings <- (funName, seconds)::functionTimings
+    method workerCounts = {
+      worker_stmt_exec_locs = self#getStmtExecLocs;
+      worker_stmt_exec_on_all_paths = stmtExecOnAllPathsCount;
+      worker_exec_steps = execStepCount;
+      worker_branches = branchCount;
+      worker_merged_branches = mergedBranchCount;
+      worker_prover_assumes = proverAssumeCount;
+      worker_definitely_equal_same_terms = definitelyEqualSameTermCount;
+      worker_definitely_equal_queries = definitelyEqualQueryCount;
+      worker_prover_other_queries = proverOtherQueryCount;
+      worker_consume_chunk_scans = consumeChunkScanCount;
+      worker_consume_chunk_index_hits = consumeChunkIndexHitCount;
+      worker_fraction_queries_avoided = fractionQueriesAvoidedCount;
+      worker_verification_cache_hits = verificationCacheHitCount;
+      worker_verification_cache_misses = verificationCacheMissCount;
+      worker_prover_timeouts = proverTimeouts;
+      worker_function_timings = functionTimings
+    }
+    method addWorkerCounts c =
+      List.iter (fun l -> Hashtbl.replace stmtExecLocs l l) c.worker_stmt_exec_locs;
+      stmtExecOnAllPathsCount <- stmtExecOnAllPathsCount + c.worker_stmt_exec_on_all_paths;
+      execStepCount <- execStepCount + c.worker_exec_steps;
+      branchCount <- branchCount + c.worker_branches;
+      mergedBranchCount <- mergedBranchCount + c.worker_merged_branches;
+      proverAssumeCount <- proverAssumeCount + c.worker_prover_assumes;
+      definitelyEqualSameTermCount <- definitelyEqualSameTermCount + c.worker_definitely_equal_same_terms;
+      definitelyEqualQueryCount <- definitelyEqualQueryCount + c.worker_definitely_equal_queries;
+      proverOtherQueryCount <- proverOtherQueryCount + c.worker_prover_other_queries;
+      consumeChunkScanCount <- consumeChunkScanCount + c.worker_consume_chunk_scans;
+      consumeChunkIndexHitCount <- consumeChunkIndexHitCount + c.worker_consume_chunk_index_hits;
+      fractionQueriesAvoidedCount <- fractionQueriesAvoidedCount + c.worker_fraction_queries_avoided;
+      verificationCacheHitCount <- verificationCacheHitCount + c.worker_verification_cache_hits;
+      verificationCacheMissCount <- verificationCacheMissCount + c.worker_verification_cache_misses;
+      proverTimeouts <- c.worker_prover_timeouts @ proverTimeouts;
+      functionTimings <- c.worker_function_timings @ functionTimings
     method getFunctionTimings =
       let compare (_, t1) (_, t2) = compare t1 t2 in
       let timingsSorted = List.sort compare functionTimings in
@@ -70,13 +151,39 @@ class stats =
       print_endline ("Statement executions: " ^ string_of_int (self#getStmtExec));
       print_endline ("Execution steps (including assertion production/consumption steps): " ^ string_of_int execStepCount);
       print_endline ("Symbolic execution forks: " ^ string_of_int branchCount);
+      if mergedBranchCount > 0 then
+        print_endline ("Symbolic execution forks avoided by merging the states at the end of an if or switch statement: " ^ string_of_int mergedBranchCount);
       print_endline ("Prover assumes: " ^ string_of_int proverAssumeCount);
       print_endline ("Term equality tests -- same term: " ^ string_of_int definitelyEqualSameTermCount);
       print_endline ("Term equality tests -- prover query: " ^ string_of_int definitelyEqualQueryCount);
       print_endline ("Term equality tests -- total: " ^ string_of_int (definitelyEqualSameTermCount + definitelyEqualQueryCount));
       print_endline ("Other prover queries: " ^ string_of_int proverOtherQueryCount);
+      print_endline ("Heap chunks examined when consuming: " ^ string_of_int consumeChunkScanCount);
+      print_endline ("Chunks consumed through the predicate symbol index: " ^ string_of_int consumeChunkIndexHitCount);
+      print_endline ("Fraction prover queries avoided (literal coefficients): " ^ string_of_int fractionQueriesAvoidedCount);
       print_endline ("Prover statistics:\n" ^ proverStats);
-      Printf.printf "Time spent parsing: %.6fs\n" (Int64.to_float (Stopwatch.ticks parsing_stopwatch) *. self#tickLength);
+      let parsingTime = Int64.to_float (Stopwatch.ticks parsing_stopwatch) *. self#tickLength in
+      Printf.printf "Time spent parsing: %.6fs\n" parsingTime;
+      let otherTime = Perf.time () -. startTime -. parsingTime in
+      if otherTime > 0.0 then
+        Printf.printf "Execution steps per second (excluding parsing): %.0f\n" (float_of_int execStepCount /. otherTime);
+      Printf.printf "Peak heap size: %.1f MB\n" (float_of_int ((Gc.quick_stat ()).Gc.top_heap_words * (Sys.word_size / 8)) /. 1048576.0);
+      if headerCacheHitCount > 0 then
+        Printf.printf "Headers loaded from the header cache: %d (parsing time saved: %.6fs)\n" headerCacheHitCount headerCacheTimeSaved;
+      if headerMapsReuseCount > 0 then
+        Printf.printf "Headers typechecked by the verification server's warm process: %d (typechecking time saved: %.6fs)\n" headerMapsReuseCount headerMapsTimeSaved;
+      if verificationCacheHitCount + verificationCacheMissCount > 0 then
+        Printf.printf "Verification cache: %d hits, %d misses\n" verificationCacheHitCount verificationCacheMissCount;
+      if proverTimeouts <> [] then begin
+        let provers = List.sort_uniq compare (List.map fst proverTimeouts) in
+        List.iter
+          begin fun prover ->
+            let locs = List.rev (flatmap (fun (p, l) -> if p = prover then [l] else []) proverTimeouts) in
+            Printf.printf "Prover time budget exceeded by %s: %d times\n" prover (List.length locs);
+            List.iter (fun l -> print_endline ("  at statement " ^ string_of_loc l)) locs
+          end
+          provers
+      end;
       print_endline ("Function timings (> 0.1s):\n" ^ self#getFunctionTimings);
       print_endline (Printf.sprintf "Total time: %.2f seconds" (Perf.time() -. startTime))
   end
@@ -85,4 +192,214 @@ let stats = ref (new stats)
 
 let clear_stats _ = 
   stats := (new stats)
-  
+
+(* Region: Profiling *)
+
+(* With -profile, VeriFast records a tree of phases: a phase that starts while another phase is running is a child of that phase.
+   For each phase, it records the number of calls, the inclusive and exclusive time, and the number of words allocated
+   (from Gc.quick_stat). Times are measured with Perf.time, like the other statistics. *)
+
+type profile_node = {
+  phase_name: string;
+  mutable phase_calls: int;
+  mutable inclusive_time: float;
+  mutable exclusive_time: float;
+  mutable inclusive_words: float;
+  mutable exclusive_words: float;
+  phase_children: (string, profile_node) Hashtbl.t;
+  mutable phase_children_list: profile_node list (* In reverse order of creation *)
+}
+
+type profile_frame = {
+  frame_node: profile_node;
+  mutable frame_start_time: float;
+  mutable frame_start_words: float;
+  mutable frame_child_time: float;
+  mutable frame_child_words: float;
+  frame_weight: float (* The number of calls this measurement stands for; see profile_phase_sampled *)
+}
+
+let profiling = ref false
+
+let new_profile_node name =
+  {phase_name = name; phase_calls = 0; inclusive_time = 0.0; exclusive_time = 0.0; inclusive_words = 0.0; exclusive_words = 0.0;
+   phase_children = Hashtbl.create 8; phase_children_list = []}
+
+let profile_root = new_profile_node "total"
+let profile_start = ref (0.0, 0.0)
+let profile_stack: profile_frame list ref = ref [] (* The innermost running phase comes first *)
+
+let allocated_words () =
+  let s = Gc.quick_stat () in
+  s.Gc.minor_words +. s.Gc.major_words -. s.Gc.promoted_words
+
+let start_profiling () =
+  profiling := true;
+  profile_start := (Perf.time (), allocated_words ())
+
+let push_profile_frame frame =
+  frame.frame_start_time <- Perf.time ();
+  frame.frame_start_words <- allocated_words ();
+  frame.frame_child_time <- 0.0;
+  frame.frame_child_words <- 0.0;
+  profile_stack := frame::!profile_stack
+
+let pop_profile_frame () =
+  match !profile_stack with
+    [] -> ()
+  | frame::frames ->
+    let time = frame.frame_weight *. (Perf.time () -. frame.frame_start_time) in
+    let words = frame.frame_weight *. (allocated_words () -. frame.frame_start_words) in
+    let node = frame.frame_node in
+    node.inclusive_time <- node.inclusive_time +. time;
+    node.exclusive_time <- node.exclusive_time +. (time -. frame.frame_child_time);
+    node.inclusive_words <- node.inclusive_words +. words;
+    node.exclusive_words <- node.exclusive_words +. (words -. frame.frame_child_words);
+    profile_stack := frames;
+    match frames with
+      parent::_ ->
+      parent.frame_child_time <- parent.frame_child_time +. time;
+      parent.frame_child_words <- parent.frame_child_words +. words
+    | [] -> ()
+
+(* Pops frames up to and including the given one. *)
+let unwind_profile_stack frame =
+  let rec iter () =
+    match !profile_stack with
+      [] -> ()
+    | frame'::_ -> pop_profile_frame (); if frame' != frame then iter ()
+  in
+  if List.memq frame !profile_stack then iter ()
+
+let enter_phase ?(weight=1) name =
+  let parent = match !profile_stack with frame::_ -> frame.frame_node | [] -> profile_root in
+  let node =
+    match Hashtbl.find_opt parent.phase_children name with
+      Some node -> node
+    | None ->
+      let node = new_profile_node name in
+      Hashtbl.add parent.phase_children name node;
+      parent.phase_children_list <- node::parent.phase_children_list;
+      node
+  in
+  node.phase_calls <- node.phase_calls + weight;
+  let frame = {frame_node = node; frame_start_time = 0.0; frame_start_words = 0.0; frame_child_time = 0.0; frame_child_words = 0.0;
+    frame_weight = float_of_int weight} in
+  push_profile_frame frame;
+  frame
+
+(* Runs f as a phase with the given name. *)
+let profile_phase name f =
+  if not !profiling then f () else begin
+    let frame = enter_phase name in
+    let result = try f () with e -> unwind_profile_stack frame; raise e in
+    unwind_profile_stack frame;
+    result
+  end
+
+(* For phases that run once per token: measuring each call would cost more than the call itself, so only
+   every profile_sample_period-th call of f is measured, and counted profile_sample_period times. The other calls
+   count towards the enclosing phase. counter must be specific to the call site. Use as
+   (if !profiling then profile_phase_sampled counter name f else f), so that nothing is added when not profiling. *)
+let profile_sample_period = 64
+
+let profile_phase_sampled counter name f x =
+  incr counter;
+  if !counter < profile_sample_period then f x else begin
+    counter := 0;
+    let frame = enter_phase ~weight:profile_sample_period name in
+    let result = try f x with e -> unwind_profile_stack frame; raise e in
+    unwind_profile_stack frame;
+    result
+  end
+
+(* For continuation-passing code: body receives a function that it must use to call its continuation;
+   the continuation does not count as part of the phase. *)
+let profile_phase_cps name body =
+  if not !profiling then body (fun cont -> cont ()) else
+  profile_phase name begin fun () ->
+    let frame = List.hd !profile_stack in
+    body begin fun cont ->
+      if not (List.memq frame !profile_stack) then cont () else begin
+        unwind_profile_stack frame;
+        let result = try cont () with e -> push_profile_frame frame; raise e in
+        push_profile_frame frame;
+        result
+      end
+    end
+  end
+
+let json_string s =
+  let b = Buffer.create (String.length s + 2) in
+  Buffer.add_char b '"';
+  String.iter
+    begin fun c ->
+      match c with
+        '"' -> Buffer.add_string b "\\\""
+      | '\\' -> Buffer.add_string b "\\\\"
+      | c when Char.code c < 0x20 -> Buffer.add_string b (Printf.sprintf "\\u%04x" (Char.code c))
+      | c -> Buffer.add_char b c
+    end
+    s;
+  Buffer.add_char b '"';
+  Buffer.contents b
+
+(* Writes the phase tree, and the totals per phase name, to the given file in JSON format.
+   A phase's total inclusive time only counts the calls that are not nested in a phase with the same name. *)
+let write_profile path =
+  List.iter (fun _ -> pop_profile_frame ()) !profile_stack;
+  let (start_time, start_words) = !profile_start in
+  let bytes words = words *. float_of_int (Sys.word_size / 8) in
+  let root = profile_root in
+  root.phase_calls <- 1;
+  root.inclusive_time <- Perf.time () -. start_time;
+  root.inclusive_words <- allocated_words () -. start_words;
+  root.exclusive_time <- List.fold_left (fun t node -> t -. node.inclusive_time) root.inclusive_time root.phase_children_list;
+  root.exclusive_words <- List.fold_left (fun w node -> w -. node.inclusive_words) root.inclusive_words root.phase_children_list;
+  let totals: (string, (int * float * float * float * float) ref) Hashtbl.t = Hashtbl.create 64 in
+  let names = ref [] in
+  let rec add_totals ancestors node =
+    let outermost = not (List.mem node.phase_name ancestors) in
+    let total =
+      match Hashtbl.find_opt totals node.phase_name with
+        Some total -> total
+      | None -> let total = ref (0, 0.0, 0.0, 0.0, 0.0) in Hashtbl.add totals node.phase_name total; names := node.phase_name::!names; total
+    in
+    let (calls, inclusive_time, exclusive_time, inclusive_words, exclusive_words) = !total in
+    total :=
+      (calls + node.phase_calls,
+       (if outermost then inclusive_time +. node.inclusive_time else inclusive_time),
+       exclusive_time +. node.exclusive_time,
+       (if outermost then inclusive_words +. node.inclusive_words else inclusive_words),
+       exclusive_words +. node.exclusive_words);
+    List.iter (add_totals (node.phase_name::ancestors)) node.phase_children_list
+  in
+  add_totals [] root;
+  let out = open_out path in
+  let fields name calls inclusive_time exclusive_time inclusive_words exclusive_words =
+    Printf.sprintf "\"name\": %s, \"calls\": %d, \"inclusive_time\": %.6f, \"exclusive_time\": %.6f, \"inclusive_alloc_bytes\": %.0f, \"exclusive_alloc_bytes\": %.0f"
+      (json_string name) calls inclusive_time exclusive_time (bytes inclusive_words) (bytes exclusive_words)
+  in
+  let rec output_node indent node =
+    Printf.fprintf out "%s{%s, \"children\": [" indent
+      (fields node.phase_name node.phase_calls node.inclusive_time node.exclusive_time node.inclusive_words node.exclusive_words);
+    let children = List.rev node.phase_children_list in
+    if children <> [] then begin
+      output_string out "\n";
+      List.iteri (fun i child -> if i > 0 then output_string out ",\n"; output_node (indent ^ "  ") child) children;
+      Printf.fprintf out "\n%s" indent
+    end;
+    output_string out "]}"
+  in
+  output_string out "{\n\"tree\":\n";
+  output_node "" root;
+  output_string out ",\n\"phases\": [\n";
+  List.iteri
+    begin fun i name ->
+      let (calls, inclusive_time, exclusive_time, inclusive_words, exclusive_words) = !(Hashtbl.find totals name) in
+      if i > 0 then output_string out ",\n";
+      Printf.fprintf out "  {%s}" (fields name calls inclusive_time exclusive_time inclusive_words exclusive_words)
+    end
+    (List.rev !names);
+  output_string out "\n]\n}\n";
+  close_out out
@@ -316,6 +316,40 @@ let try_extract xs condition =
   in
   try_extract_core xs condition []
 
+(** An undo trail: a stack of undo entries stored in a growable array.
+    Recording an entry does not allocate a list cell, and undoing a scope just truncates the array
+    after replaying the entries recorded since the scope's mark. *)
+type 'a undo_trail = {
+  mutable trail_entries: 'a array;
+  mutable trail_size: int;
+  mutable trail_high_water_mark: int;
+  trail_dummy: 'a (* Fills unused slots so that undone entries can be garbage-collected. *)
+}
+
+let create_undo_trail dummy = {trail_entries = Array.make 1024 dummy; trail_size = 0; trail_high_water_mark = 0; trail_dummy = dummy}
+
+let undo_trail_record trail x =
+  let n = trail.trail_size in
+  if n = Array.length trail.trail_entries then begin
+    let entries = Array.make (2 * n) trail.trail_dummy in
+    Array.blit trail.trail_entries 0 entries 0 n;
+    trail.trail_entries <- entries
+  end;
+  trail.trail_entries.(n) <- x;
+  trail.trail_size <- n + 1;
+  if n + 1 > trail.trail_high_water_mark then trail.trail_high_water_mark <- n + 1
+
+let undo_trail_mark trail = trail.trail_size
+
+(** Calls [undo] on the entries recorded since [mark] was taken, most recent first, and drops them. [undo] must not record new entries. *)
+let undo_trail_undo_to trail mark undo =
+  let entries = trail.trail_entries in
+  for i = trail.trail_size - 1 downto mark do
+    undo entries.(i);
+    entries.(i) <- trail.trail_dummy
+  done;
+  trail.trail_size <- mark
+
 let startswith s s0 =
   String.length s0 <= String.length s && String.sub s 0 (String.length s0) = s0
 
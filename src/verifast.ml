@@ -12,6 +12,12 @@ open Verifast1
 open Assertions
 open Verify_expr
 
+(* Set by a verification server (see vfconsole's -server mode) in the processes that it keeps warm. For a C program,
+   VerifyProgram then sets up the prover and typechecks the prelude, and calls the hook with a function that verifies the
+   main file at a given path from that state, instead of verifying the program's own main file. The hook forks a process for
+   each file it verifies, and does not return. *)
+let warm_program_hook: ((string -> unit) -> unit) option ref = ref None
+
 module VerifyProgram(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
   
   include VerifyExpr(VerifyProgramArgs)
@@ -43,6 +49,112 @@ module VerifyProgram(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
         None -> consume_asn rules [] h [] hpInvEnv inv true real_unit (fun _ h _ _ _ -> cont h)
       | Some(ehname) -> assert_handle_invs bcn hpmap ehname hpInvEnv h (fun h ->  consume_asn rules [] h [] hpInvEnv inv true real_unit (fun _ h _ _ _ -> cont h))
   
+  (* Region: merging of the states at the end of a branching statement (-merge_states) *)
+  
+  (** The facts that the prover was given since the fact log was [facts0], if they can be replayed; see [prover_facts] *)
+  let facts_since facts0 facts =
+    let rec iter facts =
+      if facts == facts0 then Some [] else
+      match facts with
+        Some t::facts -> begin match iter facts with Some ts -> Some (t::ts) | None -> None end
+      | _ -> None
+    in
+    iter facts
+  
+  (** Joins the states [(h_i, env_i)] at the ends of the paths through a branching statement into one state, whose terms are
+      [IfThenElse (c_1, t_1, IfThenElse (c_2, t_2, ...))] where the states differ, and returns it together with the condition
+      [c_1 || c_2 || ...] that holds at the end of the statement. [c_i] is the conjunction of the facts [fs_i] that path [i]
+      gave the prover, its branch conditions among them. Returns None unless the heaps consist of the same chunks up to their
+      arguments and the environments bind the same variables. *)
+  let merge_states ends =
+    let conds = ends |> List.map (fun (_, _, facts) -> match facts with [] -> ctxt#mk_true | t::ts -> List.fold_left ctxt#mk_and t ts) in
+    let merge_terms ((t::ts') as ts) =
+      if List.for_all (fun t' -> t' == t) ts' then t else
+      let rec iter conds ts =
+        match (conds, ts) with
+          (_, [t]) -> t
+        | (c::conds, t::ts) -> ctxt#mk_ifthenelse c t (iter conds ts)
+      in
+      iter conds ts
+    in
+    let rec transpose tss = match tss with [] -> [] | []::_ -> [] | _ -> List.map List.hd tss::transpose (List.map List.tl tss) in
+    let compatible (Chunk ((g1, literal1), targs1, coef1, ts1, size1)) (Chunk ((g2, literal2), targs2, coef2, ts2, size2)) =
+      g1 == g2 && literal1 = literal2 && coef1 == coef2 && List.length ts1 = List.length ts2 && targs1 = targs2 && size1 = size2
+    in
+    let same_first_arg (Chunk (_, _, _, ts1, _)) (Chunk (_, _, _, ts2, _)) =
+      match (ts1, ts2) with (t1::_, t2::_) -> t1 == t2 | _ -> false
+    in
+    let rec remove c2 h2 = match h2 with [] -> [] | c::h2 -> if c == c2 then h2 else c::remove c2 h2 in
+    (* Removes from [h2] the chunk to merge with [c1]: preferably one with the same first argument *)
+    let take c1 h2 =
+      let candidates = List.filter (compatible c1) h2 in
+      match List.filter (same_first_arg c1) candidates @ candidates with
+        [] -> None
+      | c2::_ -> Some (c2, remove c2 h2)
+    in
+    let rec take_all c1 hs =
+      match hs with
+        [] -> Some ([], [])
+      | h::hs ->
+        match take c1 h with
+          None -> None
+        | Some (c, h) ->
+          match take_all c1 hs with
+            None -> None
+          | Some (cs, hs) -> Some (c::cs, h::hs)
+    in
+    let rec merge_heaps h1 hs =
+      match h1 with
+        [] -> if List.for_all (function [] -> true | _ -> false) hs then Some [] else None
+      | Chunk (g, targs, coef, ts1, size) as c1::h1 ->
+        match take_all c1 hs with
+          None -> None
+        | Some (cs, hs) ->
+          match merge_heaps h1 hs with
+            None -> None
+          | Some h -> Some (Chunk (g, targs, coef, List.map merge_terms (transpose (ts1::List.map (fun (Chunk (_, _, _, ts, _)) -> ts) cs)), size)::h)
+    in
+    let (h1, env1, _)::ends' = ends in
+    let hs = List.map (fun (h, _, _) -> h) ends' in
+    let envs = List.map (fun (_, env, _) -> env) ends' in
+    let same_vars env = List.length env = List.length env1 && List.for_all2 (fun (x1, _) (x, _) -> x1 = x) env1 env in
+    if not (List.for_all same_vars envs) then None else
+    match merge_heaps h1 hs with
+      None -> None
+    | Some h ->
+      let env = List.map (fun ((x, _), ts) -> (x, merge_terms ts)) (List.combine env1 (transpose (List.map (List.map snd) (env1::envs)))) in
+      let (c::cs) = conds in
+      Some (h, env, List.fold_left ctxt#mk_or c cs)
+  
+  (* Whether the branching statement being executed is to be merged; false inside the paths of a statement that is being merged *)
+  let merging_states = ref options.option_merge_states
+  
+  (** Executes the paths through a branching statement (an if or switch statement) by calling [verify_paths skip_exits cont],
+      where [cont] is the continuation for the end of the statement and [skip_exits] says whether to skip the paths that leave
+      the statement in another way (return, break, goto, exceptions). The paths are first executed up to their ends. If their
+      states can be merged, [tcont] runs once, after the paths, for the merged state, under the condition that one of the
+      paths was taken. Otherwise, the paths are executed again with [tcont] as the continuation, skipping the other exits,
+      which the first execution verified already. The merged state is used outside the paths, where what the prover learnt
+      inside them is no longer known, so the facts that each path gave the prover are recorded in [prover_facts] and make
+      up its condition. A path that gave the prover a fact that cannot be replayed (a quantified axiom or fixpoint clauses)
+      is not merged. *)
+  let verify_paths_merged verify_paths tcont =
+    let with_merging b f = let b0 = !merging_states in merging_states := b; do_finally f (fun () -> merging_states := b0) in
+    let facts0 = !prover_facts in
+    let ends = ref [] in
+    let SymExecSuccess = with_merging false (fun () -> verify_paths false (fun h env -> ends := (h, env, facts_since facts0 !prover_facts)::!ends; SymExecSuccess)) in
+    let ends = List.rev !ends in
+    let merged =
+      if ends = [] || List.exists (fun (_, _, facts) -> facts = None) ends then None else
+      merge_states (List.map (fun (h, env, Some facts) -> (h, env, facts)) ends)
+    in
+    match (ends, merged) with
+      ([], _) -> SymExecSuccess (* No path reaches the end of the statement *)
+    | (_, Some (h, env, cond)) ->
+      List.iter (fun _ -> !stats#mergedBranch) (List.tl ends);
+      assume cond (fun () -> tcont h env)
+    | _ -> with_merging false (fun () -> verify_paths true (fun h env -> with_merging true (fun () -> tcont h env)))
+  
   let rec verify_stmt (pn,ilist) blocks_done lblenv tparams boxes pure leminfo funcmap predinstmap sizemap tenv ghostenv h env s tcont return_cont econt =
     let l = stmt_loc s in
     if not (is_transparent_stmt s) then begin !stats#stmtExec l; reportStmtExec l end;
@@ -520,7 +632,7 @@ module VerifyProgram(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
       if args <> [] then static_error l "open_module requires no arguments." None;
       let (_, _, _, _, module_symb, _, _) = List.assoc "module" predfammap in
       let (_, _, _, _, module_code_symb, _, _) = List.assoc "module_code" predfammap in
-      consume_chunk rules h [] [] [] l (module_symb, true) [] real_unit (SrcPat DummyPat) (Some 2) [TermPat current_module_term; TermPat ctxt#mk_true] $. fun _ h coef _ _ _ _ _ ->
+      consume_chunk rules h [] [] [] l (module_symb, true) [] real_unit (SrcPat DummyPat) (Some 2) [TermPat !current_module_term; TermPat ctxt#mk_true] $. fun _ h coef _ _ _ _ _ ->
       begin fun cont ->
         let rec iter h globals =
           match globals with
@@ -535,13 +647,13 @@ module VerifyProgram(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
         let rec iter h importmodules =
           match importmodules with
             | [] -> cont h
-            | (x,importmodule_term)::importmodules when importmodule_term != current_module_term -> 
+            | (x,importmodule_term)::importmodules when importmodule_term != !current_module_term -> 
               iter (Chunk((module_symb, true), [], real_unit, [importmodule_term; ctxt#mk_true], None)::h) importmodules
         in
         iter h importmodulemap
       end $. fun h ->
       let codeChunks =
-        if unloadable then [Chunk ((module_code_symb, true), [], coef, [current_module_term], None)] else []
+        if unloadable then [Chunk ((module_code_symb, true), [], coef, [!current_module_term], None)] else []
       in
       cont (codeChunks @ h) env
     | ExprStmt (CallExpr (l, "close_module", [], [], args, Static)) when pure ->
@@ -569,12 +681,12 @@ module VerifyProgram(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
       end $. fun h ->
       begin fun cont ->
         if unloadable then
-          consume_chunk rules h [] [] [] l (module_code_symb, true) [] real_unit real_unit_pat (Some 1) [TermPat current_module_term] $. fun _ h _ _ _ _ _ _ ->
+          consume_chunk rules h [] [] [] l (module_code_symb, true) [] real_unit real_unit_pat (Some 1) [TermPat !current_module_term] $. fun _ h _ _ _ _ _ _ ->
           cont h
         else
           cont h
       end $. fun h ->
-      cont (Chunk ((module_symb, true), [], real_unit, [current_module_term; ctxt#mk_false], None)::h) env
+      cont (Chunk ((module_symb, true), [], real_unit, [!current_module_term; ctxt#mk_false], None)::h) env
     | DeclStmt (ld, xs) ->
       let rec iter h tenv ghostenv env xs =
         match xs with
@@ -626,11 +738,24 @@ module VerifyProgram(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
         begin match ss2 with [PureStmt (lp, _)] -> static_error lp "Pure statement not allowed here." None | _ -> () end;
       end;
       let w = check_condition (pn,ilist) tparams tenv e in
-      let tcont _ _ _ h env = tcont sizemap tenv ghostenv h (List.filter (fun (x, _) -> List.mem_assoc x tenv) env) in
+      let tcont h env = tcont sizemap tenv ghostenv h env in
       (eval_h_nonpure h env w ( fun h env w ->
-        branch
-          (fun _ -> assume w (fun _ -> verify_block (pn,ilist) blocks_done lblenv tparams boxes pure leminfo funcmap predinstmap sizemap tenv ghostenv h env ss1 tcont return_cont econt))
-          (fun _ -> assume (ctxt#mk_not w) (fun _ -> verify_block (pn,ilist) blocks_done lblenv tparams boxes pure leminfo funcmap predinstmap sizemap tenv ghostenv h env ss2 tcont return_cont econt))
+        let verify_branches skip_exits tcont =
+          let tcont _ _ _ h env = tcont h (List.filter (fun (x, _) -> List.mem_assoc x tenv) env) in
+          let (lblenv, return_cont, econt) =
+            if skip_exits then
+              (List.map (fun (lbl, _) -> (lbl, fun _ _ _ _ _ _ -> SymExecSuccess)) lblenv, (fun _ _ _ _ -> SymExecSuccess), (fun _ _ _ _ _ -> SymExecSuccess))
+            else
+              (lblenv, return_cont, econt)
+          in
+          branch
+            (fun _ -> assume w (fun _ -> verify_block (pn,ilist) blocks_done lblenv tparams boxes pure leminfo funcmap predinstmap sizemap tenv ghostenv h env ss1 tcont return_cont econt))
+            (fun _ -> assume (ctxt#mk_not w) (fun _ -> verify_block (pn,ilist) blocks_done lblenv tparams boxes pure leminfo funcmap predinstmap sizemap tenv ghostenv h env ss2 tcont return_cont econt))
+        in
+        if !merging_states then
+          verify_paths_merged verify_branches tcont
+        else
+          verify_branches false tcont
       ))
     | SwitchStmt (l, e, cs) ->
       let sizemap = match e with 
@@ -641,121 +766,133 @@ module VerifyProgram(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
           end
         | _ -> sizemap
       in
-      let lblenv = (break_label (), fun blocks_done sizemap tenv ghostenv h env -> cont h (List.filter (fun (x, _) -> List.mem_assoc x tenv) env))::lblenv in
       let (w, tp) = check_expr (pn,ilist) tparams tenv e in
       let verify_expr ro h env opt e cont = verify_expr ro h env opt e cont econt in 
       verify_expr false h env None w $. fun h env v ->
-      let tcont _ _ _ h env = tcont sizemap tenv ghostenv h (List.filter (fun (x, _) -> List.mem_assoc x tenv) env) in
-      begin match unfold_inferred_type tp with
-        InductiveType (i, targs) ->
-        let (tn, targs, Some (_, itparams, ctormap, _, _)) = (i, targs, try_assoc' Ghost (pn,ilist) i inductivemap) in
-        let (Some tpenv) = zip itparams targs in
-        let rec iter ctors cs =
-          match cs with
-            [] ->
-            begin
-            match ctors with
-              [] -> success()
-            | _ -> static_error l ("Missing clauses: " ^ String.concat ", " ctors) None
-            end
-          | SwitchStmtDefaultClause (l, _) :: cs -> static_error l "default clause not allowed in switch over inductive datatype" None
-          | SwitchStmtClause (lc, e, ss)::cs ->
-            let (cn, pats) =
-              match e with
-                CallExpr (lcall, cn, [], [], args, Static) ->
-                let pats = List.map (function LitPat (Var (_, x)) -> x | _ -> static_error l "Constructor pattern arguments must be variable names" None) args in
-                (cn, pats)
-              | Var (_, cn) -> (cn, [])
-              | _ -> static_error l "Case expression must be constructor pattern" None
-            in
-            let pts =
-              match try_assoc' Real (pn,ilist) cn ctormap with
-                None -> static_error lc ("Not a constructor of type " ^ tn) None
-              | Some (_, (l, _, _, pts, _)) -> pts
-            in
-            let _ = if not (List.mem cn ctors) then static_error lc "Constructor already handled in earlier clause." None in
-            let (ptenv, xterms, xenv) =
-              let rec iter ptenv xterms xenv pats pts =
-                match (pats, pts) with
-                  ([], []) -> (List.rev ptenv, List.rev xterms, List.rev xenv)
-                | (pat::pats, (name, tp)::pts) ->
-                  if List.mem_assoc pat tenv then static_error lc ("Pattern variable '" ^ pat ^ "' hides existing local variable '" ^ pat ^ "'.") None;
-                  if List.mem_assoc pat ptenv then static_error lc "Duplicate pattern variable." None;
-                  let tp' = instantiate_type tpenv tp in
-                  let term = get_unique_var_symb pat tp' in
-                  let term' =
-                    match unfold_inferred_type tp with
-                      TypeParam x -> convert_provertype term (provertype_of_type tp') ProverInductive
-                    | _ -> term
-                  in
-                  iter ((pat, tp')::ptenv) (term'::xterms) ((pat, term)::xenv) pats pts
-                | ([], _) -> static_error lc "Too few arguments." None
-                | _ -> static_error lc "Too many arguments." None
-              in
-              iter [] [] [] pats pts
-            in
-            let Some (_, _, _, _, ctorsym) = try_assoc' Ghost (pn,ilist) cn purefuncmap in
-            let sizemap =
-              match try_assq v sizemap with
-                None -> sizemap
-              | Some(t, k) -> List.map (fun (x, tx) -> (tx, (t, k - 1))) xenv @ sizemap
-            in
-            branch
-              (fun _ -> assume_eq v (mk_app ctorsym xterms) (fun _ -> verify_cont (pn,ilist) blocks_done lblenv tparams boxes pure leminfo funcmap predinstmap sizemap (ptenv @ tenv) (pats @ ghostenv) h (xenv @ env) ss tcont return_cont econt))
-              (fun _ -> iter (List.filter (function cn' -> cn' <> cn) ctors) cs)
-        in
-        iter (List.map (function (cn, _) -> cn) ctormap) cs
-      | Int (_, _) -> 
-        let n = List.length (List.filter (function SwitchStmtDefaultClause (l, _) -> true | _ -> false) cs) in
-        if n > 1 then static_error l "switch statement can have at most one default clause" None;
-        let cs0 = cs in
-        let rec fall_through h env cs =
-          match cs with
-            [] -> cont h env
-          | c::cs ->
-            let ss =
-              match c with
-                SwitchStmtDefaultClause (l, ss) -> ss
-              | SwitchStmtClause (l, e, ss) -> ss
-            in
-            let tcont _ _ _ h env = fall_through h (List.filter (fun (x, _) -> List.mem_assoc x tenv) env) cs in
-            verify_cont (pn,ilist) blocks_done lblenv tparams boxes pure leminfo funcmap predinstmap sizemap tenv ghostenv h env ss tcont return_cont econt
+      let verify_paths skip_exits cont =
+        let (lblenv, return_cont, econt) =
+          if skip_exits then
+            (List.map (fun (lbl, _) -> (lbl, fun _ _ _ _ _ _ -> SymExecSuccess)) lblenv, (fun _ _ _ _ -> SymExecSuccess), (fun _ _ _ _ _ -> SymExecSuccess))
+          else
+            (lblenv, return_cont, econt)
         in
-        let rec verify_cases cs =
-          match cs with
-            [] ->
-            if n = 0 then (* implicit default *)
-              execute_branch (fun () -> cont h env)
-          | c::cs' ->
-            begin match c with
-              SwitchStmtClause (l, i, ss) ->
-              let w2 = check_expr_t (pn,ilist) tparams tenv i intType in
-              execute_branch $. fun () ->
-              eval_h h env w2 $. fun h env t ->
-              assume_eq t v $. fun () ->
-              fall_through h env cs
-            | SwitchStmtDefaultClause (l, ss) ->
-              execute_branch $. fun () ->
-              let restr =
-                List.fold_left
-                  begin fun state clause -> 
-                    match clause with
-                      SwitchStmtClause (l, i, ss) -> 
-                        let w2 = check_expr_t (pn,ilist) tparams tenv i intType in
-                        ctxt#mk_and state (ctxt#mk_not (ctxt#mk_eq v (ev w2))) 
-                    | _ -> state
-                  end
-                  ctxt#mk_true cs0
+        let lblenv = (break_label (), fun blocks_done sizemap tenv ghostenv h env -> cont h (List.filter (fun (x, _) -> List.mem_assoc x tenv) env))::lblenv in
+        let tcont _ _ _ h env = cont h (List.filter (fun (x, _) -> List.mem_assoc x tenv) env) in
+        begin match unfold_inferred_type tp with
+          InductiveType (i, targs) ->
+          let (tn, targs, Some (_, itparams, ctormap, _, _)) = (i, targs, try_assoc' Ghost (pn,ilist) i inductivemap) in
+          let (Some tpenv) = zip itparams targs in
+          let rec iter ctors cs =
+            match cs with
+              [] ->
+              begin
+              match ctors with
+                [] -> success()
+              | _ -> static_error l ("Missing clauses: " ^ String.concat ", " ctors) None
+              end
+            | SwitchStmtDefaultClause (l, _) :: cs -> static_error l "default clause not allowed in switch over inductive datatype" None
+            | SwitchStmtClause (lc, e, ss)::cs ->
+              let (cn, pats) =
+                match e with
+                  CallExpr (lcall, cn, [], [], args, Static) ->
+                  let pats = List.map (function LitPat (Var (_, x)) -> x | _ -> static_error l "Constructor pattern arguments must be variable names" None) args in
+                  (cn, pats)
+                | Var (_, cn) -> (cn, [])
+                | _ -> static_error l "Case expression must be constructor pattern" None
               in
-              assume restr $. fun () ->
-              fall_through h env cs
-            end;
-            verify_cases cs'
-        in
-        verify_cases cs;
-        success()
-      | _ -> static_error l "Switch statement operand is not an inductive value or integer." None
-      end
+              let pts =
+                match try_assoc' Real (pn,ilist) cn ctormap with
+                  None -> static_error lc ("Not a constructor of type " ^ tn) None
+                | Some (_, (l, _, _, pts, _)) -> pts
+              in
+              let _ = if not (List.mem cn ctors) then static_error lc "Constructor already handled in earlier clause." None in
+              let (ptenv, xterms, xenv) =
+                let rec iter ptenv xterms xenv pats pts =
+                  match (pats, pts) with
+                    ([], []) -> (List.rev ptenv, List.rev xterms, List.rev xenv)
+                  | (pat::pats, (name, tp)::pts) ->
+                    if List.mem_assoc pat tenv then static_error lc ("Pattern variable '" ^ pat ^ "' hides existing local variable '" ^ pat ^ "'.") None;
+                    if List.mem_assoc pat ptenv then static_error lc "Duplicate pattern variable." None;
+                    let tp' = instantiate_type tpenv tp in
+                    let term = get_unique_var_symb pat tp' in
+                    let term' =
+                      match unfold_inferred_type tp with
+                        TypeParam x -> convert_provertype term (provertype_of_type tp') ProverInductive
+                      | _ -> term
+                    in
+                    iter ((pat, tp')::ptenv) (term'::xterms) ((pat, term)::xenv) pats pts
+                  | ([], _) -> static_error lc "Too few arguments." None
+                  | _ -> static_error lc "Too many arguments." None
+                in
+                iter [] [] [] pats pts
+              in
+              let Some (_, _, _, _, ctorsym) = try_assoc' Ghost (pn,ilist) cn purefuncmap in
+              let sizemap =
+                match try_assq v sizemap with
+                  None -> sizemap
+                | Some(t, k) -> List.map (fun (x, tx) -> (tx, (t, k - 1))) xenv @ sizemap
+              in
+              branch
+                (fun _ -> assume_eq v (mk_app ctorsym xterms) (fun _ -> verify_cont (pn,ilist) blocks_done lblenv tparams boxes pure leminfo funcmap predinstmap sizemap (ptenv @ tenv) (pats @ ghostenv) h (xenv @ env) ss tcont return_cont econt))
+                (fun _ -> iter (List.filter (function cn' -> cn' <> cn) ctors) cs)
+          in
+          iter (List.map (function (cn, _) -> cn) ctormap) cs
+        | Int (_, _) -> 
+          let n = List.length (List.filter (function SwitchStmtDefaultClause (l, _) -> true | _ -> false) cs) in
+          if n > 1 then static_error l "switch statement can have at most one default clause" None;
+          let cs0 = cs in
+          let rec fall_through h env cs =
+            match cs with
+              [] -> cont h env
+            | c::cs ->
+              let ss =
+                match c with
+                  SwitchStmtDefaultClause (l, ss) -> ss
+                | SwitchStmtClause (l, e, ss) -> ss
+              in
+              let tcont _ _ _ h env = fall_through h (List.filter (fun (x, _) -> List.mem_assoc x tenv) env) cs in
+              verify_cont (pn,ilist) blocks_done lblenv tparams boxes pure leminfo funcmap predinstmap sizemap tenv ghostenv h env ss tcont return_cont econt
+          in
+          let rec verify_cases cs =
+            match cs with
+              [] ->
+              if n = 0 then (* implicit default *)
+                execute_branch (fun () -> cont h env)
+            | c::cs' ->
+              begin match c with
+                SwitchStmtClause (l, i, ss) ->
+                let w2 = check_expr_t (pn,ilist) tparams tenv i intType in
+                execute_branch $. fun () ->
+                eval_h h env w2 $. fun h env t ->
+                assume_eq t v $. fun () ->
+                fall_through h env cs
+              | SwitchStmtDefaultClause (l, ss) ->
+                execute_branch $. fun () ->
+                let restr =
+                  List.fold_left
+                    begin fun state clause -> 
+                      match clause with
+                        SwitchStmtClause (l, i, ss) -> 
+                          let w2 = check_expr_t (pn,ilist) tparams tenv i intType in
+                          ctxt#mk_and state (ctxt#mk_not (ctxt#mk_eq v (ev w2))) 
+                      | _ -> state
+                    end
+                    ctxt#mk_true cs0
+                in
+                assume restr $. fun () ->
+                fall_through h env cs
+              end;
+              verify_cases cs'
+          in
+          verify_cases cs;
+          success()
+        | _ -> static_error l "Switch statement operand is not an inductive value or integer." None
+        end
+      in
+      if !merging_states then
+        verify_paths_merged verify_paths cont
+      else
+        verify_paths false cont
     | Assert (l, p) when not pure ->
       let we = check_expr_t (pn,ilist) tparams tenv p boolt in
       let t = eval env we in
@@ -906,7 +1043,7 @@ module VerifyProgram(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
           begin match chunk_size with
           | Some (PredicateChunkSize k) ->
             let inductiveness: inductiveness =
-              begin match try_assoc g predfammap with
+              begin match try_lookup_predfam g with
               | Some (_, _, _, _, _, _, inductiveness) -> inductiveness
               | None ->
                 begin match try_assoc g tenv with
@@ -989,7 +1126,7 @@ module VerifyProgram(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
           if not is_global then static_error l "Local predicates are not yet supported here." None;
           if pats0 <> [] then static_error l "Predicate families are not yet supported here." None;
           let g_symb =
-            match try_assoc p#name predfammap with
+            match try_lookup_predfam p#name with
               None -> static_error l "No such predicate." None
             | Some (_, predfam_tparams, arity, pts, g_symb, inputParamCount, _) -> g_symb
           in
@@ -1000,7 +1137,7 @@ module VerifyProgram(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
           in
           ((g_symb, true), inputParamCount, targs, pats, false)
         | WPointsTo (_, WRead (_, e, fparent, fname, frange, fstatic, fvalue, fghost), _, rhs) ->
-          let (p, (_, _, _, _, symb, _, _)) = List.assoc (fparent, fname) field_pred_map in
+          let (p, (_, _, _, _, symb, _, _)) = lookup_field_pred fparent fname in
           let pats, inputParamCount =
             if fstatic then
               [rhs], 0
@@ -2095,7 +2232,7 @@ module VerifyProgram(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
       if not pure && unloadable then
         let codeCoef = List.assoc "currentCodeFraction" env in
         let (_, _, _, _, module_code_symb, _, _) = List.assoc "module_code" predfammap in
-        produce_chunk h (module_code_symb, true) [] codeCoef (Some 1) [current_module_term] None cont
+        produce_chunk h (module_code_symb, true) [] codeCoef (Some 1) [!current_module_term] None cont
       else
         cont h
     end $. fun h ->
@@ -2509,9 +2646,9 @@ module VerifyProgram(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
           if unloadable && not in_pure_context then
             let (_, _, _, _, module_code_symb, _, _) = List.assoc "module_code" predfammap in
             with_context (Executing (h, env, l, "Consuming code fraction")) $. fun () ->
-            consume_chunk rules h [] [] [] l (module_code_symb, true) [] real_unit (SrcPat DummyPat) (Some 1) [TermPat current_module_term] $. fun _ h coef _ _ _ _ _ ->
+            consume_chunk rules h [] [] [] l (module_code_symb, true) [] real_unit (SrcPat DummyPat) (Some 1) [TermPat !current_module_term] $. fun _ h coef _ _ _ _ _ ->
             let half = real_mul l real_half coef in
-            cont (Chunk ((module_code_symb, true), [], half, [current_module_term], None)::h) (("currentCodeFraction", RealType)::tenv) ("currentCodeFraction"::ghostenv) (("currentCodeFraction", half)::env)
+            cont (Chunk ((module_code_symb, true), [], half, [!current_module_term], None)::h) (("currentCodeFraction", RealType)::tenv) ("currentCodeFraction"::ghostenv) (("currentCodeFraction", half)::env)
           else
             cont h tenv ghostenv env
         end $. fun h tenv ghostenv env ->
@@ -2549,10 +2686,302 @@ module VerifyProgram(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
   
   let record_fun_timing l funName body =
     let time0 = Perf.time() in
-    let result = body () in
+    let result = profile_phase ("function " ^ funName) body in
     !stats#recordFunctionTiming (string_of_loc l ^ ": " ^ funName) (Perf.time() -. time0);
     result
-  
+
+  (* Region: verification result cache *)
+
+  (* With -cache <dir>, a function body that verified successfully is recorded in <dir> under a fingerprint,
+     and it is not symbolically executed again as long as its fingerprint does not change.
+     The fingerprint covers the source lines of the function itself and of the declarations of the current file
+     it refers to, transitively (of a function with a body, only the lines up to its first statement are included),
+     as well as the preprocessor directives of the current file, the headers it includes, the prelude,
+     the VeriFast executable and the command-line options.
+     References are found by identifier, so the set of dependencies is an over-approximation.
+     A declaration's source lines are taken to run from the location of the preceding declaration to the
+     location of the next one, which also over-approximates. Only C files are cached. *)
+  let verification_cache_dir =
+    match options.option_cache_dir with
+      Some dir when language = CLang && breakpoint = None && exportpoint = None && !targetPath = None && not (startswith filepath "<stdin>") -> Some dir
+    | _ -> None
+
+  let identifiers_of_text text =
+    let n = String.length text in
+    let is_ident_start c = match c with 'A'..'Z' | 'a'..'z' | '_' -> true | _ -> false in
+    let is_ident_char c = is_ident_start c || match c with '0'..'9' -> true | _ -> false in
+    let rec iter i ids =
+      if i >= n then ids else
+      if is_ident_char text.[i] then begin
+        let j = ref (i + 1) in
+        while !j < n && is_ident_char text.[!j] do incr j done;
+        iter !j (if is_ident_start text.[i] then String.sub text i (!j - i)::ids else ids)
+      end else
+        iter (i + 1) ids
+    in
+    iter 0 []
+
+  (* Returns the names by which other declarations refer to a declaration, the location of the first statement of the
+     body of a function, and whether the declaration must be included in every fingerprint (because it takes effect
+     without being referred to). *)
+  let cache_info_of_decl d =
+    match d with
+      Struct (l, s, fds) ->
+      let fields = match fds with None -> [] | Some fds -> flatmap (fun (Field (_, _, _, f, _, _, _, _)) -> [f; s ^ "_" ^ f]) fds in
+      (l, s::("malloc_block_" ^ s)::fields, None, false)
+    | Inductive (l, i, _, ctors) -> (l, i::List.map (fun (Ctor (_, c, _)) -> c) ctors, None, false)
+    | AbstractTypeDecl (l, t) -> (l, [t], None, false)
+    | Class (l, _, _, cn, _, _, _, _, _, _) -> (l, [cn], None, false)
+    | Interface (l, i, _, _, _, _) -> (l, [i], None, false)
+    | PredFamilyDecl (l, p, _, _, _, _, _) -> (l, [p], None, false)
+    | PredFamilyInstanceDecl (l, p, _, _, _, _) -> (l, [p], None, false)
+    | PredCtorDecl (l, p, _, _, _, _) -> (l, [p], None, false)
+    | Func (l, Lemma (true, _), _, _, g, _, _, _, _, _, _, _, _) -> (l, [g], None, true)
+    | Func (l, k, _, _, g, _, _, _, _, _, Some (ss, closeBraceLoc), _, _) when k <> Fixpoint ->
+      (l, [g], Some (match ss with s::_ -> stmt_loc s | [] -> closeBraceLoc), false)
+    | Func (l, _, _, _, g, _, _, _, _, _, _, _, _) -> (l, [g], None, false)
+    | TypedefDecl (l, _, t) -> (l, [t], None, false)
+    | FuncTypeDecl (l, _, _, ft, _, _, _, _) -> (l, [ft; "is_" ^ ft], None, false)
+    | BoxClassDecl (l, b, _, _, ads, hpds) ->
+      (l, b::List.map (fun (ActionDecl (_, a, _, _, _, _)) -> a) ads @ List.map (fun (HandlePredDecl (_, h, _, _, _, _)) -> h) hpds, None, false)
+    | EnumDecl (l, e, cs) -> (l, e::List.map fst cs, None, false)
+    | Global (l, _, x, _) -> (l, [x], None, false)
+    | UnloadableModuleDecl l | ImportModuleDecl (l, _) | RequireModuleDecl (l, _) -> (l, [], None, true)
+
+  let verification_cache_info =
+    lazy begin
+      let lines = Array.of_list (String.split_on_char '\n' (readFile filepath)) in
+      let line_count = Array.length lines in
+      let infos = Array.of_list (List.map cache_info_of_decl (flatmap (fun (PackageDecl (_, _, _, ds)) -> ds) ps)) in
+      let n = Array.length infos in
+      let line_of l = let ((path, line, _), _) = root_caller_token l in if path = filepath then line else raise Exit in
+      try
+        let starts = Array.map (fun (l, _, _, _) -> line_of l) infos in
+        for i = 1 to n - 1 do if starts.(i) < starts.(i - 1) then raise Exit done;
+        let text first last =
+          if first > last then "" else String.concat "\n" (Array.to_list (Array.sub lines (first - 1) (last - first + 1)))
+        in
+        let window_start i = if i = 0 then 1 else starts.(i - 1) in
+        let window_end i = if i = n - 1 then line_count else starts.(i + 1) in
+        let full_texts = Array.init n (fun i -> text (window_start i) (window_end i)) in
+        let contract_texts =
+          Array.init n begin fun i ->
+            match infos.(i) with
+              (_, _, Some lbody, _) -> text (window_start i) (min (window_end i) (max starts.(i) (line_of lbody)))
+            | _ -> full_texts.(i)
+          end
+        in
+        let names = Hashtbl.create 100 in
+        let decl_indices = Hashtbl.create 100 in
+        infos |> Array.iteri begin fun i (l, xs, _, _) ->
+          List.iter (fun x -> Hashtbl.add names x i) xs;
+          Hashtbl.replace decl_indices l i
+        end;
+        let digest_file path = try Digest.file path with Sys_error _ -> path in
+        let context =
+          let executable = try Digest.file Sys.executable_name with Sys_error _ -> Vfversion.version in
+          let options = Marshal.to_string {options with option_verbose = 0; option_cache_dir = None; option_jobs = 1; option_execution_forest = NoForest} [] in
+          let directives = Buffer.create 1000 in
+          let continued = ref false in
+          lines |> Array.iter begin fun line ->
+            let line = String.trim line in
+            if !continued || startswith line "#" then begin
+              Buffer.add_string directives line;
+              Buffer.add_char directives '\n';
+              continued := line <> "" && line.[String.length line - 1] = '\\'
+            end
+          end;
+          let header_paths = List.map (fun (_, (_, _, path), _, _) -> path) headers in
+          let prelude_paths =
+            Array.to_list (Sys.readdir !bindir)
+            |> List.filter (fun x -> Filename.check_suffix x ".h" || Filename.check_suffix x ".gh")
+            |> List.sort compare
+            |> List.map (concat !bindir)
+          in
+          let always_included = List.concat (Array.to_list (Array.mapi (fun i (_, _, _, always) -> if always then [full_texts.(i)] else []) infos)) in
+          Digest.string (String.concat "\000" (executable::options::Buffer.contents directives::List.map digest_file (header_paths @ prelude_paths) @ always_included))
+        in
+        Some (context, names, decl_indices, full_texts, contract_texts, Array.map identifiers_of_text full_texts, Array.map identifiers_of_text contract_texts)
+      with Exit -> None
+    end
+
+  let verification_cache_key l g =
+    if verification_cache_dir = None then None else
+    match Lazy.force verification_cache_info with
+      None -> None
+    | Some (context, names, decl_indices, full_texts, contract_texts, full_ids, contract_ids) ->
+      match Hashtbl.find_opt decl_indices l with
+        None -> None
+      | Some i ->
+        let visited = Hashtbl.create 100 in
+        Hashtbl.add visited i ();
+        let rec visit ids =
+          ids |> List.iter begin fun x ->
+            Hashtbl.find_all names x |> List.iter begin fun j ->
+              if not (Hashtbl.mem visited j) then begin
+                Hashtbl.add visited j ();
+                visit contract_ids.(j)
+              end
+            end
+          end
+        in
+        visit full_ids.(i);
+        let deps = List.sort compare (Hashtbl.fold (fun j () js -> if j = i then js else j::js) visited []) in
+        let dep_texts = List.map (fun j -> (if j < i then "<" else ">") ^ contract_texts.(j)) deps in
+        Some (Digest.to_hex (Digest.string (String.concat "\000" (context::g::full_texts.(i)::dep_texts))))
+
+  (* A cache entry lists the prototypes used by the function, so that they can still be checked during linking. *)
+  let verification_cache_lookup key =
+    match verification_cache_dir with
+      None -> None
+    | Some dir ->
+      let path = concat dir key in
+      if Sys.file_exists path then
+        Some (List.filter (fun g -> g <> "") (String.split_on_char '\n' (readFile path)))
+      else
+        None
+
+  let verification_cache_record key prototypes =
+    match verification_cache_dir with
+      None -> ()
+    | Some dir ->
+      try
+        if not (Sys.file_exists dir) then Unix.mkdir dir 0o755;
+        let path = concat dir key in
+        let tmp_path = Printf.sprintf "%s.%d.tmp" path (Unix.getpid ()) in
+        let chan = open_out_bin tmp_path in
+        List.iter (fun g -> output_string chan (g ^ "\n")) prototypes;
+        close_out chan;
+        Sys.rename tmp_path path
+      with Sys_error _ | Unix.Unix_error _ -> ()
+
+  let with_verification_cache l g verify skip =
+    match verification_cache_key l g with
+      None -> verify ()
+    | Some key ->
+      match verification_cache_lookup key with
+        Some prototypes when List.for_all (fun g -> List.mem_assoc g funcmap) prototypes ->
+        !stats#verificationCacheHit;
+        prototypes |> List.iter begin fun g ->
+          let FuncInfo (_, _, lg, _, _, _, _, _, _, _, _, _, _, _, _, _) = List.assoc g funcmap in
+          if not (List.mem (g, lg) !prototypes_used) then prototypes_used := (g, lg)::!prototypes_used
+        end;
+        skip ()
+      | _ ->
+        !stats#verificationCacheMiss;
+        let prototypes_used0 = !prototypes_used in
+        let shouldFailLocs0 = !shouldFailLocs in
+        prototypes_used := [];
+        let result = try verify () with e -> prototypes_used := !prototypes_used @ prototypes_used0; raise e in
+        let prototypes = !prototypes_used in
+        prototypes_used := List.filter (fun p -> not (List.mem p prototypes_used0)) prototypes @ prototypes_used0;
+        (* A function whose expected failure was detected did not really verify. *)
+        if !shouldFailLocs == shouldFailLocs0 then
+          verification_cache_record key (List.map fst prototypes);
+        result
+
+  (* Region: parallel verification *)
+
+  (* With -jobs N, function, method and constructor bodies are verified in up to N forked worker processes.
+     A worker inherits the prover context as it is at the point where the body would be verified sequentially,
+     while the parent process moves on to the next declaration. Worker results are processed in source order
+     at the end, so that the failure that is reported is the one a sequential run would report. *)
+  type worker_outcome =
+    WorkerVerified
+  | WorkerStaticError of loc * string * string option
+  | WorkerSymbolicExecutionError of string context list * loc * string * string option
+  | WorkerFailed of string
+
+  (* verify_program sets option_jobs to 1 for provers that run in a separate process, since the workers would share the pipe to it. *)
+  let worker_count =
+    if Sys.os_type = "Unix" && breakpoint = None && exportpoint = None && !targetPath = None then options.option_jobs else 1
+
+  (* Terminates a worker without running the at_exit functions registered by the parent process (e.g. the -profile writer).
+     Unix._exit does this too, but requires OCaml 4.12. *)
+  external exit_worker: int -> 'a = "caml_sys_exit"
+
+  let in_worker_process = ref false
+  let workers: (int * string * loc) Queue.t = Queue.create () (* pid, result file, location of the body *)
+  let running_worker_count = ref 0
+  let finished_workers: (int, Unix.process_status) Hashtbl.t = Hashtbl.create 10
+
+  let wait_for_worker () =
+    let rec wait () = try Unix.wait () with Unix.Unix_error (Unix.EINTR, _, _) -> wait () in
+    let (pid, status) = wait () in
+    Hashtbl.replace finished_workers pid status;
+    decr running_worker_count
+
+  let with_worker l body =
+    if worker_count <= 1 || !in_worker_process then body () else begin
+      while !running_worker_count >= worker_count do wait_for_worker () done;
+      let result_path = Filename.temp_file "vfworker" ".result" in
+      flush stdout;
+      flush stderr;
+      match Unix.fork () with
+        0 ->
+        in_worker_process := true;
+        clear_stats ();
+        let shouldFailLocs0 = !shouldFailLocs in
+        let outcome =
+          try
+            body ();
+            WorkerVerified
+          with
+            StaticError (l, msg, url) -> WorkerStaticError (l, msg, url)
+          | SymbolicExecutionError (ctxts, l, msg, url) -> WorkerSymbolicExecutionError (ctxts, l, msg, url)
+          | e -> WorkerFailed (Printexc.to_string e)
+        in
+        let shouldFailLocsConsumed = List.filter (fun l -> not (List.mem l !shouldFailLocs)) shouldFailLocs0 in
+        let chan = open_out_bin result_path in
+        Marshal.to_channel chan (outcome, !prototypes_used, shouldFailLocsConsumed, !stats#workerCounts) [];
+        close_out chan;
+        flush stdout;
+        flush stderr;
+        exit_worker 0
+      | pid ->
+        incr running_worker_count;
+        Queue.add (pid, result_path, l) workers
+    end
+
+  let abandon_workers () =
+    workers |> Queue.iter begin fun (pid, result_path, _) ->
+      if not (Hashtbl.mem finished_workers pid) then begin
+        (try Unix.kill pid Sys.sigkill with Unix.Unix_error _ -> ());
+        (* Reap the killed worker so that it does not linger as a zombie. *)
+        let rec wait () = try ignore (Unix.waitpid [] pid) with Unix.Unix_error (Unix.EINTR, _, _) -> wait () | Unix.Unix_error _ -> () in
+        wait ();
+        decr running_worker_count
+      end;
+      Hashtbl.remove finished_workers pid;
+      if Sys.file_exists result_path then Sys.remove result_path
+    end;
+    Queue.clear workers
+
+  (* Merges the results of the workers into the state of this process and raises the first failure, in source order. *)
+  let finish_workers () =
+    while not (Queue.is_empty workers) do
+      let (pid, result_path, l) = Queue.pop workers in
+      while not (Hashtbl.mem finished_workers pid) do wait_for_worker () done;
+      if Hashtbl.find finished_workers pid <> Unix.WEXITED 0 then begin
+        abandon_workers ();
+        static_error l "The worker process verifying this function terminated abnormally." None
+      end;
+      let chan = open_in_bin result_path in
+      let (outcome, prototypes, shouldFailLocsConsumed, counts) =
+        (Marshal.from_channel chan: worker_outcome * (string * loc) list * loc0 list * worker_counts)
+      in
+      close_in chan;
+      Sys.remove result_path;
+      prototypes |> List.iter (fun p -> if not (List.mem p !prototypes_used) then prototypes_used := p::!prototypes_used);
+      shouldFailLocs := List.filter (fun l -> not (List.mem l shouldFailLocsConsumed)) !shouldFailLocs;
+      !stats#addWorkerCounts counts;
+      match outcome with
+        WorkerVerified -> ()
+      | WorkerStaticError (l, msg, url) -> abandon_workers (); raise (StaticError (l, msg, url))
+      | WorkerSymbolicExecutionError (ctxts, l, msg, url) -> abandon_workers (); raise (SymbolicExecutionError (ctxts, l, msg, url))
+      | WorkerFailed msg -> abandon_workers (); failwith msg
+    done
+
   let rec verify_exceptional_return (pn,ilist) l h ghostenv env exceptp excep handlers =
     if not (is_unchecked_exception_type exceptp) then
       match handlers with
@@ -2587,6 +3016,7 @@ module VerifyProgram(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
         else
           static_error lm "Constructor specification is only allowed in javaspec files!" None
       | Some (Some ((ss, closeBraceLoc), rank)) ->
+        with_worker lm begin fun () ->
         record_fun_timing lm (cn ^ ".<ctor>") begin fun () ->
         if !verbosity >= 1 then Printf.printf "%10.6fs: %s: Verifying constructor %s\n" (Perf.time()) (string_of_loc lm) (string_of_sign (cn, sign));
         execute_branch begin fun () ->
@@ -2665,6 +3095,7 @@ module VerifyProgram(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
           assume_neq this (ctxt#mk_intlit 0) $. fun() -> do_body h ghostenv (("this", this)::env)
         end
         end
+        end
         end;
         verify_cons (pn,ilist) cfin cn supercn superctors boxes lems rest
   
@@ -2678,6 +3109,7 @@ module VerifyProgram(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
           if (Filename.check_suffix p ".javaspec") || abstract then verify_meths (pn,ilist) cfin cabstract boxes lems meths
           else static_error l "Method specification is only allowed in javaspec files!" None
       | Some (Some ((ss, closeBraceLoc), rank)) ->
+        with_worker l begin fun () ->
         record_fun_timing l g begin fun () ->
         if !verbosity >= 1 then Printf.printf "%10.6fs: %s: Verifying method %s\n" (Perf.time()) (string_of_loc l) g;
         if abstract then static_error l "Abstract method cannot have implementation." None;
@@ -2723,6 +3155,7 @@ module VerifyProgram(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
           let cont sizemap tenv ghostenv h env = return_cont h tenv env None in
           verify_block (pn,ilist) [] [] [] boxes in_pure_context leminfo funcmap predinstmap sizemap tenv ghostenv h env ss cont return_cont econt
         end
+        end
         end;
         verify_meths (pn,ilist) cfin cabstract boxes lems meths
   
@@ -2749,7 +3182,7 @@ module VerifyProgram(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
       if language = Java && not (Filename.check_suffix g_file_name ".javaspec") then
         static_error l "A lemma function outside a .javaspec file must have a body. To assume a lemma, use the body '{ assume(false); }'." None;
       let FuncInfo ([], fterm, _, k, tparams', rt, ps, nonghost_callers_only, pre, pre_tenv, post, terminates, functype_opt, body, fb,v) = List.assoc g funcmap in
-      if auto && (Filename.check_suffix g_file_name ".c" || is_import_spec || language = CLang && Filename.chop_extension (Filename.basename g_file_name) <> Filename.chop_extension (Filename.basename program_path)) then begin
+      if auto && (Filename.check_suffix g_file_name ".c" || is_import_spec || language = CLang && Filename.chop_extension (Filename.basename g_file_name) <> Filename.chop_extension (Filename.basename !main_program_path)) then begin
         register_prototype_used l g fterm;
         create_auto_lemma l (pn,ilist) g trigger pre post ps pre_tenv tparams'
       end;
@@ -2772,13 +3205,28 @@ module VerifyProgram(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
       verify_funcs (pn,ilist) boxes gs lems ds
     | Func (l, k, _, _, g, _, _, functype_opt, _, _, Some _, _, _)::ds when k <> Fixpoint ->
       let g = full_name pn g in
+      let verify () =
+        let FuncInfo ([], fterm, l, k, tparams', rt, ps, nonghost_callers_only, pre, pre_tenv, post, terminates, _, Some (Some (ss, closeBraceLoc)),fb,v) = (List.assoc g funcmap)in
+        let tparams = [] in
+        let env = [] in
+        verify_func pn ilist gs lems boxes predinstmap funcmap tparams env l k tparams' rt g ps nonghost_callers_only pre pre_tenv post terminates ss closeBraceLoc
+      in
+      (* Performs the effects of verify_func other than the verification itself; used if the function verified before or is verified by a worker. *)
+      let skip () =
+        let FuncInfo ([], fterm, l, k, tparams', rt, ps, nonghost_callers_only, pre, pre_tenv, post, terminates, _, _, fb, v) = List.assoc g funcmap in
+        begin match k with
+          Lemma(true, trigger) -> create_auto_lemma l (pn,ilist) g trigger pre post ps pre_tenv tparams'
+        | _ -> ()
+        end;
+        if is_lemma k then (gs, g::lems) else (g::gs, lems)
+      in
       let gs', lems' =
-      record_fun_timing l g begin fun () ->
-      let FuncInfo ([], fterm, l, k, tparams', rt, ps, nonghost_callers_only, pre, pre_tenv, post, terminates, _, Some (Some (ss, closeBraceLoc)),fb,v) = (List.assoc g funcmap)in
-      let tparams = [] in
-      let env = [] in
-      verify_func pn ilist gs lems boxes predinstmap funcmap tparams env l k tparams' rt g ps nonghost_callers_only pre pre_tenv post terminates ss closeBraceLoc
-      end in
+        if worker_count > 1 && not !in_worker_process then begin
+          with_worker l (fun () -> ignore (record_fun_timing l g (fun () -> with_verification_cache l g verify skip)));
+          skip ()
+        end else
+          record_fun_timing l g (fun () -> with_verification_cache l g verify skip)
+      in
       verify_funcs (pn, ilist) boxes gs' lems' ds
     | BoxClassDecl (l, bcn, _, _, _, _)::ds -> let bcn=full_name pn bcn in
       let (Some (l, boxpmap, boxinv, boxvarmap, amap, hpmap)) = try_assoc' Ghost (pn,ilist) bcn boxmap in
@@ -2898,7 +3346,16 @@ module VerifyProgram(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
       PackageDecl(l,pn,il,ds)::rest-> let (boxes, gs, lems) = verify_funcs (pn,il) boxes gs lems ds in verify_funcs' boxes gs lems rest
     | [] -> verify_classes boxes lems classmap
   
-  let () = verify_funcs' [] gs0 lems0 ps
+  let () =
+    begin match typechecking_frame with Some frame -> unwind_profile_stack frame | None -> () end;
+    begin try
+      profile_phase "symbolic execution" (fun () -> verify_funcs' [] gs0 lems0 ps)
+    with e ->
+      (* The workers verify bodies that precede the failing declaration; their failures take precedence. *)
+      finish_workers ();
+      raise e
+    end;
+    finish_workers ()
   
   let result = 
     (
@@ -2918,97 +3375,111 @@ module VerifyProgram(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
   end (* CheckFile *)
   
   let rec check_file filepath is_import_spec include_prelude dir headers ps =
-    let module CF = CheckFile(struct
-      let filepath = filepath
-      let is_import_spec = is_import_spec
-      let include_prelude = include_prelude
-      let dir = dir
-      let headers = headers
-      let ps = ps
-      let check_file = check_file
-    end) in
-    CF.result
+    let frame = if !profiling then Some (enter_phase "typechecking") else None in
+    do_finally begin fun () ->
+      let module CF = CheckFile(struct
+        let filepath = filepath
+        let is_import_spec = is_import_spec
+        let include_prelude = include_prelude
+        let dir = dir
+        let headers = headers
+        let ps = ps
+        let typechecking_frame = frame
+        let check_file = check_file
+      end) in
+      CF.result
+    end begin fun () ->
+      match frame with Some frame -> unwind_profile_stack frame | None -> ()
+    end
   
   (* Region: top-level stuff *)
   
-  let jardeps = ref []
-  let provide_files = ref []
-  let (prototypes_implemented, functypes_implemented, structures_defined, 
-       nonabstract_predicates, modules_imported) =
-    let result = check_should_fail ([], [], [], [], []) $. fun () ->
-    let (headers, ds)=
-      match file_type path with
-        | Java ->
-          let l = Lexed (file_loc path) in
-          let (headers, javas, provides) =
-            if Filename.check_suffix path ".jarsrc" then
-              let (jars, javas, provides) = parse_jarsrc_file_core path in
-              let specPath = Filename.chop_extension path ^ ".jarspec" in
-              let jarspecs = List.map (fun path -> (l, (DoubleQuoteInclude, path ^ "spec",""), [], [])) jars in (* Include the location where the jar is referenced *)
-              let pathDir = Filename.dirname path in
-              let javas = List.map (concat pathDir) javas in
-              if Sys.file_exists specPath then begin
-                let (specJars, _) = parse_jarspec_file_core specPath in
-                jardeps := specJars @ jars;
-                ((l, (DoubleQuoteInclude, Filename.basename specPath,""), [], []) :: jarspecs, javas, provides)
-              end else
-                (jarspecs, javas, provides)
+  (* Verifies the program whose main file is at [path]: normally the one at program_path, but see warm_program_hook. *)
+  let verify_main_file path =
+    if path <> program_path then begin
+      main_program_path := path;
+      current_module_name := current_module_name_of path;
+      current_module_term := get_unique_var_symb !current_module_name intType
+    end;
+    let jardeps = ref [] in
+    let provide_files = ref [] in
+    let (prototypes_implemented, functypes_implemented, structures_defined, 
+         nonabstract_predicates, modules_imported) =
+      let result = check_should_fail ([], [], [], [], []) $. fun () ->
+      let (headers, ds)=
+        match file_type path with
+          | Java ->
+            let l = Lexed (file_loc path) in
+            let (headers, javas, provides) =
+              if Filename.check_suffix path ".jarsrc" then
+                let (jars, javas, provides) = parse_jarsrc_file_core path in
+                let specPath = Filename.chop_extension path ^ ".jarspec" in
+                let jarspecs = List.map (fun path -> (l, (DoubleQuoteInclude, path ^ "spec",""), [], [])) jars in (* Include the location where the jar is referenced *)
+                let pathDir = Filename.dirname path in
+                let javas = List.map (concat pathDir) javas in
+                if Sys.file_exists specPath then begin
+                  let (specJars, _) = parse_jarspec_file_core specPath in
+                  jardeps := specJars @ jars;
+                  ((l, (DoubleQuoteInclude, Filename.basename specPath,""), [], []) :: jarspecs, javas, provides)
+                end else
+                  (jarspecs, javas, provides)
+              else
+                ([], [path], [])
+            in
+            let provides = provides @ options.option_provides in
+            let token = (* A string to make the provide files unique *)
+              if options.option_keep_provide_files then "" else Printf.sprintf "_%ld" (Stopwatch.getpid ())
+            in
+            let provide_javas =
+              provides |> imap begin fun i provide ->
+                let provide_file = Printf.sprintf "%s_provide%d%s.java" (Filename.chop_extension path) i token in
+                let cmdLine = Printf.sprintf "%s > %s" provide provide_file in
+                let exitCode = Sys.command cmdLine in
+                if exitCode <> 0 then
+                  raise (static_error l (Printf.sprintf "Provide %d: command '%s' failed with exit code %d" i cmdLine exitCode) None);
+                provide_file
+              end
+            in
+            provide_files := provide_javas;
+            let javas = javas @ provide_javas in
+            let context = List.map (fun (Lexed ((b, _, _), _), (_, p, _), _, _) -> Util.concat (Filename.dirname b) ((Filename.chop_extension p) ^ ".jar")) headers in
+            let ds = Java_frontend_bridge.parse_java_files javas context reportRange reportShouldFail options.option_verbose options.option_enforce_annotations options.option_use_java_frontend in
+            (headers, ds)
+          | CLang ->
+            if Filename.check_suffix path ".h" then
+              parse_header_file path reportRange reportShouldFail options.option_verbose [] options.option_define_macros options.option_enforce_annotations data_model
             else
-              ([], [path], [])
-          in
-          let provides = provides @ options.option_provides in
-          let token = (* A string to make the provide files unique *)
-            if options.option_keep_provide_files then "" else Printf.sprintf "_%ld" (Stopwatch.getpid ())
-          in
-          let provide_javas =
-            provides |> imap begin fun i provide ->
-              let provide_file = Printf.sprintf "%s_provide%d%s.java" (Filename.chop_extension path) i token in
-              let cmdLine = Printf.sprintf "%s > %s" provide provide_file in
-              let exitCode = Sys.command cmdLine in
-              if exitCode <> 0 then
-                raise (static_error l (Printf.sprintf "Provide %d: command '%s' failed with exit code %d" i cmdLine exitCode) None);
-              provide_file
-            end
-          in
-          provide_files := provide_javas;
-          let javas = javas @ provide_javas in
-          let context = List.map (fun (Lexed ((b, _, _), _), (_, p, _), _, _) -> Util.concat (Filename.dirname b) ((Filename.chop_extension p) ^ ".jar")) headers in
-          let ds = Java_frontend_bridge.parse_java_files javas context reportRange reportShouldFail options.option_verbose options.option_enforce_annotations options.option_use_java_frontend in
-          (headers, ds)
-        | CLang ->
-          if Filename.check_suffix path ".h" then
-            parse_header_file path reportRange reportShouldFail options.option_verbose [] options.option_define_macros options.option_enforce_annotations data_model
-          else
-            parse_c_file path reportRange reportShouldFail options.option_verbose options.option_include_paths options.option_define_macros options.option_enforce_annotations data_model
-    in
-    emitter_callback ds;
-    check_should_fail ([], [], [], [], []) $. fun () ->
-    let (linker_info, _) = check_file path false true programDir headers ds in
-    linker_info
+              parse_c_file path reportRange reportShouldFail options.option_verbose options.option_include_paths options.option_define_macros options.option_enforce_annotations data_model
+      in
+      emitter_callback ds;
+      check_should_fail ([], [], [], [], []) $. fun () ->
+      let (linker_info, _) = check_file path false true (Filename.dirname path) headers ds in
+      linker_info
+      in
+      begin
+        match !shouldFailLocs with
+          [] -> ()
+        | l::_ -> static_error (Lexed l) "No error found on line." None
+      end;
+      result
     in
-    begin
-      match !shouldFailLocs with
-        [] -> ()
-      | l::_ -> static_error (Lexed l) "No error found on line." None
-    end;
-    result
   
-  let () =
     if not options.option_keep_provide_files then begin
       !provide_files |> List.iter Sys.remove
-    end
+    end;
   
-  let () = !stats#appendProverStats ctxt#stats
+    !stats#appendProverStats ctxt#stats;
 
-  let create_jardeps_file() =
-    let jardeps_filename = Filename.chop_extension path ^ ".jardeps" in
-    if emit_manifest then
-      let file = open_out jardeps_filename in
-      do_finally (fun () ->
-        List.iter (fun line -> output_string file (line ^ "\n")) !jardeps
-      ) (fun () -> close_out file)
-    else
-      jardeps_map := (jardeps_filename, !jardeps)::!jardeps_map
+    let create_jardeps_file() =
+      let jardeps_filename = Filename.chop_extension path ^ ".jardeps" in
+      if emit_manifest then
+        let file = open_out jardeps_filename in
+        do_finally (fun () ->
+          List.iter (fun line -> output_string file (line ^ "\n")) !jardeps
+        ) (fun () -> close_out file)
+      else
+        jardeps_map := (jardeps_filename, !jardeps)::!jardeps_map
+    in
 
 (*
 There are 7 kinds of entries possible in a vfmanifest/dll_vfmanifest file
@@ -3057,76 +3528,98 @@ There are 7 kinds of entries possible in a vfmanifest/dll_vfmanifest file
 
 *)
 
-  let create_manifest_file() =
-    let manifest_filename = Filename.chop_extension path ^ ".vfmanifest" in
-    let qualified_path path' =
-      qualified_path options.option_vroots path (Filename.dirname path', Filename.basename path')
-    in
-    let sorted_lines symbol protos =
-      let lines =
-        protos |> List.map begin fun (g, l) ->
-          let ((path, _, _), _) = root_caller_token l in
-          qualified_path path ^ (Char.escaped symbol) ^ g
-        end
+    let create_manifest_file() =
+      let manifest_filename = Filename.chop_extension path ^ ".vfmanifest" in
+      let qualified_path path' =
+        qualified_path options.option_vroots path (Filename.dirname path', Filename.basename path')
       in
-      List.sort compare lines
-    in
-    let sorted_module_lines modules =
-      let lines =
-        modules |> List.map begin fun (name, _) -> name
-        end
+      let sorted_lines symbol protos =
+        let lines =
+          protos |> List.map begin fun (g, l) ->
+            let ((path, _, _), _) = root_caller_token l in
+            qualified_path path ^ (Char.escaped symbol) ^ g
+          end
+        in
+        List.sort compare lines
+      in
+      let sorted_module_lines modules =
+        let lines =
+          modules |> List.map begin fun (name, _) -> name
+          end
+        in
+        List.sort compare lines
+      in
+      let sorted_delayed_definition_lines defs =
+        let lines =
+          defs |> List.map begin fun (x, ldecl, ldef) ->
+            let ((declpath, _, _), _) = root_caller_token ldecl in
+            let ((defpath, _, _), _) = root_caller_token ldef in
+            Printf.sprintf "%s@%s#%s" (qualified_path defpath) (qualified_path declpath) x
+          end
+        in
+        List.sort compare lines
       in
-      List.sort compare lines
-    in
-    let sorted_delayed_definition_lines defs =
       let lines =
-        defs |> List.map begin fun (x, ldecl, ldef) ->
-          let ((declpath, _, _), _) = root_caller_token ldecl in
-          let ((defpath, _, _), _) = root_caller_token ldef in
-          Printf.sprintf "%s@%s#%s" (qualified_path defpath) (qualified_path declpath) x
-        end
+        List.map (fun line -> ".requires " ^ line) (sorted_lines '#' !prototypes_used)
+        @
+        List.map (fun line -> ".provides " ^ line) (sorted_lines '#' prototypes_implemented)
+        @
+        List.map (fun line -> ".structure " ^ line) (sorted_delayed_definition_lines structures_defined)
+        @
+        List.map (fun line -> ".predicate " ^ line) (sorted_delayed_definition_lines nonabstract_predicates)
+        @
+        List.sort compare
+          begin
+            List.map
+              begin fun (fn, lf, ftn, ftargs, unloadable) ->
+                let ((header, _, _), _) = root_caller_token lf in
+                Printf.sprintf
+                  ".provides %s#%s : %s(%s)%s" (qualified_path header) fn ftn (String.concat "," ftargs) (if unloadable then " unloadable" else "")
+              end
+              functypes_implemented
+          end
+        @
+        List.map (fun line -> ".imports module " ^ line)  (sorted_module_lines modules_imported)
+        @
+        [".produces module " ^ !current_module_name]
       in
-      List.sort compare lines
-    in
-    let lines =
-      List.map (fun line -> ".requires " ^ line) (sorted_lines '#' !prototypes_used)
-      @
-      List.map (fun line -> ".provides " ^ line) (sorted_lines '#' prototypes_implemented)
-      @
-      List.map (fun line -> ".structure " ^ line) (sorted_delayed_definition_lines structures_defined)
-      @
-      List.map (fun line -> ".predicate " ^ line) (sorted_delayed_definition_lines nonabstract_predicates)
-      @
-      List.sort compare
-        begin
-          List.map
-            begin fun (fn, lf, ftn, ftargs, unloadable) ->
-              let ((header, _, _), _) = root_caller_token lf in
-              Printf.sprintf
-                ".provides %s#%s : %s(%s)%s" (qualified_path header) fn ftn (String.concat "," ftargs) (if unloadable then " unloadable" else "")
-            end
-            functypes_implemented
-        end
-      @
-      List.map (fun line -> ".imports module " ^ line)  (sorted_module_lines modules_imported)
-      @
-      [".produces module " ^ current_module_name]
+      if emit_manifest then
+        let file = open_out manifest_filename in
+        do_finally (fun () ->
+          List.iter (fun line -> output_string file (line ^ "\n")) lines
+        ) (fun () -> close_out file)
+      else
+        manifest_map := (manifest_filename, lines)::!manifest_map
     in
-    if emit_manifest then
-      let file = open_out manifest_filename in
-      do_finally (fun () ->
-        List.iter (fun line -> output_string file (line ^ "\n")) lines
-      ) (fun () -> close_out file)
-    else
-      manifest_map := (manifest_filename, lines)::!manifest_map
   
-  let () =
     if file_type path <> Java then
       create_manifest_file()
     else
       if Filename.check_suffix path ".jarsrc" then
         create_jardeps_file()
   
+  let () =
+    match !warm_program_hook with
+      Some hook when language = CLang ->
+      warm_program_hook := None;
+      (* Typecheck the prelude and the headers of this main file, by checking the main file without its declarations. *)
+      record_header_sources := true;
+      let headers =
+        try
+          fst (parse_c_file path (fun _ _ -> ()) (fun _ -> ()) options.option_verbose options.option_include_paths options.option_define_macros options.option_enforce_annotations data_model)
+        with _ -> []
+      in
+      ignore (check_file path false true programDir headers [PackageDecl (dummy_loc, "", [], [])]);
+      record_header_sources := false;
+      warm_header_paths := List.map fst !headermap_sources;
+      warm_prelude := true;
+      hook begin fun path ->
+        (* The main file must parse as it would in a fresh process. *)
+        Hashtbl.clear typedefs;
+        verify_main_file path
+      end
+    | _ -> verify_main_file path
+  
 end
 
 (** Verifies the .c/.jarsrc/.scala file at path [path].
@@ -3139,6 +3632,7 @@ let verify_program_core (* ?verify_program_core *)
     ?(emitter_callback : package list -> unit = fun _ -> ())
     (type typenode') (type symbol') (type termnode')  (* Explicit type parameters; new in OCaml 3.12 *)
     (ctxt: (typenode', symbol', termnode') Proverapi.context)
+    (prover_facts: termnode' option list ref)
     (options : options)
     (program_path : string)
     (callbacks : callbacks)
@@ -3146,21 +3640,28 @@ let verify_program_core (* ?verify_program_core *)
     (exportpoint : ((termnode' context list -> unit) * string * int) option)
     (targetPath : int list option) : unit =
 
-  let module VP = VerifyProgram(struct
-    let emitter_callback = emitter_callback
-    type typenode = typenode'
-    type symbol = symbol'
-    type termnode = termnode'
-    let ctxt = ctxt
-    let options = options
-    let program_path = program_path
-    let callbacks = callbacks
-    let breakpoint = breakpoint
-    let exportpoint = exportpoint
-    let targetPath = targetPath
-    let tolerate_errors = match exportpoint with | Some _ -> true | None -> false
-  end) in
-  ()
+  begin match options.option_execution_forest with
+    StreamedForest path -> open_forest_stream path
+  | _ -> ()
+  end;
+  do_finally begin fun () ->
+    let module VP = VerifyProgram(struct
+      let emitter_callback = emitter_callback
+      type typenode = typenode'
+      type symbol = symbol'
+      type termnode = termnode'
+      let ctxt = ctxt
+      let prover_facts = prover_facts
+      let options = options
+      let program_path = program_path
+      let callbacks = callbacks
+      let breakpoint = breakpoint
+      let exportpoint = exportpoint
+      let targetPath = targetPath
+      let tolerate_errors = match exportpoint with | Some _ -> true | None -> false
+    end) in
+    ()
+  end close_forest_stream
 
 (* Region: prover selection *)
 
@@ -3179,12 +3680,103 @@ class virtual ctxt_dumper =
       ('termnode -> string) -> unit
   end
 
+(* Passes all calls on to p; the base class of the wrappers below. *)
+class ['typenode, 'symbol, 'termnode] forwarding_context (p: ('typenode, 'symbol, 'termnode) Proverapi.context) =
+  object
+    inherit ['typenode, 'symbol, 'termnode] Proverapi.context
+    method set_verbosity v = p#set_verbosity v
+    method type_bool = p#type_bool
+    method type_int = p#type_int
+    method type_real = p#type_real
+    method type_inductive = p#type_inductive
+    method mk_boxed_int t = p#mk_boxed_int t
+    method mk_unboxed_int t = p#mk_unboxed_int t
+    method mk_boxed_real t = p#mk_boxed_real t
+    method mk_unboxed_real t = p#mk_unboxed_real t
+    method mk_boxed_bool t = p#mk_boxed_bool t
+    method mk_unboxed_bool t = p#mk_unboxed_bool t
+    method mk_symbol name domain range kind = p#mk_symbol name domain range kind
+    method set_fpclauses s k cs = p#set_fpclauses s k cs
+    method mk_app s ts = p#mk_app s ts
+    method mk_true = p#mk_true
+    method mk_false = p#mk_false
+    method mk_and t1 t2 = p#mk_and t1 t2
+    method mk_or t1 t2 = p#mk_or t1 t2
+    method mk_not t = p#mk_not t
+    method mk_ifthenelse t1 t2 t3 = p#mk_ifthenelse t1 t2 t3
+    method mk_iff t1 t2 = p#mk_iff t1 t2
+    method mk_implies t1 t2 = p#mk_implies t1 t2
+    method mk_eq t1 t2 = p#mk_eq t1 t2
+    method mk_intlit n = p#mk_intlit n
+    method mk_intlit_of_string s = p#mk_intlit_of_string s
+    method mk_add t1 t2 = p#mk_add t1 t2
+    method mk_sub t1 t2 = p#mk_sub t1 t2
+    method mk_mul t1 t2 = p#mk_mul t1 t2
+    method mk_div t1 t2 = p#mk_div t1 t2
+    method mk_mod t1 t2 = p#mk_mod t1 t2
+    method mk_lt t1 t2 = p#mk_lt t1 t2
+    method mk_le t1 t2 = p#mk_le t1 t2
+    method mk_reallit n = p#mk_reallit n
+    method mk_reallit_of_num n = p#mk_reallit_of_num n
+    method mk_real_add t1 t2 = p#mk_real_add t1 t2
+    method mk_real_sub t1 t2 = p#mk_real_sub t1 t2
+    method mk_real_mul t1 t2 = p#mk_real_mul t1 t2
+    method mk_real_lt t1 t2 = p#mk_real_lt t1 t2
+    method mk_real_le t1 t2 = p#mk_real_le t1 t2
+    method pprint t = p#pprint t
+    method pprint_sort tp = p#pprint_sort tp
+    method pprint_sym s = p#pprint_sym s
+    method push = p#push
+    method pop = p#pop
+    method assert_term t = p#assert_term t
+    method assume t = p#assume t
+    method query t = p#query t
+    method stats = p#stats
+    method begin_formal = p#begin_formal
+    method end_formal = p#end_formal
+    method mk_bound i tp = p#mk_bound i tp
+    method assume_forall descr triggers tps body = p#assume_forall descr triggers tps body
+    method simplify t = p#simplify t
+  end
+
+(* With -profile, the push, pop, assume, assert_term and query calls on the prover are profiled as phases of their own. *)
+class ['typenode, 'symbol, 'termnode] profiling_context (p: ('typenode, 'symbol, 'termnode) Proverapi.context) =
+  object
+    inherit ['typenode, 'symbol, 'termnode] forwarding_context p
+    method push = profile_phase "prover push" (fun () -> p#push)
+    method pop = profile_phase "prover pop" (fun () -> p#pop)
+    method assume t = profile_phase "prover assume" (fun () -> p#assume t)
+    method assert_term t = profile_phase "prover assert_term" (fun () -> p#assert_term t)
+    method query t = profile_phase "prover query" (fun () -> p#query t)
+  end
+
+(* With -merge_states, records the facts given to the prover in the current scopes, in facts; see verify_paths_merged. *)
+class ['typenode, 'symbol, 'termnode] fact_recording_context (facts: 'termnode option list ref) (p: ('typenode, 'symbol, 'termnode) Proverapi.context) =
+  object
+    inherit ['typenode, 'symbol, 'termnode] forwarding_context p
+    val mutable scopes = []
+    method push = scopes <- !facts::scopes; p#push
+    method pop = begin match scopes with facts0::scopes0 -> facts := facts0; scopes <- scopes0 | [] -> () end; p#pop
+    method set_fpclauses s k cs = facts := None::!facts; p#set_fpclauses s k cs
+    method assert_term t = facts := Some t::!facts; p#assert_term t
+    method assume t = facts := Some t::!facts; p#assume t
+    method assume_forall descr triggers tps body = facts := None::!facts; p#assume_forall descr triggers tps body
+  end
+
 let default_prover = "Redux"
 
 let prover_table: (string * (string * (prover_client -> Stats.stats))) list ref = ref []
 
-let register_prover name description f =
-  prover_table := (name, (description, f))::!prover_table
+(* The provers that talk to a solver process through a pipe; see verify_program *)
+let external_provers: string list ref = ref []
+
+(* The provers whose terms remain valid after the scope in which they were built is popped, as -merge_states requires *)
+let lasting_term_provers: string list ref = ref []
+
+let register_prover ?(external_process=false) ?(lasting_terms=false) name description f =
+  prover_table := (name, (description, f))::!prover_table;
+  if external_process then external_provers := name::!external_provers;
+  if lasting_terms then lasting_term_provers := name::!lasting_term_provers
 
 let prover_descriptions indent =
   !prover_table
@@ -3221,16 +3813,34 @@ let verify_program (* ?verify_program *)
     (breakpoint : (string * int) option)
     (exportpoint : ((ctxt_dumper * string * int) option))
     (targetPath : int list option) : Stats.stats =
+  let is_among provers = List.exists (fun name -> String.lowercase_ascii name = String.lowercase_ascii prover) provers in
+  (* Worker processes (-jobs) inherit the prover; they cannot share a pipe to a solver process. *)
+  let options =
+    if is_among !external_provers then
+      {options with option_jobs = 1}
+    else
+      options
+  in
+  (* The merged states use terms built in scopes that have been popped. *)
+  let options =
+    if options.option_merge_states && not (is_among !lasting_term_provers) then
+      {options with option_merge_states = false}
+    else
+      options
+  in
   lookup_prover prover
     (object
       method run: 'typenode 'symbol 'termnode. ('typenode, 'symbol, 'termnode) Proverapi.context ->
         ('termnode -> string) -> Stats.stats =
          fun ctxt tnode_to_str -> clear_stats ();
+           let ctxt = if !profiling then (new profiling_context ctxt :> ('typenode, 'symbol, 'termnode) Proverapi.context) else ctxt in
+           let prover_facts = ref [] in
+           let ctxt = if options.option_merge_states then (new fact_recording_context prover_facts ctxt :> ('typenode, 'symbol, 'termnode) Proverapi.context) else ctxt in
            let exportpoint = match exportpoint with
              | Some (dumper,path,line) -> Some ((fun ctxts -> dumper#run ctxts tnode_to_str),path,line)
              | None -> None
            in
-           verify_program_core ~emitter_callback:emitter_callback ctxt options
+           verify_program_core ~emitter_callback:emitter_callback ctxt prover_facts options
              path callbacks breakpoint exportpoint targetPath;
            !stats
      end)
@@ -41,6 +41,111 @@ type 'termnode context =
 type node_type = ExecNode of string * int list | BranchNode | SuccessNode | ErrorNode
 type node = Node of node_type * node list ref
 
+(* How much of the execution forest to record. Only vfide shows the full forest. *)
+type execution_forest_mode =
+  FullForest
+| NoForest
+| ErrorPathForest (* Only the nodes on the path to the error, if any *)
+| StreamedForest of string (* Written to the given file as it is built; see read_execution_forest *)
+
+(* Region: streamed execution forests *)
+
+(* A streamed execution forest is the header followed by the nodes in depth-first order. A node with children
+   is opened by an ExecNode event (the last element of the node's path, followed by its message) or a BranchNode
+   event, and closed by an end event; leaves are SuccessNode and ErrorNode events. Each message is written once
+   and then referred to by number. Nodes that are still open at the end of the file (e.g. after an error) are closed there. *)
+
+let forest_stream_header = "VFEF1"
+
+type forest_stream = {forest_channel: out_channel; forest_messages: (string, int) Hashtbl.t}
+
+let forest_stream: forest_stream option ref = ref None
+
+let open_forest_stream path =
+  let chan = open_out_bin path in
+  output_string chan forest_stream_header;
+  forest_stream := Some {forest_channel = chan; forest_messages = Hashtbl.create 100}
+
+let close_forest_stream () =
+  match !forest_stream with
+    None -> ()
+  | Some s -> close_out s.forest_channel; forest_stream := None
+
+let output_varint chan n =
+  let rec iter n =
+    if n < 0x80 then output_byte chan n else begin output_byte chan (0x80 lor (n land 0x7f)); iter (n lsr 7) end
+  in
+  iter n
+
+let stream_exec_node s branch msg =
+  output_byte s.forest_channel 1;
+  output_varint s.forest_channel branch;
+  match Hashtbl.find_opt s.forest_messages msg with
+    Some id -> output_varint s.forest_channel id
+  | None ->
+    let id = Hashtbl.length s.forest_messages in
+    Hashtbl.add s.forest_messages msg id;
+    output_varint s.forest_channel id;
+    output_varint s.forest_channel (String.length msg);
+    output_string s.forest_channel msg
+
+let stream_branch_node s = output_byte s.forest_channel 2
+let stream_end_node s = output_byte s.forest_channel 3
+let stream_leaf_node s nodeType = output_byte s.forest_channel (match nodeType with ErrorNode -> 5 | _ -> 4)
+
+(* Returns the execution forest in the form in which it is built in memory, for vfide's Load execution forest command.
+   vfide lays the forest out as a whole, so it is read completely. *)
+let read_execution_forest file: node list =
+  let chan = open_in_bin file in
+  let header = try really_input_string chan (String.length forest_stream_header) with End_of_file -> "" in
+  if header <> forest_stream_header then begin close_in chan; failwith (file ^ ": not an execution forest") end;
+  let read_varint () =
+    let rec iter shift n =
+      let c = input_byte chan in
+      let n = n lor ((c land 0x7f) lsl shift) in
+      if c < 0x80 then n else iter (shift + 7) n
+    in
+    iter 0 0
+  in
+  let messages = Hashtbl.create 100 in
+  let forest = ref [] in
+  (* The open nodes, innermost first: their children, the path of the innermost enclosing ExecNode, and whether it is a BranchNode *)
+  let rec iter open_nodes =
+    let (children, path, _) = match open_nodes with n::_ -> n | [] -> (forest, [], false) in
+    match try Some (input_byte chan) with End_of_file -> None with
+      None -> ()
+    | Some 1 ->
+      let branch = read_varint () in
+      let id = read_varint () in
+      let msg =
+        match Hashtbl.find_opt messages id with
+          Some msg -> msg
+        | None -> let n = read_varint () in let msg = really_input_string chan n in Hashtbl.add messages id msg; msg
+      in
+      let path = branch::path in
+      let children' = ref [] in
+      children := Node (ExecNode (msg, path), children')::!children;
+      iter ((children', path, false)::open_nodes)
+    | Some 2 ->
+      let children' = ref [] in
+      children := Node (BranchNode, children')::!children;
+      iter ((children', path, true)::open_nodes)
+    | Some 3 ->
+      begin match open_nodes with
+        [] -> failwith (file ^ ": unbalanced execution forest")
+      | (children, _, is_branch)::open_nodes ->
+        if is_branch && !children = [] then children := [Node (SuccessNode, ref [])];
+        iter open_nodes
+      end
+    | Some (4 | 5 as code) ->
+      children := Node ((if code = 5 then ErrorNode else SuccessNode), ref [])::!children;
+      iter open_nodes
+    | Some code -> failwith (Printf.sprintf "%s: bad execution forest event %d" file code)
+  in
+  begin try iter [] with End_of_file -> close_in chan; failwith (file ^ ": truncated execution forest") | e -> close_in chan; raise e end;
+  close_in chan;
+  !forest
+
 (* Returns the locations of the "call stack" of the current execution step. *)
 let get_callers (ctxts: 'termnode context list): loc option list =
   let rec iter lo ls ctxts =
@@ -143,7 +248,11 @@ type options = {
   option_use_java_frontend : bool;
   option_enforce_annotations : bool;
   option_allow_undeclared_struct_types: bool;
-  option_data_model: data_model
+  option_data_model: data_model;
+  option_cache_dir: string option; (* directory of the verification result cache *)
+  option_jobs: int; (* number of worker processes that verify function bodies in parallel *)
+  option_execution_forest: execution_forest_mode;
+  option_merge_states: bool (* join the symbolic states of the paths through an if or switch statement where possible *)
 } (* ?options *)
 
 (* Region: verify_program_core: the toplevel function *)
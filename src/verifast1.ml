@@ -19,12 +19,19 @@ type callbacks = {
 
 let noop_callbacks = {reportRange = (fun _ _ -> ()); reportUseSite = (fun _ _ _ -> ()); reportExecutionForest = (fun _ -> ()); reportStmt = (fun _ -> ()); reportStmtExec = (fun _ -> ())}
 
+(* Raised when a header's typechecked maps, inherited from a warm process (see warm_program_hook in verifast.ml), do not match
+   what the header or one of its includes declares now; the main file must then be verified in a fresh process. *)
+exception StaleHeaderMaps of string
+
 module type VERIFY_PROGRAM_ARGS = sig
   val emitter_callback: package list -> unit
   type typenode
   type symbol
   type termnode
   val ctxt: (typenode, symbol, termnode) Proverapi.context
+  (** With -merge_states, the facts that ctxt was given in the current scopes, most recent first; None for a fact that is not
+      a term (a quantified axiom or fixpoint clauses). Maintained by a fact_recording_context. *)
+  val prover_facts: termnode option list ref
   val options: options
   val program_path: string
   val callbacks: callbacks
@@ -97,6 +104,8 @@ module VerifyProgram1(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
   let used_ids_undo_stack = ref []
   (** The terms that represent coefficients of leakable chunks. These come from [_] patterns in the source code. *)
   let dummy_frac_terms = ref []
+  (** The terms created for real literals, with their values; see real_lit *)
+  let real_lit_terms: (num * termnode) list ref = ref []
   (** The terms that represent predicate constructor applications. *)
   let pred_ctor_applications : (termnode * (symbol * termnode * (termnode list) * int option)) list ref = ref []
   (** When switching to the next symbolic execution branch, this stack is popped to forget about fresh identifiers generated in the old branch. *)
@@ -148,42 +157,93 @@ module VerifyProgram1(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
   let register_pred_ctor_application t symbol symbol_term ts inputParamCount =
     pred_ctor_applications := (t, (symbol, symbol_term, ts, inputParamCount)) :: !pred_ctor_applications
 
+  let forest_stream () = match !forest_stream with Some s -> s | None -> failwith "Execution forest stream is not open"
+
+  (* Records a leaf of the execution forest *)
+  let push_leaf_node nodeType =
+    match options.option_execution_forest with
+      FullForest -> push (Node (nodeType, ref [])) !currentForest
+    | NoForest -> ()
+    | ErrorPathForest -> if nodeType = ErrorNode then push (Node (nodeType, ref [])) !currentForest
+    | StreamedForest _ -> stream_leaf_node (forest_stream ()) nodeType
+
   let assert_false h env l msg url =
-    push (Node (ErrorNode, ref [])) !currentForest;
+    push_leaf_node ErrorNode;
     raise (SymbolicExecutionError (pprint_context_stack !contextStack, l, msg, url))
 
   let dump_context dumper =
     dumper !contextStack
 
+  (* The branch paths of execution steps are needed only to build the execution forest and to find the target path. *)
+  let track_paths = options.option_execution_forest <> NoForest || !targetPath <> None
+
   let push_node l msg =
-    let oldPath, oldBranch, oldTargetPath = !currentPath, !currentBranch, !targetPath in
-    targetPath :=
-      begin match oldTargetPath with
-        Some (b::bs) ->
-        if b = oldBranch then
-          if bs = [] then
-            assert_false [] [] l "Target branch reached" None
+    if track_paths then begin
+      let oldPath, oldBranch, oldTargetPath = !currentPath, !currentBranch, !targetPath in
+      targetPath :=
+        begin match oldTargetPath with
+          Some (b::bs) ->
+          if b = oldBranch then
+            if bs = [] then
+              assert_false [] [] l "Target branch reached" None
+            else
+              Some bs
           else
-            Some bs
-        else
-          Some []
-      | p -> p
-      end;
-    currentPath := oldBranch::oldPath;
-    currentBranch := 0;
-    push_undo_item (fun () -> currentPath := oldPath; currentBranch := oldBranch + 1; targetPath := oldTargetPath);
-    let newForest = ref [] in
-    let oldForest = !currentForest in
-    push (Node (ExecNode (msg, !currentPath), newForest)) oldForest;
-    push_undo_item (fun () -> currentForest := oldForest);
-    currentForest := newForest
+            Some []
+        | p -> p
+        end;
+      currentPath := oldBranch::oldPath;
+      currentBranch := 0;
+      push_undo_item (fun () -> currentPath := oldPath; currentBranch := oldBranch + 1; targetPath := oldTargetPath);
+      match options.option_execution_forest with
+        NoForest -> ()
+      | StreamedForest _ ->
+        let s = forest_stream () in
+        stream_exec_node s oldBranch msg;
+        push_undo_item (fun () -> stream_end_node s)
+      | mode ->
+        let newForest = ref [] in
+        let oldForest = !currentForest in
+        let node = Node (ExecNode (msg, !currentPath), newForest) in
+        push node oldForest;
+        push_undo_item begin fun () ->
+          currentForest := oldForest;
+          (* Paths that complete without an error are not kept *)
+          if mode = ErrorPathForest then
+            match !oldForest with n::ns when n == node -> oldForest := ns | _ -> ()
+        end;
+        currentForest := newForest
+    end
   
   let success () = SymExecSuccess
 
   let major_success () =  (* A major success is a successful completion of a symbolic execution path that shows up as a green node in the execution tree. *)
-    push (Node (SuccessNode, ref [])) !currentForest;
+    push_leaf_node SuccessNode;
     success ()
 
+  (* Executes [left] and [right] as the two branches of a BranchNode pair *)
+  let forest_branch left right =
+    match options.option_execution_forest with
+      NoForest -> left (); right ()
+    | StreamedForest _ ->
+      let s = forest_stream () in
+      stream_branch_node s; left (); stream_end_node s;
+      stream_branch_node s; right (); stream_end_node s
+    | mode ->
+      let oldForest = !currentForest in
+      let oldNodes = !oldForest in
+      let leftForest = ref [] in
+      let rightForest = ref [] in
+      oldForest := Node (BranchNode, rightForest)::Node (BranchNode, leftForest)::!oldForest;
+      currentForest := leftForest;
+      left ();
+      if !leftForest = [] then leftForest := [Node (SuccessNode, ref [])];
+      currentForest := rightForest;
+      right ();
+      if !rightForest = [] then rightForest := [Node (SuccessNode, ref [])];
+      currentForest := oldForest;
+      if mode = ErrorPathForest then oldForest := oldNodes
+
   let push_context ?(verbosity_level=1) msg =
     contextStack := msg::!contextStack;
     begin match msg with
@@ -212,29 +272,29 @@ module VerifyProgram1(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
     push_contextStack ();
     push_context ~verbosity_level msg;
     let result =
-      if !targetPath <> Some [] then
-        cont()
-      else
-        SymExecSuccess
+      match !targetPath with
+        Some [] -> SymExecSuccess
+      | _ -> cont()
     in
     pop_contextStack ();
     result
   
-  (** Remember the current path condition, set of used IDs, and set of dummy fraction terms. *)  
+  (** Remember the current path condition, set of used IDs, set of dummy fraction terms, and set of real literal terms. *)  
   let push() =
-    used_ids_stack := (!used_ids_undo_stack, !dummy_frac_terms, !pred_ctor_applications)::!used_ids_stack;
+    used_ids_stack := (!used_ids_undo_stack, !dummy_frac_terms, !pred_ctor_applications, !real_lit_terms)::!used_ids_stack;
     used_ids_undo_stack := [];
     ctxt#push;
     push_contextStack ()
   
-  (** Restore the previous path condition, set of used IDs, and set of dummy fraction terms. *)
+  (** Restore the previous path condition, set of used IDs, set of dummy fraction terms, and set of real literal terms. *)
   let pop() =
     pop_contextStack ();
     List.iter (fun r -> decr r) !used_ids_undo_stack;
-    let ((usedIdsUndoStack, dummyFracTerms, predCtorApplications)::t) = !used_ids_stack in
+    let ((usedIdsUndoStack, dummyFracTerms, predCtorApplications, realLitTerms)::t) = !used_ids_stack in
     used_ids_undo_stack := usedIdsUndoStack;
     dummy_frac_terms := dummyFracTerms;
     pred_ctor_applications := predCtorApplications;
+    real_lit_terms := realLitTerms;
     used_ids_stack := t;
     ctxt#pop
   
@@ -388,6 +448,26 @@ module VerifyProgram1(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
   let real_zero = ctxt#mk_reallit 0
   let real_unit = ctxt#mk_reallit 1
   let real_half = ctxt#mk_reallit_of_num (num_of_ints 1 2)
+  let () = real_lit_terms := [(num_of_int 0, real_zero); (num_of_int 1, real_unit); (num_of_ints 1 2, real_half)]
+
+  (* Real literals are shared: each value is represented by a single term, so that coefficients that are literals or
+     products of literals can be recognized and compared without the prover (see match_chunk). *)
+  let real_lit n =
+    let rec iter lits =
+      match lits with
+        [] -> let t = ctxt#mk_reallit_of_num n in real_lit_terms := (n, t)::!real_lit_terms; t
+      | (n', t)::lits -> if eq_num n n' then t else iter lits
+    in
+    iter !real_lit_terms
+
+  (** The value of [t] if it is a term returned by [real_lit] *)
+  let real_lit_value t =
+    let rec iter lits =
+      match lits with
+        [] -> None
+      | (n, t')::lits -> if t' == t then Some n else iter lits
+    in
+    iter !real_lit_terms
 
   let int_zero_term = ctxt#mk_intlit 0
   let int_unit_term = ctxt#mk_intlit 1
@@ -459,12 +539,16 @@ module VerifyProgram1(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
   
   let real_unit_pat = TermPat real_unit
   
-  let current_module_name =
+  let current_module_name_of path =
     match language with
       | Java -> "current_module"
       | CLang -> Filename.chop_extension (Filename.basename path)
   
-  let current_module_term = get_unique_var_symb current_module_name intType
+  (* The main file, and the module it implements; these change if a verification server has a warm process verify another
+     main file (see warm_program_hook in verifast.ml). *)
+  let main_program_path = ref program_path
+  let current_module_name = ref (current_module_name_of path)
+  let current_module_term = ref (get_unique_var_symb !current_module_name intType)
   
   let programDir = Filename.dirname path
   let rtpath = match options.option_runtime with None -> concat (rtdir()) "rt.jarspec" | Some path -> path
@@ -797,6 +881,21 @@ module VerifyProgram1(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
 
   let prelude_maps = ref None
   
+  (* While record_header_sources is set (in a warm process; see warm_program_hook in verifast.ml), for each C header in
+     headermap: whether it was checked as an import spec, the headers it includes, a digest of its declarations, and the time
+     spent typechecking it, excluding its includes *)
+  let record_header_sources = ref false
+  let headermap_sources: (bool * string list * Digest.t * float) map ref = ref []
+  (* Total time spent typechecking headers so far *)
+  let header_check_time = ref 0.0
+  (* The time spent typechecking the prelude *)
+  let prelude_check_time = ref 0.0
+  (* The headers typechecked by a warm process before it forked this process (see warm_program_hook in verifast.ml), and
+     those of them reused so far; and whether the prelude was typechecked by the warm process and not reused yet *)
+  let warm_header_paths: string list ref = ref []
+  let reused_warm_header_paths: string list ref = ref []
+  let warm_prelude = ref false
+  
   (** Verify the .c/.h/.jarsrc/.jarspec file whose headers are given by [headers] and which declares packages [ps].
       As a side-effect, adds all processed headers to the header map.
       Recursively calls itself on headers included by the current file.
@@ -819,6 +918,8 @@ module VerifyProgram1(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
     val dir: string
     val headers: (loc * (include_kind * string * string) * string list * package list) list
     val ps: package list
+    (** The profiling phase of the typechecking of this file, if profiling; CheckFile exits it before symbolic execution. *)
+    val typechecking_frame: profile_frame option
     
     (** For recursive calls. *)
     val check_file: string -> bool -> bool -> string -> (loc * (include_kind * string * string) * string list * package list) list -> package list -> check_file_output * maps
@@ -901,6 +1002,23 @@ module VerifyProgram1(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
        append_nodups abstract_types_map abstract_types_map0 id l "abstract type")
     in
 
+    let is_import_spec_header header_path =
+      Filename.chop_extension (Filename.basename header_path) <> Filename.chop_extension (Filename.basename !main_program_path)
+    in
+    let digest_decls decls = Digest.string (Marshal.to_string decls [Marshal.No_sharing]) in
+    (** Whether the maps of the header at [path] that a warm process computed for an earlier main file, were computed from
+        what the header and its includes declare in [global_headers]. *)
+    let rec header_maps_current global_headers path =
+      not (List.mem path !warm_header_paths) || List.mem path !reused_warm_header_paths ||
+      match try_assoc path !headermap_sources with
+        None -> true
+      | Some (is_import_spec, hs, decls_digest, _) ->
+        match try_find (fun (_, (_, _, total_path), _, _) -> total_path = path) global_headers with
+          None -> false
+        | Some (_, (_, header_path, _), hs', decls') ->
+          is_import_spec = is_import_spec_header header_path && hs' = hs && digest_decls decls' = decls_digest &&
+          List.for_all (header_maps_current global_headers) hs
+    in
     (** [merge_header_maps maps0 headers] returns [maps0] plus all elements transitively declared in [headers]. *)
     let rec merge_header_maps include_prelude maps0 headers_included dir headers global_headers =
       match headers with
@@ -930,10 +1048,10 @@ module VerifyProgram1(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
           if List.mem path headers_included then
             merge_header_maps include_prelude maps0 headers_included dir headers global_headers
           else begin
+            let header_is_import_spec = is_import_spec_header header_path in
             let (headers', maps) =
               match try_assoc path !headermap with
                 None ->
-                let header_is_import_spec = Filename.chop_extension (Filename.basename header_path) <> Filename.chop_extension (Filename.basename program_path) in
                 let (headers', ds) =
                   match language with
                     CLang ->
@@ -963,10 +1081,25 @@ module VerifyProgram1(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
                     let jarspecs = List.map spec_include_for_jar jars in 
                     (jarspecs, ds)
                 in
+                let decls_digest = if !record_header_sources then digest_decls header_decls else "" in
+                let time0 = Perf.time () in
+                let nested_time0 = !header_check_time in
                 let (_, maps) = check_file header_path header_is_import_spec include_prelude (Filename.dirname path) headers' ds in
+                let elapsed = Perf.time () -. time0 in
+                let own_time = elapsed -. (!header_check_time -. nested_time0) in
+                header_check_time := nested_time0 +. elapsed;
                 headermap := (path, (headers', maps))::!headermap;
+                if !record_header_sources then
+                  headermap_sources := (path, (header_is_import_spec, hs, decls_digest, own_time))::!headermap_sources;
                 (headers', maps)
               | Some (headers', maps) ->
+                if List.mem path !warm_header_paths && not (List.mem path !reused_warm_header_paths) then begin
+                  if not (header_maps_current global_headers path) then raise (StaleHeaderMaps path);
+                  reused_warm_header_paths := path::!reused_warm_header_paths;
+                  match try_assoc path !headermap_sources with
+                    Some (_, _, _, own_time) -> !stats#headerMapsReused own_time
+                  | None -> ()
+                end;
                 (headers', maps)
             in
             let path_dir = Filename.dirname path in
@@ -1001,22 +1134,29 @@ module VerifyProgram1(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
           | CLang ->
             begin match !prelude_maps with
               None ->
+              let time0 = Perf.time () in
               let maps =
                 let prelude_path = concat !bindir "prelude.h" in
-                let (prelude_headers, prelude_decls) = parse_header_file prelude_path reportRange reportShouldFail initial_verbosity [] [] enforce_annotations data_model in
+                let (prelude_headers, prelude_decls) = parse_header_file_cached options.option_cache_dir prelude_path reportRange reportShouldFail initial_verbosity [] [] enforce_annotations data_model in
                 let prelude_header_names = List.map (fun (_, (_, _, h), _, _) -> h) prelude_headers in
                 let prelude_headers = (dummy_loc, (AngleBracketInclude, "prelude.h", prelude_path), prelude_header_names, prelude_decls)::prelude_headers in
-                merge_header_maps false maps0 [] !bindir prelude_headers prelude_headers
+                profile_phase "header merging" (fun () -> merge_header_maps false maps0 [] !bindir prelude_headers prelude_headers)
               in
+              prelude_check_time := Perf.time () -. time0;
               prelude_maps := Some maps;
               maps
-            | Some maps -> maps
+            | Some maps ->
+              if !warm_prelude then begin
+                warm_prelude := false;
+                !stats#headerMapsReused !prelude_check_time
+              end;
+              maps
             end
       else
         (maps0, [])
     in
 
-    let (maps, _) = merge_header_maps include_prelude maps0 headers_included dir headers headers in
+    let (maps, _) = profile_phase "header merging" (fun () -> merge_header_maps include_prelude maps0 headers_included dir headers headers) in
     maps
 
   (* Region: structdeclmap, enumdeclmap, inductivedeclmap, modulemap *)
@@ -1646,7 +1786,7 @@ module VerifyProgram1(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
       | _ :: ds -> iter mm ds
     in
     match ps with
-      [PackageDecl(_,"",[],ds)] -> iter [(current_module_name, current_module_term)] ds
+      [PackageDecl(_,"",[],ds)] -> iter [(!current_module_name, !current_module_term)] ds
     | _ when file_type path=Java -> []
 
   let modulemap = modulemap1 @ modulemap0
@@ -1661,7 +1801,7 @@ module VerifyProgram1(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
         begin
           match try_assoc name modulemap with
           | None -> static_error l ("Unknown module '" ^ name ^ "'.") None
-          | Some(module_term) when module_term == current_module_term -> 
+          | Some(module_term) when module_term == !current_module_term -> 
               static_error l ("Cannot import current module.") None
           | Some(module_term) ->
             begin
@@ -2212,6 +2352,16 @@ module VerifyProgram1(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
   
   let field_pred_map = field_pred_map1 @ field_pred_map0
   
+  (** Indexes the map [xys] by key; a key that appears more than once maps to its first binding, as with [List.assoc]. *)
+  let index_map xys =
+    let index = Hashtbl.create (List.length xys) in
+    List.iter (fun (x, y) -> Hashtbl.replace index x y) (List.rev xys);
+    index
+  
+  (* Every points-to assertion that is produced or consumed, e.g. at every call in the callee's contract, looks up its field predicate *)
+  let field_pred_index = index_map field_pred_map
+  let lookup_field_pred fparent fname = Hashtbl.find field_pred_index (fparent, fname)
+  
   let structpreds1: pred_fam_info map = List.map (fun (_, p) -> p) malloc_block_pred_map1 @ List.map (fun (_, p) -> p) field_pred_map1 @ struct_padding_predfams1
   
   let predfammap1 =
@@ -2372,6 +2522,10 @@ module VerifyProgram1(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
   
   let predfammap = predfammap1 @ predfammap0 (* TODO: Check for name clashes here. *)
   
+  (* Likewise, every predicate assertion looks up its predicate family *)
+  let predfam_index = index_map predfammap
+  let try_lookup_predfam g = Hashtbl.find_opt predfam_index g
+  
   let interfmap1 =
     let rec iter_interfs interfmap1_done interfmap1_todo =
       match interfmap1_todo with
@@ -5351,12 +5505,7 @@ let check_if_list_is_defined () =
     | TypedExpr (e, t) -> ev state e cont
     | WidenedParameterArgument e -> ev state e cont
     | RealLit(l, n) ->
-      cont state begin 
-        if eq_num n (num_of_big_int unit_big_int) then
-        real_unit
-            else
-        ctxt#mk_reallit_of_num n
-      end
+      cont state (real_lit n)
     | WIntLit (l, n) ->
       let v =
         match int_of_big_int n with
@@ -5425,7 +5574,12 @@ let check_if_list_is_defined () =
           | RealLit (l, n) -> n
           | _ -> static_error (expr_loc e) "The denominator of a division must be a literal." None
         in
-        ev state e1 $. fun state v1 -> cont state (ctxt#mk_real_mul v1 (ctxt#mk_reallit_of_num (div_num (num_of_int 1) (eval_reallit e2)))) 
+        let d = div_num (num_of_int 1) (eval_reallit e2) in
+        ev state e1 $. fun state v1 ->
+        cont state begin match real_lit_value v1 with
+          Some n -> real_lit (mult_num n d)
+        | None -> ctxt#mk_real_mul v1 (real_lit d)
+        end
       end
     | WOperation (l, BitAnd, [e1; WIntLit(_, i)], _) when le_big_int zero_big_int i && ass_term <> None -> (* optimization *)
       ev state e1 $. fun state v1 ->
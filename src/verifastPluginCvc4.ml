@@ -3,7 +3,7 @@ module S = Smtlib
 module P = Proverapi
 
 let _ =
-  Verifast.register_prover "CVC4"
+  Verifast.register_prover ~external_process:true "CVC4"
     "(experimental) the CVC4 theorem prover. (Does not ship with VeriFast; make sure the 'cvc4' command is in your PATH.)"
     (
       fun client ->
@@ -3,7 +3,7 @@ module S = Smtlib
 module P = Proverapi
 
 let _ =
-  Verifast.register_prover "ext_z3"
+  Verifast.register_prover ~external_process:true "ext_z3"
     "(experimental) runs Z3 as an external prover. This is to measure the impact of communicating with Z3 using a pipe instead of the API. This is also more portable."
     (
       fun client ->
@@ -1,5 +1,5 @@
 let _ =
-  Verifast.register_prover "Redux"
+  Verifast.register_prover ~lasting_terms:true "Redux"
     "the built-in Redux theorem prover. A partial re-implementation in OCaml by the VeriFast team of the Simplify theorem prover [Detlefs, Nelson, and Saxe]."
     (
       fun client ->
@@ -22,3 +22,41 @@ let _ =
       client#run (C.combine redux_ctxt smtlib_ctxt C.Sync)
     )
 *)
+
+let _ =
+  Verifast.register_prover ~external_process:true "redux|z3"
+    "(experimental) race Redux against Z3, which works on the same question in the background, as an external process; the first prover to prove it wins, and Redux gives up when Z3 proves it first. (Does not ship with VeriFast; make sure the 'z3' command is in your PATH.)"
+    (
+      fun client ->
+      let redux_ctxt =
+        (new R.context ():
+           R.context :> (unit, R.symbol, (R.symbol, R.termnode) R.term) P.context)
+      in
+      let z3_ctxt =
+        Sp.external_smtlib_async_ctxt
+          "z3 -in -smt2 smt.auto_config=false smt.mbqi=false auto_config=false model=false type_check=true well_sorted_check=true"
+          ["z3"; "I"; "Q"; "NDT"; "LIA"; "LRA"]
+      in
+      let ctxt = C.portfolio redux_ctxt z3_ctxt in
+      let termnode_to_string tn = ctxt#pprint tn in
+      client#run ctxt termnode_to_string
+    )
+
+let _ =
+  Verifast.register_prover ~external_process:true "Redux+ext_z3"
+    "(experimental) run Redux, and Z3 as an external process if Redux does not prove an assumption or query (within -prover_time_budget seconds, if given). (Does not ship with VeriFast; make sure the 'z3' command is in your PATH.)"
+    (
+      fun client ->
+      let redux_ctxt =
+        (new R.context ():
+           R.context :> (unit, R.symbol, (R.symbol, R.termnode) R.term) P.context)
+      in
+      let z3_ctxt =
+        Sp.external_smtlib_ctxt
+          "z3 -in -smt2 smt.auto_config=false smt.mbqi=false auto_config=false model=false type_check=true well_sorted_check=true"
+          ["z3"; "I"; "Q"; "NDT"; "LIA"; "LRA"]
+      in
+      let ctxt = C.combine redux_ctxt z3_ctxt C.Sequence in
+      let termnode_to_string tn = ctxt#pprint tn in
+      client#run ctxt termnode_to_string
+    )
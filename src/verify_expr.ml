@@ -1392,7 +1392,7 @@ module VerifyExpr(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
             consume_c_object l (field_address l addr sn f) t h true $. fun h ->
             iter h fields
           | _ ->
-             let (_, (_, _, _, _, f_symb, _, _)) = List.assoc (sn, f) field_pred_map in
+             let (_, (_, _, _, _, f_symb, _, _)) = lookup_field_pred sn f in
              consume_chunk rules h [] [] [] l (f_symb, true) [] real_unit (TermPat(real_unit)) (Some 1) [TermPat addr; dummypat] $.
              (fun chunk h coef [_; t] size ghostenv env env' -> iter h fields)
       in
@@ -1737,6 +1737,31 @@ module VerifyExpr(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
     | WMatchAsn (_, _, _, _) -> false
     | _ -> true
 
+  (* Region: callee summaries *)
+  
+  (* The work at a call that depends only on the callee: finding its FuncInfo in the function map, and checking whether its
+     precondition asserts exclusive ownership. Functions such as mutex_acquire are called from many places, often in loops,
+     so this is done once per callee of the global function map. Local lemma functions extend the global function map within
+     their block; that extension is short and is searched first, like List.assoc would. *)
+  let global_callee_index =
+    lazy begin
+      let index = Hashtbl.create (List.length funcmap) in
+      funcmap |> List.rev |> List.iter begin fun (g, (FuncInfo (_, _, _, _, _, _, _, _, pre, _, _, _, _, _, _, _) as info)) ->
+        Hashtbl.replace index g (info, lazy (asserts_exclusive_ownership pre))
+      end;
+      index
+    end
+  
+  let lookup_callee funcmap' g =
+    let rec iter fmap =
+      if fmap == funcmap then Hashtbl.find (Lazy.force global_callee_index) g else
+      match fmap with
+        [] -> raise Not_found
+      | (g', (FuncInfo (_, _, _, _, _, _, _, _, pre, _, _, _, _, _, _, _) as info))::fmap ->
+        if g' = g then (info, lazy (asserts_exclusive_ownership pre)) else iter fmap
+    in
+    iter funcmap'
+
   let rec verify_expr readonly (pn,ilist) tparams pure leminfo funcmap sizemap tenv ghostenv h env xo e cont econt =
     let (envReadonly, heapReadonly) = readonly in
     let verify_expr readonly h env xo e cont = verify_expr readonly (pn,ilist) tparams pure leminfo funcmap sizemap tenv ghostenv h env xo e (fun h env v -> cont h env v) econt in
@@ -1793,7 +1818,7 @@ module VerifyExpr(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
       match lhs with
         WVar (l, x, scope) -> cont h env (LValues.Var (l, x, scope))
       | WRead (l, w, fparent, fname, tp, fstatic, fvalue, fghost) ->
-        let (_, (_, _, _, _, f_symb, _, _)) = List.assoc (fparent, fname) field_pred_map in
+        let (_, (_, _, _, _, f_symb, _, _)) = lookup_field_pred fparent fname in
         begin fun cont ->
           if fstatic then
             cont h env None
@@ -2103,8 +2128,8 @@ module VerifyExpr(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
       in
       check_correct h None None [] args (lm, [], rt, xmap, [], pre, post, Some epost, terminates, v) is_upcall (Some supercn) cont
     | WFunCall (l, g, targs, es) ->
-      let FuncInfo (funenv, fterm, lg, k, tparams, tr, ps, nonghost_callers_only, pre, pre_tenv, post, terminates, functype_opt, body, fbf, v) = List.assoc g funcmap in
-      if heapReadonly && language = CLang && not (startswith g "vf__") && asserts_exclusive_ownership pre then has_heap_effects ();
+      let (FuncInfo (funenv, fterm, lg, k, tparams, tr, ps, nonghost_callers_only, pre, pre_tenv, post, terminates, functype_opt, body, fbf, v), exclusive_pre) = lookup_callee funcmap g in
+      if heapReadonly && language = CLang && not (startswith g "vf__") && Lazy.force exclusive_pre then has_heap_effects ();
       if body = None then register_prototype_used lg g fterm;
       if pure && k = Regular then static_error l "Cannot call regular functions in a pure context." None;
       if not pure && is_lemma k then static_error l "Cannot call lemma functions in a non-pure context." None;
@@ -2163,7 +2188,7 @@ module VerifyExpr(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
         StaticArrayType (elemTp, elemCount) ->
         cont h env (field_address l t fparent fname)
       | _ ->
-      let (_, (_, _, _, _, f_symb, _, _)) = List.assoc (fparent, fname) field_pred_map in
+      let (_, (_, _, _, _, f_symb, _, _)) = lookup_field_pred fparent fname in
       begin match lookup_points_to_chunk_core h f_symb t with
         None -> (* Try the heavyweight approach; this might trigger a rule (i.e. an auto-open or auto-close) and rewrite the heap. *)
         get_points_to h t f_symb l $. fun h coef v ->
@@ -2172,7 +2197,7 @@ module VerifyExpr(VerifyProgramArgs: VERIFY_PROGRAM_ARGS) = struct
       end
       end
     | WRead (l, _, fparent, fname, frange, true (* is static? *), fvalue, fghost) when ! fvalue = None || ! fvalue = Some None->
-      let (_, (_, _, _, _, f_symb, _, _)) = List.assoc (fparent, fname) field_pred_map in
+      let (_, (_, _, _, _, f_symb, _, _)) = lookup_field_pred fparent fname in
       consume_chunk rules h [] [] [] l (f_symb, true) [] real_unit dummypat (Some 0) [dummypat] (fun chunk h coef [field_value] size ghostenv _ _ ->
         cont (chunk :: h) env field_value)
     | WReadArray (l, arr, elem_tp, i) when language = Java ->
@@ -31,7 +31,37 @@ let dump_context_to_file file ctxts termnode_to_string =
   flush outfile;
   close_out outfile
 
-let _ =
+(* Makes every prover record the calls that VeriFast makes on it in the file !trace_path; see provertrace.ml. *)
+let trace_prover_calls (trace_path: string ref) =
+  prover_table :=
+    List.map
+      begin fun (name, (description, f)) ->
+        (name, (description, fun (client: prover_client) ->
+           f (object
+             method run: 'typenode 'symbol 'termnode. ('typenode, 'symbol, 'termnode) Proverapi.context ->
+               ('termnode -> string) -> Stats.stats =
+               fun ctxt _ ->
+                 let tracing_ctxt = new Provertrace.tracing_context ctxt (open_out_bin !trace_path) in
+                 let result =
+                   try
+                     client#run (tracing_ctxt :> (_, _, _) Proverapi.context) tracing_ctxt#pprint
+                   with e -> tracing_ctxt#close; raise e
+                 in
+                 tracing_ctxt#close;
+                 result
+           end)))
+      end
+      !prover_table
+
+(* Set in a verification server's warm process (see serve below) to the function that serves the requests for its
+   configuration, given the prover, the options, and the function that verifies a main file once the prover has been set up
+   and the prelude has been typechecked *)
+let warm_process_hook: (string -> options -> (string -> unit) -> unit) option ref = ref None
+
+(* Set in a request handler forked from a warm process to the warm process's prover, options, and main file verifier *)
+let warm_verifier: (string * options * (string -> unit)) option ref = ref None
+
+let main (argv: string array) =
   let print_msg l msg =
     print_endline (string_of_loc l ^ ": " ^ msg)
   in
@@ -42,6 +72,11 @@ let _ =
       Java_frontend_bridge.unload();
       exit l
     in
+    (* Whether a warm process's state does not lack anything this verification needs (see warm_verifier) *)
+    let verify_warm =
+      Filename.check_suffix path ".c" && breakpoint_lino = None && export_lino = None &&
+      not emitHighlightedSourceFiles && not dumpPerLineStmtExecCounts
+    in
     try
       let reportStmt, reportStmtExec, dumpPerLineStmtExecCounts =
         if dumpPerLineStmtExecCounts then
@@ -97,8 +132,27 @@ let _ =
                 path,lino)
         | None -> None
       in
-      let stats = verify_program ~emitter_callback:emitter_callback prover options path callbacks
-          my_breakpoint my_exportpoint None in
+      let stats =
+        match !warm_verifier with
+          Some (prover', options', verify_main_file) when prover' = prover && options' = options && verify_warm ->
+          warm_verifier := None;
+          begin try
+            verify_main_file path;
+            !Stats.stats
+          with Verifast1.StaleHeaderMaps _ ->
+            verify_program ~emitter_callback:emitter_callback prover options path callbacks my_breakpoint my_exportpoint None
+          end
+        | _ ->
+          begin match !warm_process_hook with
+            (* Forks of a warm process would share the pipe to an external solver process. *)
+            Some hook when not (List.exists (fun name -> String.lowercase_ascii name = String.lowercase_ascii prover) !external_provers) ->
+            warm_process_hook := None; warm_program_hook := Some (hook prover options)
+          | Some _ -> exit 0 (* This process cannot be a warm process. *)
+          | None -> ()
+          end;
+          verify_program ~emitter_callback:emitter_callback prover options path callbacks
+            my_breakpoint my_exportpoint None
+      in
       dumpPerLineStmtExecCounts ();
       if print_stats then stats#printStats;
       print_endline ("0 errors found (" ^ (string_of_int (stats#getStmtExec)) ^ " statements verified)");
@@ -256,6 +310,12 @@ let _ =
   let enforceAnnotations = ref false in
   let allowUndeclaredStructTypes = ref false in
   let dataModel = ref data_model_32bit in
+  let cacheDir: string option ref = ref None in
+  let jobs = ref 1 in
+  let proverTrace = ref "" in
+  let profilePath = ref "" in
+  let executionForest = ref NoForest in
+  let mergeStates = ref false in
   let vroots = ref [Util.crt_vroot Util.default_bindir] in
   let add_vroot vroot =
     let (root, expansion) = Util.split_around_char vroot '=' in
@@ -318,6 +378,17 @@ let _ =
             ; "-enforce_annotations", Unit (fun _ -> (enforceAnnotations := true)), " "
             ; "-allow_undeclared_struct_types", Unit (fun () -> (allowUndeclaredStructTypes := true)), " "
             ; "-target", String (fun s -> dataModel := data_model_of_string s), "Target platform of the program being verified. Determines the size of pointer and integer types. Supported targets: " ^ String.concat ", " (List.map fst data_models)
+            ; "-cache", String (fun dir -> cacheDir := Some dir), "Keep parsed prelude headers and the results of function verifications in the specified directory, and skip the verification of functions that verified before in an unchanged context."
+            ; "-jobs", Set_int jobs, "Verify function bodies in the specified number of parallel worker processes. Ignored for provers that run as an external process."
+            ; "-prover_trace", String (fun path -> if !proverTrace = "" then trace_prover_calls proverTrace; proverTrace := path), "Write the calls that VeriFast makes on the prover to the specified file, for replaying with vfprover-replay. Implies -jobs 1."
+            ; "-profile", String (fun path -> if !profilePath = "" then begin Stats.start_profiling (); at_exit (fun () -> Stats.write_profile !profilePath) end; profilePath := path), "Write a profile of the verification (time, calls and allocation per phase: parsing, typechecking, the symbolic execution of each function, produce/consume, prover calls, ...) to the specified file in JSON format. Implies -jobs 1."
+            ; "-execution_forest", Symbol (["off"; "errors"; "full"], fun s -> executionForest := List.assoc s ["off", NoForest; "errors", ErrorPathForest; "full", FullForest]), " Which part of the execution forest (the tree of symbolic execution steps that vfide shows) to keep in memory: none (the default), only the path to the error, or all of it."
+            ; "-execution_forest_stream", String (fun path -> executionForest := StreamedForest path), "Write the execution forest to the specified file while it is being built, instead of keeping it in memory. Implies -jobs 1."
+            ; "-merge_states", Set mergeStates, "Where the paths through an if or switch statement end in heaps with the same chunks, verify the rest of the block once, for a merged state, instead of once per path. Supported by Redux only; ignored for other provers."
+            ; "-simplex_bounds", Set Simplex.propagate_bounds, "Let Redux's Simplex derive implied bounds and constants after each assertion (bound propagation)."
+            ; "-prover_time_budget", Float (fun seconds -> Combineprovers.sequence_time_budget := seconds), "For provers that run two provers in sequence: the number of seconds after which the first prover gives up on an assumption or query and the second prover takes over. Redux checks the budget before each case split."
+            ; "-server", Unit (fun () -> raise (Bad "-server <socket> must be the only option")), "<socket> (only option) Keep running and verify the command lines sent by 'verifast -client <socket> ...' to the specified Unix domain socket."
+            ; "-client", Unit (fun () -> raise (Bad "-client <socket> must be the first option")), "<socket> (first option) Have the server listening on the specified socket process the remaining arguments; runs them locally if no server is listening."
             ]
   in
   let process_file filename =
@@ -342,7 +413,11 @@ let _ =
           option_use_java_frontend = !useJavaFrontend;
           option_enforce_annotations = !enforceAnnotations;
           option_allow_undeclared_struct_types = !allowUndeclaredStructTypes;
-          option_data_model = !dataModel
+          option_data_model = !dataModel;
+          option_cache_dir = !cacheDir;
+          option_jobs = (match !executionForest with StreamedForest _ -> 1 | _ -> if !proverTrace = "" && !profilePath = "" then !jobs else 1);
+          option_execution_forest = !executionForest;
+          option_merge_states = !mergeStates
         } in
         print_endline filename;
         let emitter_callback (packages : package list) =
@@ -379,7 +454,7 @@ let _ =
     Verifast.banner ()
     ^ "\nUsage: verifast [options] {sourcefile|objectfile}\n"
   in
-  if Array.length Sys.argv = 1
+  if Array.length argv = 1
   then usage cla usage_string
   else begin
     let process_file filename =
@@ -388,7 +463,12 @@ let _ =
       if !verbose = -1 then Printf.printf "%10.6fs: done with file %s\n\n" (Perf.time()) filename;
       result
     in
-    parse cla process_file usage_string;
+    begin try
+      parse_argv ~current:(ref 0) argv cla process_file usage_string
+    with
+      Bad msg -> prerr_string msg; exit 2
+    | Help msg -> print_string msg; exit 0
+    end;
     if not !compileOnly then
       begin
         try
@@ -412,3 +492,241 @@ let _ =
           | CompilationError msg -> print_endline ("error: " ^ msg); exit 1
       end
   end
+
+(* Server mode. 'verifast -server <socket>' keeps running and verifies the command lines that
+   'verifast -client <socket> ...' sends to it. Each request runs in a fresh fork of a process that already did the work the
+   request shares with earlier ones, so requests cannot affect each other, but they skip process startup and find the prelude
+   already parsed. A request that verifies a single C file is forked from a warm process for its configuration (the rest of its
+   command line), which has also set up the prover and typechecked the prelude. *)
+
+type server_message =
+  ServerOutput of string (* A chunk of the request's standard output *)
+| ServerError of string (* A chunk of the request's standard error *)
+| ServerExit of int
+
+let send_message out_chan msg = try output_value out_chan msg; flush out_chan with Sys_error _ -> ()
+
+(* Accepts connections on [socket] forever. For each, [prepare connection] runs in this process and returns the function
+   that then handles the connection in a process of its own. *)
+let accept_forever socket prepare =
+  while true do
+    match (try Some (Unix.accept socket) with Unix.Unix_error (Unix.EINTR, _, _) -> None) with
+      None -> ()
+    | Some (connection, _) ->
+      let handle = try prepare connection with _ -> (fun () -> ()) in
+      flush stdout;
+      flush stderr;
+      match Unix.fork () with
+        0 ->
+        Unix.close socket;
+        (* Fork again so that this process need not reap the handlers. *)
+        if Unix.fork () <> 0 then exit 0;
+        begin try handle () with _ -> () end;
+        exit 0
+      | pid ->
+        Unix.close connection;
+        ignore (Unix.waitpid [] pid)
+  done
+
+(* Runs the command line [argv] in a fork of this process, in directory [cwd], and sends its standard output, its standard
+   error and its exit code over [out_chan]; returns the exit code. *)
+let run_request out_chan cwd argv =
+  let (stdout_out, stdout_in) = Unix.pipe () in
+  let (stderr_out, stderr_in) = Unix.pipe () in
+  flush stdout;
+  flush stderr;
+  match Unix.fork () with
+    0 ->
+    Unix.close stdout_out;
+    Unix.close stderr_out;
+    Unix.dup2 stdout_in Unix.stdout;
+    Unix.dup2 stderr_in Unix.stderr;
+    Unix.close stdout_in;
+    Unix.close stderr_in;
+    begin try
+      Sys.chdir cwd;
+      main argv
+    with e ->
+      prerr_endline ("Exception: " ^ Printexc.to_string e);
+      exit 2
+    end;
+    exit 0
+  | pid ->
+    Unix.close stdout_in;
+    Unix.close stderr_in;
+    let buffer = Bytes.create 4096 in
+    (* Relays what is available on a ready pipe; returns whether the pipe is still open *)
+    let relay_chunk pipe =
+      match (try Unix.read pipe buffer 0 (Bytes.length buffer) with Unix.Unix_error (Unix.EINTR, _, _) -> -1) with
+        0 -> Unix.close pipe; false
+      | -1 -> true
+      | n ->
+        let chunk = Bytes.sub_string buffer 0 n in
+        send_message out_chan (if pipe = stdout_out then ServerOutput chunk else ServerError chunk);
+        true
+    in
+    let rec relay pipes =
+      if pipes <> [] then
+        match (try Some (Unix.select pipes [] [] (-1.0)) with Unix.Unix_error (Unix.EINTR, _, _) -> None) with
+          None -> relay pipes
+        | Some (ready, _, _) -> relay (List.filter (fun pipe -> not (List.mem pipe ready) || relay_chunk pipe) pipes)
+    in
+    relay [stdout_out; stderr_out];
+    let code = match snd (Unix.waitpid [] pid) with Unix.WEXITED code -> code | _ -> 2 in
+    send_message out_chan (ServerExit code);
+    code
+
+(* The requests that a warm process serves have its prover and options; see warm_process_hook. *)
+let serve_warm_requests socket prover options verify_main_file =
+  accept_forever socket begin fun connection ->
+    let (cwd, argv) = (input_value (Unix.in_channel_of_descr connection): string * string array) in
+    fun () ->
+      warm_verifier := Some (prover, options, verify_main_file);
+      ignore (run_request (Unix.out_channel_of_descr connection) cwd argv)
+  end
+
+(* The configuration of the warm process that can serve the command line [argv], if any: the command line without its main
+   file. A command line qualifies if it verifies a single C file and has none of the options whose state the warm process
+   would have set up for the wrong main file. *)
+let warm_configuration argv =
+  let args = List.tl (Array.to_list argv) in
+  let is_main_file arg = Filename.check_suffix arg ".c" in
+  let disqualifying_options = [
+    "-emit_highlighted_source_files"; "-dump_per_line_stmt_exec_counts"; "-breakpoint"; "-context_export_file"; "-exportpoint";
+    "-emit_sexpr"; "-emit_sexpr_fail"; "-javac"; "-prover_trace"; "-profile"; "-execution_forest_stream"
+  ] in
+  match List.filter is_main_file args with
+    [_] when not (List.exists (fun arg -> List.mem arg disqualifying_options) args) ->
+    Some (String.concat "\000" (List.filter (fun arg -> not (is_main_file arg)) args))
+  | _ -> None
+
+(* Passes the request to the warm process listening on [warm_socket_path], and relays its messages over [out_chan]. Returns
+   the request's exit code, or None if the warm process did not take the request, in which case nothing was relayed. *)
+let forward_request out_chan warm_socket_path cwd argv =
+  let socket = Unix.socket Unix.PF_UNIX Unix.SOCK_STREAM 0 in
+  match (try Unix.connect socket (Unix.ADDR_UNIX warm_socket_path); true with Unix.Unix_error _ -> false) with
+    false -> Unix.close socket; None
+  | true ->
+    let in_chan = Unix.in_channel_of_descr socket in
+    send_message (Unix.out_channel_of_descr socket) (cwd, argv);
+    let rec relay relayed =
+      match (try Some (input_value in_chan: server_message) with End_of_file | Sys_error _ -> None) with
+        Some (ServerExit code as msg) -> send_message out_chan msg; Some code
+      | Some msg -> send_message out_chan msg; relay true
+      | None when relayed ->
+        send_message out_chan (ServerError "Error: the warm verification process died.\n");
+        send_message out_chan (ServerExit 2);
+        Some 2
+      | None -> None
+    in
+    let result = relay false in
+    close_in in_chan;
+    result
+
+let serve socket_path =
+  Parser.keep_parsed_headers_in_memory := true;
+  List.iter begin fun (_, dataModel) ->
+    try
+      ignore (parse_header_file_cached None (Filename.concat !Util.bindir "prelude.h") (fun _ _ -> ()) (fun _ -> ()) 0 [] [] false dataModel)
+    with _ -> ()
+  end data_models;
+  Sys.set_signal Sys.sigpipe Sys.Signal_ignore;
+  begin try Unix.unlink socket_path with Unix.Unix_error _ -> () end;
+  let socket = Unix.socket Unix.PF_UNIX Unix.SOCK_STREAM 0 in
+  Unix.bind socket (Unix.ADDR_UNIX socket_path);
+  Unix.listen socket 16;
+  print_endline ("Listening on " ^ socket_path);
+  (* The warm processes: configuration -> (pid, socket path); a configuration whose warm process exited is served cold. *)
+  let warm_processes = Hashtbl.create 16 in
+  let cold_configurations = Hashtbl.create 16 in
+  let warm_process_count = ref 0 in
+  (* Starts a warm process for [configuration], which sets itself up by starting to verify the command line [argv]. Its
+     socket exists before this returns, so requests queue up while it warms up. *)
+  let start_warm_process connection configuration cwd argv =
+    incr warm_process_count;
+    let warm_socket_path = socket_path ^ "." ^ string_of_int !warm_process_count in
+    begin try Unix.unlink warm_socket_path with Unix.Unix_error _ -> () end;
+    let warm_socket = Unix.socket Unix.PF_UNIX Unix.SOCK_STREAM 0 in
+    Unix.bind warm_socket (Unix.ADDR_UNIX warm_socket_path);
+    Unix.listen warm_socket 16;
+    flush stdout;
+    flush stderr;
+    match Unix.fork () with
+      0 ->
+      Unix.close socket;
+      Unix.close connection;
+      let null = Unix.openfile "/dev/null" [Unix.O_RDWR] 0 in
+      Unix.dup2 null Unix.stdout;
+      Unix.dup2 null Unix.stderr;
+      Unix.close null;
+      warm_process_hook := Some (serve_warm_requests warm_socket);
+      (* Does not return if the prover and the prelude get set up; if not, requests fall back to running cold. *)
+      begin try Sys.chdir cwd; main argv with _ -> () end;
+      exit 0
+    | pid ->
+      Unix.close warm_socket;
+      Hashtbl.replace warm_processes configuration (pid, warm_socket_path);
+      Some warm_socket_path
+  in
+  let find_warm_process connection configuration cwd argv =
+    if Hashtbl.mem cold_configurations configuration then None else
+    match Hashtbl.find_opt warm_processes configuration with
+      None -> start_warm_process connection configuration cwd argv
+    | Some (pid, warm_socket_path) ->
+      if (try fst (Unix.waitpid [Unix.WNOHANG] pid) = 0 with Unix.Unix_error _ -> false) then
+        Some warm_socket_path
+      else begin
+        Hashtbl.remove warm_processes configuration;
+        Hashtbl.replace cold_configurations configuration ();
+        (try Unix.unlink warm_socket_path with Unix.Unix_error _ -> ());
+        None
+      end
+  in
+  accept_forever socket begin fun connection ->
+    let (cwd, argv) = (input_value (Unix.in_channel_of_descr connection): string * string array) in
+    let warm_socket_path =
+      match warm_configuration argv with
+        None -> None
+      | Some configuration -> find_warm_process connection configuration cwd argv
+    in
+    fun () ->
+      let time0 = Unix.gettimeofday () in
+      let out_chan = Unix.out_channel_of_descr connection in
+      let (code, mode) =
+        match warm_socket_path with
+          None -> (run_request out_chan cwd argv, "cold")
+        | Some warm_socket_path ->
+          match forward_request out_chan warm_socket_path cwd argv with
+            Some code -> (code, "warm")
+          | None -> (run_request out_chan cwd argv, "cold")
+      in
+      Printf.printf "%s: exit code %d, %s, %.3fs\n" (String.concat " " (List.tl (Array.to_list argv))) code mode (Unix.gettimeofday () -. time0)
+  end
+
+let run_client socket_path args =
+  let argv = Array.of_list (Sys.executable_name::args) in
+  let socket = Unix.socket Unix.PF_UNIX Unix.SOCK_STREAM 0 in
+  match (try Unix.connect socket (Unix.ADDR_UNIX socket_path); true with Unix.Unix_error _ -> false) with
+    false ->
+    (* No server is listening; do the work ourselves. *)
+    Unix.close socket;
+    main argv
+  | true ->
+    let in_chan = Unix.in_channel_of_descr socket in
+    let out_chan = Unix.out_channel_of_descr socket in
+    output_value out_chan (Sys.getcwd (), argv);
+    flush out_chan;
+    let rec receive () =
+      match (try Some (input_value in_chan: server_message) with End_of_file -> None) with
+        Some (ServerOutput s) -> print_string s; flush stdout; receive ()
+      | Some (ServerError s) -> prerr_string s; flush stderr; receive ()
+      | Some (ServerExit code) -> exit code
+      | None -> print_endline "Error: the verification server closed the connection."; exit 1
+    in
+    receive ()
+
+let () =
+  match Array.to_list Sys.argv with
+    [_; "-server"; socket_path] -> serve socket_path
+  | _::"-client"::socket_path::args -> run_client socket_path args
+  | _ -> main Sys.argv
@@ -269,6 +269,7 @@ let show_ide initialPath prover codeFont traceFont runtime layout javaFrontend e
       GAction.add_toggle_action "UseJavaFrontend" ~label:"Use the Java frontend" ~active:(toggle_java_frontend javaFrontend; javaFrontend) ~callback:(fun toggleAction -> toggle_java_frontend toggleAction#get_active);
       GAction.add_toggle_action "SimplifyTerms" ~label:"Simplify Terms" ~active:true ~callback:(fun toggleAction -> simplifyTerms := toggleAction#get_active);
       a "Include paths" ~label:"_Include paths...";
+      a "LoadExecutionForest" ~label:"_Load execution forest..." ~tooltip:"Show an execution forest written by 'verifast -execution_forest_stream'";
       a "Find file (top window)" ~label:"Find file (_top window)..." ~stock:`FIND ~accel:"<Shift>F7";
       a "Find file (bottom window)" ~label:"Find _file (bottom window)..." ~stock:`FIND ~accel:"F7";
       a "VerifyProgram" ~label:"Verify program" ~stock:`MEDIA_PLAY ~accel:"F5" ~tooltip:"Verify";
@@ -326,6 +327,8 @@ let show_ide initialPath prover codeFont traceFont runtime layout javaFrontend e
           <menuitem action='UseJavaFrontend' />
           <menuitem action='SimplifyTerms' />
           <menuitem action='Include paths' />
+          <separator />
+          <menuitem action='LoadExecutionForest' />
         </menu>
         <menu action='TopWindow'>
            <menuitem action='Stub' />
@@ -1241,6 +1244,14 @@ let show_ide initialPath prover codeFont traceFont runtime layout javaFrontend e
       if not (close_all ()) then
       ignore (open_path thePath)
   );
+  ignore $. (actionGroup#get_action "LoadExecutionForest")#connect#activate (fun _ ->
+    match GToolbox.select_file ~title:"Load execution forest" () with
+      None -> ()
+    | Some thePath ->
+      match try Some (read_execution_forest thePath) with Failure msg | Sys_error msg -> GToolbox.message_box "VeriFast IDE" ("Could not load execution forest: " ^ msg); None with
+        None -> ()
+      | Some forest -> reportExecutionForest forest
+  );
   ignore $. (actionGroup#get_action "Save")#connect#activate (fun () -> match get_current_tab() with Some tab -> ignore $. save tab | None -> ());
   ignore $. (actionGroup#get_action "SaveAs")#connect#activate (fun () -> match get_current_tab() with Some tab -> ignore $. saveAs tab | None -> ());
   ignore $. (actionGroup#get_action "Close")#connect#activate (fun () -> match get_current_tab() with Some tab -> ignore $. close tab | None -> ());
@@ -1420,6 +1431,10 @@ let show_ide initialPath prover codeFont traceFont runtime layout javaFrontend e
                 option_enforce_annotations = enforceAnnotations;
                 option_allow_undeclared_struct_types = allowUndeclaredStructTypes;
                 option_data_model = dataModel;
+                option_cache_dir = None;
+                option_jobs = 1;
+                option_execution_forest = FullForest;
+                option_merge_states = false;
                 option_allow_should_fail = true;
                 option_emit_manifest = false;
                 option_vroots = [crt_vroot default_bindir];
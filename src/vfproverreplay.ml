@@ -0,0 +1,61 @@
+(* Replays a prover trace recorded with 'verifast -prover_trace' against a registered prover
+   and reports the latency of the prover calls, per kind of call.
+   Usage: vfprover-replay [-prover name] [-repeat n] trace *)
+
+open Printf
+
+(* The nearest-rank percentile of a sorted, nonempty array. *)
+let percentile sorted p =
+  let n = Array.length sorted in
+  let rank = int_of_float (ceil (p *. float_of_int n)) in
+  sorted.(max 0 (min (n - 1) (rank - 1)))
+
+let () =
+  let prover = ref Verifast.default_prover in
+  let repeat = ref 1 in
+  let paths = ref [] in
+  let usage = "Usage: vfprover-replay [options] trace\n" in
+  Arg.parse [
+    "-prover", Arg.String (fun s -> prover := s), "Replay the trace against the given prover (" ^ Verifast.list_provers () ^ ").";
+    "-repeat", Arg.Set_int repeat, "Replay the trace this many times, each time with a fresh prover."
+  ] (fun path -> paths := !paths @ [path]) usage;
+  let path = match !paths with [path] -> path | _ -> Arg.usage [] usage; exit 1 in
+  let ops = Provertrace.read_trace path in
+  let samples: (string, float list ref) Hashtbl.t = Hashtbl.create 32 in
+  let timer = {Provertrace.time = fun kind f ->
+    let t0 = Unix.gettimeofday () in
+    let result = f () in
+    let t = Unix.gettimeofday () -. t0 in
+    begin match Hashtbl.find_opt samples kind with
+      Some ts -> ts := t::!ts
+    | None -> Hashtbl.add samples kind (ref [t])
+    end;
+    result}
+  in
+  let mismatches = ref 0 in
+  for i = 1 to !repeat do
+    ignore (Verifast.lookup_prover !prover
+      (object
+        method run: 'typenode 'symbol 'termnode. ('typenode, 'symbol, 'termnode) Proverapi.context ->
+          ('termnode -> string) -> Stats.stats =
+          fun ctxt _ ->
+            mismatches := !mismatches + Provertrace.replay ctxt timer ops;
+            !Stats.stats
+      end))
+  done;
+  printf "%-22s %10s %10s %10s %10s %10s %10s\n" "Call" "Count" "Total (s)" "p50 (us)" "p90 (us)" "p99 (us)" "Max (us)";
+  let rows = Hashtbl.fold (fun kind ts rows -> (kind, Array.of_list !ts)::rows) samples [] in
+  let total = ref 0.0 in
+  List.iter
+    begin fun (kind, ts) ->
+      Array.sort compare ts;
+      let sum = Array.fold_left (+.) 0.0 ts in
+      total := !total +. sum;
+      let us t = t *. 1000000.0 in
+      printf "%-22s %10d %10.3f %10.1f %10.1f %10.1f %10.1f\n" kind (Array.length ts) sum
+        (us (percentile ts 0.5)) (us (percentile ts 0.9)) (us (percentile ts 0.99)) (us ts.(Array.length ts - 1))
+    end
+    (List.sort compare rows);
+  printf "Total prover time: %.3fs\n" !total;
+  if !mismatches > 0 then
+    printf "Answers that differ from the trace: %d\n" !mismatches
@@ -0,0 +1,93 @@
+// Run with -merge_states -stats: the statements after each if and switch statement below are verified once, for the
+// merged state of the paths through it, and the statistics report the symbolic execution forks that this avoided.
+
+#include <limits.h>
+
+struct counter {
+    int value;
+};
+
+int read_sensor();
+    //@ requires true;
+    //@ ensures true;
+
+int abs_value(int x)
+    //@ requires INT_MIN < x;
+    //@ ensures 0 <= result &*& result == x || result == -x;
+{
+    int y;
+    if (x < 0) {
+        y = -x;
+    } else {
+        y = x;
+    }
+    return y;
+}
+
+void bump(struct counter *c, int reset)
+    //@ requires c->value |-> ?v &*& 0 <= v &*& v < 1000;
+    //@ ensures c->value |-> ?v1 &*& 0 <= v1 &*& v1 <= 1000;
+{
+    if (reset != 0) {
+        c->value = 0;
+    } else {
+        c->value = c->value + 1;
+    }
+}
+
+int sample(int useDefault)
+    //@ requires true;
+    //@ ensures INT_MIN <= result &*& result <= INT_MAX;
+{
+    int r;
+    if (useDefault != 0) {
+        r = 42;
+    } else {
+        r = read_sensor();
+    }
+    return r;
+}
+
+int clamp_reading()
+    //@ requires true;
+    //@ ensures 0 <= result &*& result <= 100;
+{
+    int r = read_sensor();
+    int result;
+    if (r < 0) {
+        result = 0;
+    } else if (r > 100) {
+        result = 100;
+    } else {
+        result = r;
+    }
+    return result;
+}
+
+int days_in_month(int month)
+    //@ requires 1 <= month &*& month <= 12;
+    //@ ensures 28 <= result &*& result <= 31;
+{
+    int days;
+    switch (month) {
+        case 2:
+            days = 28;
+            break;
+        case 4:
+            days = 30;
+            break;
+        case 6:
+            days = 30;
+            break;
+        case 9:
+            days = 30;
+            break;
+        case 11:
+            days = 30;
+            break;
+        default:
+            days = 31;
+            break;
+    }
+    return days;
+}